@@ -108,6 +108,7 @@ class AddressIndexTest(BitcoinTestFramework):
         # Check that balances are correct
         balance0 = self.nodes[1].getaddressbalance("93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB")
         assert_equal(balance0["balance"], 45 * 100000000)
+        assert_equal(balance0["txcount"], 3)
 
         # Check that outputs with the same address will only return one txid
         print "Testing for txid uniqueness..."
@@ -183,6 +184,14 @@ class AddressIndexTest(BitcoinTestFramework):
         deltasAll = self.nodes[1].getaddressdeltas({"addresses": [address2]})
         assert_equal(len(deltasAll), len(deltas))
 
+        # Check that deltas can be paged through
+        page = self.nodes[1].getaddressdeltas({"addresses": [address2], "limit": 1})
+        pagedDeltas = page["deltas"]
+        while "cursor" in page:
+            page = self.nodes[1].getaddressdeltas({"addresses": [address2], "limit": 1, "cursor": page["cursor"]})
+            pagedDeltas += page["deltas"]
+        assert_equal(pagedDeltas, deltasAll)
+
         # Check that deltas can be returned from range of block heights
         deltas = self.nodes[1].getaddressdeltas({"addresses": [address2], "start": 113, "end": 113})
         assert_equal(len(deltas), 1)
@@ -8,6 +8,7 @@
 
 #include "uint256.h"
 #include "amount.h"
+#include "serialize.h"
 
 struct CMempoolAddressDelta
 {
@@ -54,6 +55,17 @@ struct CMempoolAddressDeltaKey
         index = 0;
         spending = 0;
     }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(type);
+        READWRITE(addressBytes);
+        READWRITE(txhash);
+        READWRITE(index);
+        READWRITE(spending);
+    }
 };
 
 struct CMempoolAddressDeltaKeyCompare
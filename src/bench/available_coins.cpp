@@ -0,0 +1,75 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "random.h"
+#include "script/standard.h"
+#include "validation.h"
+#include "wallet/wallet.h"
+
+static const int PAYMENT_CHAINS = 1000;
+static const int PAYMENT_CHAIN_LENGTH = 1000;
+static const int CHAIN_HEIGHT = 10;
+
+// 1000 chains of 1000 transactions each spending the previous one, all
+// confirmed: a 1M transaction history with only 1000 unspent outputs left
+static void LoadLongHistoryWallet(CWallet& wallet, const CKey& key, const uint256& hashBlock)
+{
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    LOCK(wallet.cs_wallet);
+    wallet.AddKey(key);
+    for (int i = 0; i < PAYMENT_CHAINS; i++) {
+        COutPoint prevout(GetRandHash(), 0);
+        for (int j = 0; j < PAYMENT_CHAIN_LENGTH; j++) {
+            CMutableTransaction tx;
+            tx.vin.push_back(CTxIn(prevout));
+            tx.vout.push_back(CTxOut(COIN, scriptPubKey));
+            CWalletTx wtx(&wallet, tx);
+            wtx.hashBlock = hashBlock;
+            wtx.nIndex = 0;
+            wallet.AddToWallet(wtx, true, NULL);
+            prevout = COutPoint(wtx.GetHash(), 0);
+        }
+    }
+}
+
+// What every coin selection starts with, on a wallet with a long history
+static void AvailableCoinsLongHistory(benchmark::State& state)
+{
+    std::vector<uint256> vecHashes(CHAIN_HEIGHT);
+    std::vector<CBlockIndex> vecIndex(CHAIN_HEIGHT);
+    {
+        LOCK(cs_main);
+        for (int i = 0; i < CHAIN_HEIGHT; i++) {
+            vecHashes[i] = GetRandHash();
+            vecIndex[i].phashBlock = &vecHashes[i];
+            vecIndex[i].nHeight = i;
+            vecIndex[i].pprev = i > 0 ? &vecIndex[i - 1] : NULL;
+            mapBlockIndex[vecHashes[i]] = &vecIndex[i];
+        }
+        chainActive.SetTip(&vecIndex.back());
+    }
+
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        CWallet wallet;
+        LoadLongHistoryWallet(wallet, key, vecHashes[0]);
+
+        // the first call after load indexes the whole history once
+        std::vector<COutput> vCoins;
+        wallet.AvailableCoins(vCoins);
+        while (state.KeepRunning()) {
+            wallet.AvailableCoins(vCoins);
+        }
+        assert(vCoins.size() == PAYMENT_CHAINS);
+    }
+
+    LOCK(cs_main);
+    chainActive.SetTip(NULL);
+    for (int i = 0; i < CHAIN_HEIGHT; i++)
+        mapBlockIndex.erase(vecHashes[i]);
+}
+
+BENCHMARK(AvailableCoinsLongHistory);
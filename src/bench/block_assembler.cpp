@@ -0,0 +1,81 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "miner.h"
+#include "random.h"
+#include "txmempool.h"
+
+static const int INDEPENDENT_TX_COUNT = 30000;
+static const int CPFP_PACKAGE_COUNT = 10000;
+
+static CMutableTransaction RandomTx(const COutPoint& prevout)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    std::vector<unsigned char> vch(GetRandInt(100) + 40);
+    GetRandBytes(&vch[0], vch.size());
+    tx.vin[0].scriptSig = CScript() << vch;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[0].nValue = COIN;
+    return tx;
+}
+
+static void AddToPool(CTxMemPool& pool, const CMutableTransaction& mtx, CAmount nFeePerByte)
+{
+    CTransaction tx(mtx);
+    CAmount nFee = nFeePerByte * ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, 0, 0, 1, pool.HasNoInputsOf(tx), 0, false, 1, LockPoints()));
+}
+
+// 50k transactions, far more than fit in a block: 30k independent ones paying
+// 10-200 duff/byte, and 10k free parents each with a child paying 100-600
+// duff/byte on its own size, which only package selection can pick up.
+static void FillMemPool(CTxMemPool& pool)
+{
+    for (int i = 0; i < INDEPENDENT_TX_COUNT; i++) {
+        AddToPool(pool, RandomTx(COutPoint(GetRandHash(), 0)), 10 + GetRandInt(191));
+    }
+    for (int i = 0; i < CPFP_PACKAGE_COUNT; i++) {
+        CMutableTransaction parent = RandomTx(COutPoint(GetRandHash(), 0));
+        AddToPool(pool, parent, 0);
+        AddToPool(pool, RandomTx(COutPoint(parent.GetHash(), 0)), 100 + GetRandInt(501));
+    }
+}
+
+static void AssembleBlock(benchmark::State& state, bool fPackageSelection)
+{
+    CTxMemPool pool(CFeeRate(0));
+    FillMemPool(pool);
+
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+    BlockAssembler assembler(chainparams, pool, fPackageSelection);
+    while (state.KeepRunning()) {
+        assembler.AddTransactions(1, 0);
+    }
+
+    // Ancestor feerate selection must never collect less than the legacy
+    // per-transaction score walk on the same mempool
+    if (fPackageSelection) {
+        BlockAssembler legacy(chainparams, pool, false);
+        legacy.AddTransactions(1, 0);
+        assert(assembler.GetFees() >= legacy.GetFees());
+    }
+}
+
+static void AssembleBlockByScore(benchmark::State& state)
+{
+    AssembleBlock(state, false);
+}
+
+static void AssembleBlockByAncestorScore(benchmark::State& state)
+{
+    AssembleBlock(state, true);
+}
+
+BENCHMARK(AssembleBlockByScore);
+BENCHMARK(AssembleBlockByAncestorScore);
@@ -0,0 +1,50 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "utilstrencodings.h"
+
+static const uint32_t NONCES_PER_ITERATION = 256;
+
+static CBlockHeader RandomHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 0;
+    return header;
+}
+
+// The nonce search as the miner used to do it, hashing the whole header
+static void SearchNoncesGetHash(benchmark::State& state)
+{
+    CBlockHeader header = RandomHeader();
+    while (state.KeepRunning()) {
+        for (uint32_t i = 0; i < NONCES_PER_ITERATION; i++) {
+            header.GetHash();
+            header.nNonce++;
+        }
+    }
+}
+
+// The same search from the blake512 midstate
+static void SearchNoncesMidstate(benchmark::State& state)
+{
+    CBlockHeader header = RandomHeader();
+    CX11HeaderHasher hasher((const unsigned char*)BEGIN(header.nVersion));
+    uint256 vHashes[NONCES_PER_ITERATION];
+    while (state.KeepRunning()) {
+        hasher.HashNonces(header.nNonce, NONCES_PER_ITERATION, vHashes);
+        header.nNonce += NONCES_PER_ITERATION;
+    }
+}
+
+BENCHMARK(SearchNoncesGetHash);
+BENCHMARK(SearchNoncesMidstate);
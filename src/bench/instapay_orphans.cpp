@@ -0,0 +1,39 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "instapay.h"
+#include "random.h"
+
+static const int ORPHAN_TX_COUNT = 2000;
+static const int VOTES_PER_TX = 10;
+
+// Lock requests arriving while 20000 orphan votes for 2000 other transactions
+// are waiting: look up and release the votes the request unblocks, then queue
+// them again to keep the orphan set at the same size
+static void ProcessOrphanTxLockVotes(benchmark::State& state)
+{
+    CTxLockVoteOrphans orphans;
+    std::vector<uint256> vecTxHashes;
+    std::vector<COutPoint> vecOutpoints;
+    for (int i = 0; i < ORPHAN_TX_COUNT; i++) {
+        vecTxHashes.push_back(GetRandHash());
+        vecOutpoints.push_back(COutPoint(GetRandHash(), 0));
+        for (int j = 0; j < VOTES_PER_TX; j++) {
+            orphans.AddWaitingForTx(CTxLockVote(vecTxHashes[i], vecOutpoints[i], COutPoint(GetRandHash(), 0)));
+        }
+    }
+
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        size_t i = n++ % vecTxHashes.size();
+        assert(orphans.CountVotesForTxAndOutPoint(vecTxHashes[i], vecOutpoints[i]) == VOTES_PER_TX);
+        std::vector<CTxLockVote> vecVotes = orphans.PopVotesForTx(vecTxHashes[i]);
+        for (const CTxLockVote& vote : vecVotes) {
+            orphans.AddWaitingForTx(vote);
+        }
+    }
+}
+
+BENCHMARK(ProcessOrphanTxLockVotes);
@@ -0,0 +1,84 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "tinyformat.h"
+#include "validation.h"
+
+#include "test/masternode_util.h"
+
+#include <atomic>
+
+#include <boost/thread.hpp>
+
+static const int MASTERNODE_COUNT = 5000;
+static const int RPC_THREADS = 4;
+
+static void FillMasternodeList(CMasternodeMan& man, std::vector<CTxIn>& vecVin)
+{
+    CService addr("10.0.0.1", 44444);
+    for (int i = 0; i < MASTERNODE_COUNT; i++) {
+        CMasternode mn(addr, CTxIn(COutPoint(GetRandHash(), 0)), RandomPubKey(), RandomPubKey(), PROTOCOL_VERSION);
+        man.Add(mn);
+        vecVin.push_back(mn.vin);
+    }
+}
+
+// What `masternodelist full` does with the list
+static void MasternodeListFull(CMasternodeMan& man, std::atomic<bool>& fStop)
+{
+    while (!fStop) {
+        CMasternodeListSnapshotRef snapshot = man.GetMasternodeListSnapshot();
+        std::string strList;
+        for (const CMasternode& mn : snapshot->vecMasternodes) {
+            strList += strprintf("%s %s %d %d %d %s\n", mn.vin.prevout.ToStringShort(), mn.GetStatus(), mn.nProtocolVersion,
+                                 mn.lastPing.sigTime, mn.GetLastPaidTime(), mn.addr.ToString());
+        }
+        boost::this_thread::interruption_point();
+    }
+}
+
+// Message handler work: lookups under cs_main and the list lock like MNPING
+// processing, with an occasional update that invalidates the published snapshot
+static void MasternodeHandler(benchmark::State& state, int nRpcThreads)
+{
+    CMasternodeMan man;
+    std::vector<CTxIn> vecVin;
+    FillMasternodeList(man, vecVin);
+
+    std::atomic<bool> fStop(false);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nRpcThreads; i++) {
+        threadGroup.create_thread(boost::bind(&MasternodeListFull, boost::ref(man), boost::ref(fStop)));
+    }
+
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        const CTxIn& vin = vecVin[n++ % vecVin.size()];
+        LOCK(cs_main);
+        if (n % 64 == 0) {
+            man.UpdateLastDsq(vin);
+        } else {
+            man.Has(vin);
+        }
+    }
+
+    fStop = true;
+    threadGroup.join_all();
+}
+
+static void MasternodeHandlerIdle(benchmark::State& state)
+{
+    MasternodeHandler(state, 0);
+}
+
+static void MasternodeHandlerUnderListLoad(benchmark::State& state)
+{
+    MasternodeHandler(state, RPC_THREADS);
+}
+
+BENCHMARK(MasternodeHandlerIdle);
+BENCHMARK(MasternodeHandlerUnderListLoad);
@@ -0,0 +1,53 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "validation.h"
+
+#include "test/masternode_util.h"
+
+static const int MASTERNODE_COUNT = 5000;
+static const int CHAIN_HEIGHT = 6000;
+
+// Pick the next payee out of 5000 masternodes with random last paid blocks,
+// as every masternode does for each new block
+static void GetNextMasternodeInQueueForPayment(benchmark::State& state)
+{
+    // a chain long enough for all collaterals to be mature
+    std::vector<uint256> vecHashes(CHAIN_HEIGHT);
+    std::vector<CBlockIndex> vecIndex(CHAIN_HEIGHT);
+    for (int i = 0; i < CHAIN_HEIGHT; i++) {
+        vecHashes[i] = GetRandHash();
+        vecIndex[i].phashBlock = &vecHashes[i];
+        vecIndex[i].nHeight = i;
+        vecIndex[i].pprev = i > 0 ? &vecIndex[i - 1] : NULL;
+    }
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&vecIndex.back());
+    }
+
+    CMasternodeMan man;
+    CService addr("10.0.0.1", 44444);
+    for (int i = 0; i < MASTERNODE_COUNT; i++) {
+        CMasternode mn(addr, CTxIn(COutPoint(GetRandHash(), 0)), RandomPubKey(), RandomPubKey(), PROTOCOL_VERSION);
+        mn.sigTime = 0;
+        mn.nCacheCollateralBlock = 1;
+        mn.nBlockLastPaid = GetRandInt(CHAIN_HEIGHT);
+        man.Add(mn);
+    }
+
+    int nCount = 0;
+    while (state.KeepRunning()) {
+        man.GetNextMasternodeInQueueForPayment(CHAIN_HEIGHT + 10, true, nCount);
+    }
+    assert(nCount == MASTERNODE_COUNT);
+
+    LOCK(cs_main);
+    chainActive.SetTip(NULL);
+}
+
+BENCHMARK(GetNextMasternodeInQueueForPayment);
@@ -0,0 +1,85 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "privatepay.h"
+#include "random.h"
+#include "script/standard.h"
+#include "wallet/wallet.h"
+
+static const int MIXING_CHAINS = 200;
+static const int MIXING_ROUNDS = 8;
+static const int DENOMS_PER_TX = 10;
+
+// 200 chains of a denominating transaction followed by 8 mixing rounds of 10
+// outputs each: 2000 unspent fully mixed outputs on top of 16000 spent ones
+static std::vector<CMutableTransaction> MixedWalletTxs(const CScript& scriptPubKey)
+{
+    const CAmount nDenom = CPrivatePay::GetSmallestDenomination();
+    std::vector<CMutableTransaction> vTxs;
+    for (int i = 0; i < MIXING_CHAINS; i++) {
+        CMutableTransaction tx;
+        tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        tx.vout.assign(DENOMS_PER_TX, CTxOut(nDenom, scriptPubKey));
+        tx.vout.push_back(CTxOut(COIN, scriptPubKey));
+        vTxs.push_back(tx);
+        for (int nRound = 0; nRound < MIXING_ROUNDS; nRound++) {
+            uint256 hashPrev = vTxs.back().GetHash();
+            CMutableTransaction mix;
+            for (int n = 0; n < DENOMS_PER_TX; n++)
+                mix.vin.push_back(CTxIn(COutPoint(hashPrev, n)));
+            mix.vout.assign(DENOMS_PER_TX, CTxOut(nDenom, scriptPubKey));
+            vTxs.push_back(mix);
+        }
+    }
+    return vTxs;
+}
+
+static void LoadMixedWallet(CWallet& wallet, const CKey& key, const std::vector<CMutableTransaction>& vTxs)
+{
+    LOCK(wallet.cs_wallet);
+    wallet.AddKey(key);
+    for (size_t i = 0; i < vTxs.size(); i++) {
+        wallet.AddToWallet(CWalletTx(&wallet, vTxs[i]), true, NULL);
+    }
+}
+
+// The balance and rounds the PrivatePay UI and mixing loop refresh all the time
+static void QueryAnonymizedBalance(const CWallet& wallet)
+{
+    wallet.GetNormalizedAnonymizedBalance();
+    wallet.GetAverageAnonymizedRounds();
+}
+
+static void PrivatePayBalance(benchmark::State& state)
+{
+    CPrivatePay::InitStandardDenominations();
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<CMutableTransaction> vTxs = MixedWalletTxs(GetScriptForDestination(key.GetPubKey().GetID()));
+
+    CWallet wallet;
+    LoadMixedWallet(wallet, key, vTxs);
+    while (state.KeepRunning()) {
+        QueryAnonymizedBalance(wallet);
+    }
+}
+
+// First query after startup, which has to walk every mixing chain
+static void PrivatePayBalanceAfterLoad(benchmark::State& state)
+{
+    CPrivatePay::InitStandardDenominations();
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<CMutableTransaction> vTxs = MixedWalletTxs(GetScriptForDestination(key.GetPubKey().GetID()));
+
+    while (state.KeepRunning()) {
+        CWallet wallet;
+        LoadMixedWallet(wallet, key, vTxs);
+        QueryAnonymizedBalance(wallet);
+    }
+}
+
+BENCHMARK(PrivatePayBalance);
+BENCHMARK(PrivatePayBalanceAfterLoad);
@@ -0,0 +1,153 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "chainparamsbase.h"
+#include "consensus/merkle.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "versionbits.h"
+
+#include <boost/filesystem.hpp>
+
+static const int IMPORT_BLOCK_COUNT = 2000;
+static const int IMPORT_TX_COUNT = 20;
+
+static CBlock CreateBlock(const CChainParams& chainparams, const CBlock& prev, int nHeight)
+{
+    CBlock block;
+    block.nVersion = VERSIONBITS_TOP_BITS;
+    block.hashPrevBlock = prev.GetHash();
+    block.nTime = prev.nTime + chainparams.GetConsensus().nPowTargetSpacing;
+    block.nBits = prev.nBits;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(coinbase);
+
+    // the inputs are never looked up, importing a block only checks it on its own
+    for (int i = 0; i < IMPORT_TX_COUNT; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = tx.vout[1].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = tx.vout[1].nValue = COIN;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus()))
+        ++block.nNonce;
+    return block;
+}
+
+// Selects regtest and a temporary -datadir, and puts back what the process had
+// before when it goes out of scope
+class CRegTestDatadir
+{
+private:
+    std::string strNetworkPrev;
+    bool fDatadirPrev;
+    std::string strDatadirPrev;
+
+public:
+    boost::filesystem::path path;
+
+    CRegTestDatadir()
+    {
+        if (AreBaseParamsConfigured())
+            strNetworkPrev = Params().NetworkIDString();
+        fDatadirPrev = mapArgs.count("-datadir");
+        if (fDatadirPrev)
+            strDatadirPrev = mapArgs["-datadir"];
+
+        SelectParams(CBaseChainParams::REGTEST);
+        ClearDatadirCache();
+        path = GetTempPath() / strprintf("bench_pura_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(path);
+        mapArgs["-datadir"] = path.string();
+    }
+
+    ~CRegTestDatadir()
+    {
+        boost::filesystem::remove_all(path);
+        if (fDatadirPrev)
+            mapArgs["-datadir"] = strDatadirPrev;
+        else
+            mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        // there is no way back to no network at all
+        if (!strNetworkPrev.empty())
+            SelectParams(strNetworkPrev);
+    }
+};
+
+// Reindex a block file of 2000 regtest blocks with 21 transactions each into
+// an empty block index, with the given number of -par threads. Each iteration
+// is one reindex of the 2001 blocks.
+static void ReindexBlockFile(benchmark::State& state, int nThreads)
+{
+    CRegTestDatadir datadir;
+    const CChainParams& chainparams = Params();
+
+    pblocktree = new CBlockTreeDB(1 << 20, 1 << 20, 1 << 20, 1 << 20, true);
+    CCoinsViewDB* pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+
+    // blk00000.dat as written by a node that synced the chain
+    {
+        CAutoFile fileout(OpenBlockFile(CDiskBlockPos(0, 0)), SER_DISK, CLIENT_VERSION);
+        CBlock block = chainparams.GenesisBlock();
+        for (int nHeight = 0; nHeight <= IMPORT_BLOCK_COUNT; nHeight++) {
+            if (nHeight > 0)
+                block = CreateBlock(chainparams, block, nHeight);
+            fileout << FLATDATA(chainparams.MessageStart()) << (unsigned int)fileout.GetSerializeSize(block) << block;
+        }
+    }
+
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+
+        CDiskBlockPos pos(0, 0);
+        LoadExternalBlockFile(chainparams, OpenBlockFile(pos, true), &pos);
+        assert(mapBlockIndex.size() == IMPORT_BLOCK_COUNT + 1);
+    }
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pcoinsTip = NULL;
+    pblocktree = NULL;
+}
+
+static void ReindexBlockFileSerial(benchmark::State& state)
+{
+    ReindexBlockFile(state, 0);
+}
+
+static void ReindexBlockFileParallel(benchmark::State& state)
+{
+    ReindexBlockFile(state, 4);
+}
+
+BENCHMARK(ReindexBlockFileSerial);
+BENCHMARK(ReindexBlockFileParallel);
@@ -0,0 +1,42 @@
+/**
+ * Run-time selection of the AES-NI code paths, see sph_aes_ni.h.
+ *
+ * @file     aes_ni.c
+ */
+
+#include "sph_aes_ni.h"
+
+#if SPH_AES_NI
+
+volatile int sph_aes_ni_state = -1;
+
+int
+sph_aes_ni_supported(void)
+{
+	unsigned a, b, c, d;
+
+	return __get_cpuid(1, &a, &b, &c, &d)
+		&& (c & bit_AES) != 0 && (c & bit_SSSE3) != 0;
+}
+
+void
+sph_aes_ni_enable(int enable)
+{
+	sph_aes_ni_state = enable && sph_aes_ni_supported();
+}
+
+#else
+
+int
+sph_aes_ni_supported(void)
+{
+	return 0;
+}
+
+void
+sph_aes_ni_enable(int enable)
+{
+	(void)enable;
+}
+
+#endif
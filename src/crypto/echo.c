@@ -35,6 +35,7 @@
 #include <limits.h>
 
 #include "sph_echo.h"
+#include "sph_aes_ni.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -719,11 +720,98 @@ echo_small_compress(sph_echo_small_context *sc)
 	COMPRESS_SMALL(sc);
 }
 
+#if SPH_AES_NI
+
+#define XTIME_NI(x)   _mm_xor_si128(_mm_add_epi8(x, x), \
+		_mm_and_si128(_mm_cmplt_epi8(x, _mm_setzero_si128()), \
+		_mm_set1_epi8(0x1B)))
+
+/*
+ * Same computation as COMPRESS_BIG, with the 128-bit words kept in SSE
+ * registers: BIG.SubWords is two AESENC per word (the counter as round
+ * key, then an all-zero key), and BIG.MixColumns uses byte-wise SSE2
+ * doubling in GF(2^8).
+ */
+static SPH_AES_NI_TARGET void
+echo_big_compress_aesni(sph_echo_big_context *sc)
+{
+	unsigned char *V = (unsigned char *)&sc->u;
+	__m128i W[16];
+	__m128i zero = _mm_setzero_si128();
+	sph_u32 K0 = sc->C0;
+	sph_u32 K1 = sc->C1;
+	sph_u32 K2 = sc->C2;
+	sph_u32 K3 = sc->C3;
+	unsigned u, n;
+
+	for (n = 0; n < 8; n ++) {
+		W[n] = _mm_loadu_si128((const __m128i *)(V + 16 * n));
+		W[n + 8] = _mm_loadu_si128((const __m128i *)(sc->buf + 16 * n));
+	}
+	for (u = 0; u < 10; u ++) {
+		__m128i t;
+
+		for (n = 0; n < 16; n ++) {
+			__m128i K = _mm_set_epi32((int)K3, (int)K2,
+				(int)K1, (int)K0);
+
+			W[n] = _mm_aesenc_si128(_mm_aesenc_si128(W[n], K), zero);
+			if ((K0 = T32(K0 + 1)) == 0) {
+				if ((K1 = T32(K1 + 1)) == 0)
+					if ((K2 = T32(K2 + 1)) == 0)
+						K3 = T32(K3 + 1);
+			}
+		}
+
+		t = W[1]; W[1] = W[5]; W[5] = W[9]; W[9] = W[13]; W[13] = t;
+		t = W[2]; W[2] = W[10]; W[10] = t;
+		t = W[6]; W[6] = W[14]; W[14] = t;
+		t = W[15]; W[15] = W[11]; W[11] = W[7]; W[7] = W[3]; W[3] = t;
+
+		for (n = 0; n < 16; n += 4) {
+			__m128i a = W[n];
+			__m128i b = W[n + 1];
+			__m128i c = W[n + 2];
+			__m128i d = W[n + 3];
+			__m128i ab = _mm_xor_si128(a, b);
+			__m128i bc = _mm_xor_si128(b, c);
+			__m128i cd = _mm_xor_si128(c, d);
+			__m128i abx = XTIME_NI(ab);
+			__m128i bcx = XTIME_NI(bc);
+			__m128i cdx = XTIME_NI(cd);
+
+			W[n] = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+			W[n + 1] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+			W[n + 2] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+			W[n + 3] = _mm_xor_si128(_mm_xor_si128(abx, bcx),
+				_mm_xor_si128(_mm_xor_si128(cdx, ab), c));
+		}
+	}
+	for (n = 0; n < 8; n ++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(V + 16 * n));
+
+		v = _mm_xor_si128(v,
+			_mm_loadu_si128((const __m128i *)(sc->buf + 16 * n)));
+		v = _mm_xor_si128(v, _mm_xor_si128(W[n], W[n + 8]));
+		_mm_storeu_si128((__m128i *)(V + 16 * n), v);
+	}
+}
+
+#undef XTIME_NI
+
+#endif
+
 static void
 echo_big_compress(sph_echo_big_context *sc)
 {
 	DECL_STATE_BIG
 
+#if SPH_AES_NI
+	if (sph_aes_ni_available()) {
+		echo_big_compress_aesni(sc);
+		return;
+	}
+#endif
 	COMPRESS_BIG(sc);
 }
 
@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "sph_groestl.h"
+#include "sph_aes_ni.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -2734,6 +2735,197 @@ static const sph_u32 T3dn[] = {
 
 #endif
 
+#if SPH_AES_NI && SPH_GROESTL_64 && USE_LE
+
+#define SPH_GROESTL_AES_NI   1
+
+/*
+ * AES-NI variant of the Groestl-512 permutations. The state is held
+ * as eight 128-bit rows (row i holds byte i of all sixteen columns).
+ * SubBytes is AESENCLAST with an all-zero key, applied after an
+ * inverse AES ShiftRows so that only the S-box remains; ShiftBytes is
+ * one PALIGNR per row; MixBytes uses byte-wise doubling in GF(2^8).
+ */
+
+#define XTIME_NI(x)   _mm_xor_si128(_mm_add_epi8(x, x), \
+		_mm_and_si128(_mm_cmplt_epi8(x, _mm_setzero_si128()), \
+		_mm_set1_epi8(0x1B)))
+
+/*
+ * Convert between the column representation (sixteen 8-byte columns,
+ * as in H[]) and eight row registers. Each 16-byte load holds two
+ * columns; interleaving their bytes turns the problem into an 8x8
+ * transposition of 16-bit words.
+ */
+#define TRANSPOSE_WORDS_NI(a)   do { \
+		__m128i b0, b1, b2, b3, b4, b5, b6, b7; \
+		b0 = _mm_unpacklo_epi16(a[0], a[1]); \
+		b1 = _mm_unpackhi_epi16(a[0], a[1]); \
+		b2 = _mm_unpacklo_epi16(a[2], a[3]); \
+		b3 = _mm_unpackhi_epi16(a[2], a[3]); \
+		b4 = _mm_unpacklo_epi16(a[4], a[5]); \
+		b5 = _mm_unpackhi_epi16(a[4], a[5]); \
+		b6 = _mm_unpacklo_epi16(a[6], a[7]); \
+		b7 = _mm_unpackhi_epi16(a[6], a[7]); \
+		a[0] = _mm_unpacklo_epi32(b0, b2); \
+		a[1] = _mm_unpackhi_epi32(b0, b2); \
+		a[2] = _mm_unpacklo_epi32(b1, b3); \
+		a[3] = _mm_unpackhi_epi32(b1, b3); \
+		a[4] = _mm_unpacklo_epi32(b4, b6); \
+		a[5] = _mm_unpackhi_epi32(b4, b6); \
+		a[6] = _mm_unpacklo_epi32(b5, b7); \
+		a[7] = _mm_unpackhi_epi32(b5, b7); \
+		b0 = _mm_unpacklo_epi64(a[0], a[4]); \
+		b1 = _mm_unpackhi_epi64(a[0], a[4]); \
+		b2 = _mm_unpacklo_epi64(a[1], a[5]); \
+		b3 = _mm_unpackhi_epi64(a[1], a[5]); \
+		b4 = _mm_unpacklo_epi64(a[2], a[6]); \
+		b5 = _mm_unpackhi_epi64(a[2], a[6]); \
+		b6 = _mm_unpacklo_epi64(a[3], a[7]); \
+		b7 = _mm_unpackhi_epi64(a[3], a[7]); \
+		a[0] = b0; a[1] = b1; a[2] = b2; a[3] = b3; \
+		a[4] = b4; a[5] = b5; a[6] = b6; a[7] = b7; \
+	} while (0)
+
+/*
+ * MixBytes with circ(02, 02, 03, 04, 05, 03, 05, 07), in Horner form:
+ * out[i] = S1 ^ 2.(S2 ^ 2.S4), where, with offsets taken mod 8,
+ * S1 = R[i+2] ^ R[i+4] ^ R[i+5] ^ R[i+6] ^ R[i+7],
+ * S2 = R[i] ^ R[i+1] ^ R[i+2] ^ R[i+5] ^ R[i+7],
+ * S4 = R[i+3] ^ R[i+4] ^ R[i+6] ^ R[i+7].
+ */
+#define MIX_ROW_NI(i)   do { \
+		__m128i s4 = _mm_xor_si128(T[((i) + 3) & 7], T[((i) + 6) & 7]); \
+		__m128i s2 = _mm_xor_si128(_mm_xor_si128(T[i], R[((i) + 2) & 7]), \
+			_mm_xor_si128(R[((i) + 5) & 7], R[((i) + 7) & 7])); \
+		__m128i s1 = _mm_xor_si128(R[((i) + 2) & 7], \
+			_mm_xor_si128(T[((i) + 4) & 7], T[((i) + 6) & 7])); \
+		O[i] = _mm_xor_si128(s1, XTIME_NI(_mm_xor_si128(s2, \
+			XTIME_NI(s4)))); \
+	} while (0)
+
+static SPH_AES_NI_TARGET __attribute__((always_inline)) inline void
+groestl_big_perm_aesni(unsigned char *a, const int q)
+{
+	__m128i R[8], T[8], O[8];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8((char)0xFF);
+	const __m128i inv_shift_rows = _mm_setr_epi8(
+		0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+	const __m128i interleave = _mm_setr_epi8(
+		0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+	const __m128i deinterleave = _mm_setr_epi8(
+		0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+	const __m128i col_const = _mm_setr_epi8(
+		0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70,
+		(char)0x80, (char)0x90, (char)0xA0, (char)0xB0,
+		(char)0xC0, (char)0xD0, (char)0xE0, (char)0xF0);
+	const __m128i cc = q ? _mm_xor_si128(col_const, ones) : col_const;
+	int r, i;
+
+	for (i = 0; i < 8; i ++)
+		R[i] = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(a + (i << 4))),
+			interleave);
+	TRANSPOSE_WORDS_NI(R);
+
+	for (r = 0; r < 14; r ++) {
+		__m128i rc = _mm_xor_si128(cc, _mm_set1_epi8((char)r));
+
+		/* AddRoundConstant */
+		if (q) {
+			for (i = 0; i < 7; i ++)
+				R[i] = _mm_xor_si128(R[i], ones);
+			R[7] = _mm_xor_si128(R[7], rc);
+		} else {
+			R[0] = _mm_xor_si128(R[0], rc);
+		}
+
+		/* SubBytes */
+		for (i = 0; i < 8; i ++)
+			R[i] = _mm_aesenclast_si128(
+				_mm_shuffle_epi8(R[i], inv_shift_rows), zero);
+
+		/* ShiftBytes */
+		if (q) {
+			R[0] = _mm_alignr_epi8(R[0], R[0], 1);
+			R[1] = _mm_alignr_epi8(R[1], R[1], 3);
+			R[2] = _mm_alignr_epi8(R[2], R[2], 5);
+			R[3] = _mm_alignr_epi8(R[3], R[3], 11);
+			R[5] = _mm_alignr_epi8(R[5], R[5], 2);
+			R[6] = _mm_alignr_epi8(R[6], R[6], 4);
+			R[7] = _mm_alignr_epi8(R[7], R[7], 6);
+		} else {
+			R[1] = _mm_alignr_epi8(R[1], R[1], 1);
+			R[2] = _mm_alignr_epi8(R[2], R[2], 2);
+			R[3] = _mm_alignr_epi8(R[3], R[3], 3);
+			R[4] = _mm_alignr_epi8(R[4], R[4], 4);
+			R[5] = _mm_alignr_epi8(R[5], R[5], 5);
+			R[6] = _mm_alignr_epi8(R[6], R[6], 6);
+			R[7] = _mm_alignr_epi8(R[7], R[7], 11);
+		}
+
+		/* MixBytes */
+		for (i = 0; i < 8; i ++)
+			T[i] = _mm_xor_si128(R[i], R[(i + 1) & 7]);
+		MIX_ROW_NI(0);
+		MIX_ROW_NI(1);
+		MIX_ROW_NI(2);
+		MIX_ROW_NI(3);
+		MIX_ROW_NI(4);
+		MIX_ROW_NI(5);
+		MIX_ROW_NI(6);
+		MIX_ROW_NI(7);
+		for (i = 0; i < 8; i ++)
+			R[i] = O[i];
+	}
+
+	TRANSPOSE_WORDS_NI(R);
+	for (i = 0; i < 8; i ++)
+		_mm_storeu_si128((__m128i *)(a + (i << 4)),
+			_mm_shuffle_epi8(R[i], deinterleave));
+}
+
+#undef XTIME_NI
+#undef TRANSPOSE_WORDS_NI
+#undef MIX_ROW_NI
+
+/*
+ * Same computation as COMPRESS_BIG; H is the chaining value in the
+ * little-endian column representation.
+ */
+static SPH_AES_NI_TARGET void
+groestl_big_compress_aesni(sph_u64 *H, const unsigned char *buf)
+{
+	sph_u64 g[16], m[16];
+	size_t u;
+
+	memcpy(m, buf, sizeof m);
+	for (u = 0; u < 16; u ++)
+		g[u] = m[u] ^ H[u];
+	groestl_big_perm_aesni((unsigned char *)g, 0);
+	groestl_big_perm_aesni((unsigned char *)m, 1);
+	for (u = 0; u < 16; u ++)
+		H[u] ^= g[u] ^ m[u];
+}
+
+/*
+ * Same computation as FINAL_BIG.
+ */
+static SPH_AES_NI_TARGET void
+groestl_big_final_aesni(sph_u64 *H)
+{
+	sph_u64 x[16];
+	size_t u;
+
+	memcpy(x, H, sizeof x);
+	groestl_big_perm_aesni((unsigned char *)x, 0);
+	for (u = 0; u < 16; u ++)
+		H[u] ^= x[u];
+}
+
+#endif
+
 static void
 groestl_small_init(sph_groestl_small_context *sc, unsigned out_size)
 {
@@ -2931,6 +3123,11 @@ groestl_big_core(sph_groestl_big_context *sc, const void *data, size_t len)
 		data = (const unsigned char *)data + clen;
 		len -= clen;
 		if (ptr == sizeof sc->buf) {
+#if SPH_GROESTL_AES_NI
+			if (sph_aes_ni_available())
+				groestl_big_compress_aesni(H, buf);
+			else
+#endif
 			COMPRESS_BIG;
 #if SPH_64
 			sc->count ++;
@@ -2994,6 +3191,11 @@ groestl_big_close(sph_groestl_big_context *sc,
 #endif
 	groestl_big_core(sc, pad, pad_len);
 	READ_STATE_BIG(sc);
+#if SPH_GROESTL_AES_NI
+	if (sph_aes_ni_available())
+		groestl_big_final_aesni(H);
+	else
+#endif
 	FINAL_BIG;
 #if SPH_GROESTL_64
 	for (u = 0; u < 8; u ++)
@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "sph_shavite.h"
+#include "sph_aes_ni.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -1475,6 +1476,127 @@ c512(sph_shavite_big_context *sc, const void *msg)
 
 #endif
 
+#if SPH_AES_NI
+
+/*
+ * Same computation as c512(), with AES_ROUND_NOKEY done by AESENC with
+ * an all-zero round key. The state is held as four 128-bit words
+ * (p0..p3, p4..p7, p8..pB, pC..pF).
+ */
+static SPH_AES_NI_TARGET void
+c512_aesni(sph_shavite_big_context *sc, const void *msg)
+{
+	sph_u32 rk[448] __attribute__((aligned(16)));
+	__m128i P0, P1, P2, P3, x, t;
+	__m128i zero = _mm_setzero_si128();
+	size_t u;
+	int r, s;
+
+#if SPH_LITTLE_ENDIAN
+	memcpy(rk, msg, 128);
+#else
+	for (u = 0; u < 32; u ++)
+		rk[u] = sph_dec32le_aligned((const unsigned char *)msg + (u << 2));
+#endif
+	u = 32;
+	for (;;) {
+		for (s = 0; s < 8; s ++) {
+			/* x = AES(rk[u - 31], rk[u - 30], rk[u - 29], rk[u - 32]) */
+			x = _mm_shuffle_epi32(
+				_mm_load_si128((const __m128i *)(rk + u - 32)), 0x39);
+			x = _mm_aesenc_si128(x, zero);
+			x = _mm_xor_si128(x,
+				_mm_load_si128((const __m128i *)(rk + u - 4)));
+			_mm_store_si128((__m128i *)(rk + u), x);
+			if (u == 32) {
+				rk[ 32] ^= sc->count0;
+				rk[ 33] ^= sc->count1;
+				rk[ 34] ^= sc->count2;
+				rk[ 35] ^= SPH_T32(~sc->count3);
+			} else if (u == 164) {
+				rk[164] ^= sc->count3;
+				rk[165] ^= sc->count2;
+				rk[166] ^= sc->count1;
+				rk[167] ^= SPH_T32(~sc->count0);
+			} else if (u == 316) {
+				rk[316] ^= sc->count2;
+				rk[317] ^= sc->count3;
+				rk[318] ^= sc->count0;
+				rk[319] ^= SPH_T32(~sc->count1);
+			} else if (u == 440) {
+				rk[440] ^= sc->count1;
+				rk[441] ^= sc->count0;
+				rk[442] ^= sc->count3;
+				rk[443] ^= SPH_T32(~sc->count2);
+			}
+			u += 4;
+		}
+		if (u == 448)
+			break;
+		for (s = 0; s < 8; s ++) {
+			x = _mm_xor_si128(
+				_mm_load_si128((const __m128i *)(rk + u - 32)),
+				_mm_loadu_si128((const __m128i *)(rk + u - 7)));
+			_mm_store_si128((__m128i *)(rk + u), x);
+			u += 4;
+		}
+	}
+
+	P0 = _mm_loadu_si128((const __m128i *)(sc->h + 0x0));
+	P1 = _mm_loadu_si128((const __m128i *)(sc->h + 0x4));
+	P2 = _mm_loadu_si128((const __m128i *)(sc->h + 0x8));
+	P3 = _mm_loadu_si128((const __m128i *)(sc->h + 0xC));
+	u = 0;
+	for (r = 0; r < 14; r ++) {
+#define C512_ELT_NI(l, r)   do { \
+		x = _mm_xor_si128(r, \
+			_mm_load_si128((const __m128i *)(rk + u))); \
+		x = _mm_aesenc_si128(x, \
+			_mm_load_si128((const __m128i *)(rk + u + 4))); \
+		x = _mm_aesenc_si128(x, \
+			_mm_load_si128((const __m128i *)(rk + u + 8))); \
+		x = _mm_aesenc_si128(x, \
+			_mm_load_si128((const __m128i *)(rk + u + 12))); \
+		x = _mm_aesenc_si128(x, zero); \
+		l = _mm_xor_si128(l, x); \
+		u += 16; \
+	} while (0)
+
+		C512_ELT_NI(P0, P1);
+		C512_ELT_NI(P2, P3);
+
+#undef C512_ELT_NI
+
+		t = P3;
+		P3 = P2;
+		P2 = P1;
+		P1 = P0;
+		P0 = t;
+	}
+	_mm_storeu_si128((__m128i *)(sc->h + 0x0), _mm_xor_si128(P0,
+		_mm_loadu_si128((const __m128i *)(sc->h + 0x0))));
+	_mm_storeu_si128((__m128i *)(sc->h + 0x4), _mm_xor_si128(P1,
+		_mm_loadu_si128((const __m128i *)(sc->h + 0x4))));
+	_mm_storeu_si128((__m128i *)(sc->h + 0x8), _mm_xor_si128(P2,
+		_mm_loadu_si128((const __m128i *)(sc->h + 0x8))));
+	_mm_storeu_si128((__m128i *)(sc->h + 0xC), _mm_xor_si128(P3,
+		_mm_loadu_si128((const __m128i *)(sc->h + 0xC))));
+}
+
+#endif
+
+static void
+shavite_big_compress(sph_shavite_big_context *sc, const void *msg)
+{
+#if SPH_AES_NI
+	if (sph_aes_ni_available()) {
+		c512_aesni(sc, msg);
+		return;
+	}
+#endif
+	c512(sc, msg);
+}
+
 static void
 shavite_small_init(sph_shavite_small_context *sc, const sph_u32 *iv)
 {
@@ -1590,7 +1712,7 @@ shavite_big_core(sph_shavite_big_context *sc, const void *data, size_t len)
 					}
 				}
 			}
-			c512(sc, buf);
+			shavite_big_compress(sc, buf);
 			ptr = 0;
 		}
 	}
@@ -1624,7 +1746,7 @@ shavite_big_close(sph_shavite_big_context *sc,
 	} else {
 		buf[ptr ++] = z;
 		memset(buf + ptr, 0, 128 - ptr);
-		c512(sc, buf);
+		shavite_big_compress(sc, buf);
 		memset(buf, 0, 110);
 		sc->count0 = sc->count1 = sc->count2 = sc->count3 = 0;
 	}
@@ -1634,7 +1756,7 @@ shavite_big_close(sph_shavite_big_context *sc,
 	sph_enc32le(buf + 122, count3);
 	buf[126] = out_size_w32 << 5;
 	buf[127] = out_size_w32 >> 3;
-	c512(sc, buf);
+	shavite_big_compress(sc, buf);
 	for (u = 0; u < out_size_w32; u ++)
 		sph_enc32le((unsigned char *)dst + (u << 2), sc->h[u]);
 }
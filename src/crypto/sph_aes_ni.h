@@ -0,0 +1,77 @@
+/**
+ * Runtime selection of the AES-NI code paths of the AES-based X11
+ * stages (Groestl, ECHO, SHAvite-3).
+ *
+ * On x86 with a GCC-compatible compiler, those functions carry a
+ * second implementation of their compression function built on the
+ * AES-NI and SSSE3 instructions. It is compiled with a per-function
+ * target attribute, so the rest of the code needs no special compiler
+ * flags, and it is only used when CPUID reports both extensions. The
+ * results are bit-for-bit identical to the table-based code, which
+ * sph_aes_ni_enable() can force at run time. Define SPH_NO_AES_NI to
+ * build the table-based code only.
+ *
+ * @file     sph_aes_ni.h
+ */
+
+#ifndef SPH_AES_NI_H__
+#define SPH_AES_NI_H__
+
+#if !defined SPH_AES_NI && !defined SPH_NO_AES_NI && defined __GNUC__ \
+	&& (defined __x86_64__ || defined __i386__)
+#define SPH_AES_NI   1
+#endif
+
+#if SPH_AES_NI
+
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#define SPH_AES_NI_TARGET   __attribute__((target("aes,ssse3")))
+
+#endif
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * Returns non-zero when the CPU implements AES-NI and SSSE3, and the
+ * AES-NI code paths were compiled in.
+ */
+int sph_aes_ni_supported(void);
+
+/**
+ * Turns the AES-NI code paths on or off. They are on by default when
+ * supported; turning them off forces the table-based code, so that
+ * both paths can be checked on the same machine. Turning them on has
+ * no effect when they are not supported.
+ *
+ * @param enable   non-zero to use AES-NI when it is supported
+ */
+void sph_aes_ni_enable(int enable);
+
+#if SPH_AES_NI
+
+/*
+ * -1 until first queried, then non-zero when the AES-NI code paths are
+ * used. Concurrent first queries all store the same value.
+ */
+extern volatile int sph_aes_ni_state;
+
+static inline int
+sph_aes_ni_available(void)
+{
+	if (sph_aes_ni_state < 0)
+		sph_aes_ni_state = sph_aes_ni_supported();
+	return sph_aes_ni_state;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,7 @@
 #define GOVERNANCE_VOTE_H
 
 #include "key.h"
+#include "messagesigqueue.h"
 #include "primitives/transaction.h"
 
 #include <boost/lexical_cast.hpp>
@@ -102,6 +103,9 @@ private:
     std::vector<unsigned char> vchSig;
 
 public:
+    // result of an earlier check on the signature queue, not serialized
+    CCheckedSignature checkedSig;
+
     CGovernanceVote();
     CGovernanceVote(CTxIn vinMasternodeIn, uint256 nParentHashIn, vote_signal_enum_t eVoteSignalIn, vote_outcome_enum_t eVoteOutcomeIn);
 
@@ -121,6 +125,10 @@ public:
 
     void SetSignature(const std::vector<unsigned char>& vchSigIn) { vchSig = vchSigIn; }
 
+    const std::vector<unsigned char>& GetSignature() const { return vchSig; }
+
+    std::string GetSignatureMessage() const;
+
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool IsValid(bool fSignatureCheck) const;
     void Relay() const;
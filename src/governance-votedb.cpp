@@ -4,33 +4,131 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "governance-votedb.h"
+#include "util.h"
+
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_VOTE = 'v';
+
+CGovernanceVoteDB* pgovernancevotedb = NULL;
+
+CGovernanceVoteDB::CGovernanceVoteDB(size_t nCacheSize, bool fMemory, bool fWipe)
+    : CDBWrapper(GetDataDir() / "governance", nCacheSize, fMemory, fWipe)
+{}
+
+bool CGovernanceVoteDB::WriteVotes(const std::vector<CGovernanceVote>& vecVotes)
+{
+    CDBBatch batch(&GetObfuscateKey());
+    for(size_t i = 0; i < vecVotes.size(); ++i) {
+        batch.Write(std::make_pair(DB_VOTE, std::make_pair(vecVotes[i].GetParentHash(), vecVotes[i].GetHash())), vecVotes[i]);
+    }
+    // Not synced, this runs on every flush with cs held. governance.dat,
+    // which refers to the flushed votes by hash only, is written on shutdown
+    // right after SyncVotes().
+    return WriteBatch(batch);
+}
+
+bool CGovernanceVoteDB::SyncVotes()
+{
+    try {
+        return Sync();
+    } catch(const dbwrapper_error& e) {
+        return error("CGovernanceVoteDB::SyncVotes -- %s", e.what());
+    }
+}
+
+bool CGovernanceVoteDB::ReadVote(const uint256& nParentHash, const uint256& nHash, CGovernanceVote& vote)
+{
+    return Read(std::make_pair(DB_VOTE, std::make_pair(nParentHash, nHash)), vote);
+}
+
+bool CGovernanceVoteDB::ReadVotes(const uint256& nParentHash, std::vector<CGovernanceVote>& vecVotes)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_VOTE, std::make_pair(nParentHash, uint256())));
+
+    while(pcursor->Valid()) {
+        std::pair<char, std::pair<uint256, uint256> > key;
+        if(!pcursor->GetKey(key) || key.first != DB_VOTE || key.second.first != nParentHash) {
+            break;
+        }
+        CGovernanceVote vote;
+        if(!pcursor->GetValue(vote)) {
+            return error("CGovernanceVoteDB::ReadVotes -- failed to read vote %s", key.second.second.ToString());
+        }
+        vecVotes.push_back(vote);
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CGovernanceVoteDB::EraseVotes(const uint256& nParentHash, const std::vector<uint256>& vecHashes)
+{
+    CDBBatch batch(&GetObfuscateKey());
+    for(size_t i = 0; i < vecHashes.size(); ++i) {
+        batch.Erase(std::make_pair(DB_VOTE, std::make_pair(nParentHash, vecHashes[i])));
+    }
+    return WriteBatch(batch);
+}
+
+int CGovernanceVoteDB::EraseVotesExcept(const std::set<uint256>& setParentHashes)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(&GetObfuscateKey());
+    int nErased = 0;
+
+    pcursor->Seek(std::make_pair(DB_VOTE, std::make_pair(uint256(), uint256())));
+
+    while(pcursor->Valid()) {
+        std::pair<char, std::pair<uint256, uint256> > key;
+        if(!pcursor->GetKey(key) || key.first != DB_VOTE) {
+            break;
+        }
+        if(!setParentHashes.count(key.second.first)) {
+            batch.Erase(key);
+            ++nErased;
+        }
+        pcursor->Next();
+    }
+    WriteBatch(batch);
+    return nErased;
+}
 
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile()
-    : nMemoryVotes(0),
+    : nParentHash(),
+      nMemoryVotes(0),
       listVotes(),
-      mapVoteIndex()
+      mapVoteIndex(),
+      setDiskVotes(),
+      pDiskRef(new disk_ref_t())
 {}
 
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other)
-    : nMemoryVotes(other.nMemoryVotes),
+    : nParentHash(other.nParentHash),
+      nMemoryVotes(other.nMemoryVotes),
       listVotes(other.listVotes),
-      mapVoteIndex()
+      mapVoteIndex(),
+      setDiskVotes(other.setDiskVotes),
+      pDiskRef(other.pDiskRef)
 {
     RebuildIndex();
 }
 
 void CGovernanceObjectVoteFile::AddVote(const CGovernanceVote& vote)
 {
+    nParentHash = vote.GetParentHash();
     listVotes.push_front(vote);
     mapVoteIndex[vote.GetHash()] = listVotes.begin();
     ++nMemoryVotes;
+    FlushVotes();
 }
 
 bool CGovernanceObjectVoteFile::HasVote(const uint256& nHash) const
 {
     vote_m_cit it = mapVoteIndex.find(nHash);
     if(it == mapVoteIndex.end()) {
-        return false;
+        return setDiskVotes.count(nHash) > 0;
     }
     return true;
 }
@@ -39,7 +137,10 @@ bool CGovernanceObjectVoteFile::GetVote(const uint256& nHash, CGovernanceVote& v
 {
     vote_m_cit it = mapVoteIndex.find(nHash);
     if(it == mapVoteIndex.end()) {
-        return false;
+        if(!setDiskVotes.count(nHash) || !pgovernancevotedb) {
+            return false;
+        }
+        return pgovernancevotedb->ReadVote(nParentHash, nHash, vote);
     }
     vote = *(it->second);
     return true;
@@ -51,6 +152,27 @@ std::vector<CGovernanceVote> CGovernanceObjectVoteFile::GetVotes() const
     for(vote_l_cit it = listVotes.begin(); it != listVotes.end(); ++it) {
         vecResult.push_back(*it);
     }
+    if(!setDiskVotes.empty() && pgovernancevotedb) {
+        // the store may hold stale votes of this object which are no longer in the file
+        std::vector<CGovernanceVote> vecDiskVotes;
+        pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes);
+        for(size_t i = 0; i < vecDiskVotes.size(); ++i) {
+            if(setDiskVotes.count(vecDiskVotes[i].GetHash())) {
+                vecResult.push_back(vecDiskVotes[i]);
+            }
+        }
+    }
+    return vecResult;
+}
+
+std::vector<uint256> CGovernanceObjectVoteFile::GetVoteHashes() const
+{
+    std::vector<uint256> vecResult;
+    vecResult.reserve(GetVoteCount());
+    for(vote_l_cit it = listVotes.begin(); it != listVotes.end(); ++it) {
+        vecResult.push_back(it->GetHash());
+    }
+    vecResult.insert(vecResult.end(), setDiskVotes.begin(), setDiskVotes.end());
     return vecResult;
 }
 
@@ -67,12 +189,45 @@ void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const CTxIn& vinMaster
             ++it;
         }
     }
+
+    if(setDiskVotes.empty() || !pgovernancevotedb) {
+        return;
+    }
+    std::vector<CGovernanceVote> vecDiskVotes;
+    std::vector<uint256> vecErase;
+    pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes);
+    for(size_t i = 0; i < vecDiskVotes.size(); ++i) {
+        uint256 nHash = vecDiskVotes[i].GetHash();
+        if(vecDiskVotes[i].GetVinMasternode() == vinMasternode && setDiskVotes.erase(nHash)) {
+            vecErase.push_back(nHash);
+        }
+    }
+    // other copies may still refer to them, leftovers are swept with the object
+    if(OwnsDiskVotes()) {
+        pgovernancevotedb->EraseVotes(nParentHash, vecErase);
+    }
+}
+
+void CGovernanceObjectVoteFile::Clear()
+{
+    if(!setDiskVotes.empty() && pgovernancevotedb && OwnsDiskVotes()) {
+        std::vector<uint256> vecErase(setDiskVotes.begin(), setDiskVotes.end());
+        pgovernancevotedb->EraseVotes(nParentHash, vecErase);
+    }
+    listVotes.clear();
+    mapVoteIndex.clear();
+    setDiskVotes.clear();
+    pDiskRef.reset(new disk_ref_t());
+    nMemoryVotes = 0;
 }
 
 CGovernanceObjectVoteFile& CGovernanceObjectVoteFile::operator=(const CGovernanceObjectVoteFile& other)
 {
+    nParentHash = other.nParentHash;
     nMemoryVotes = other.nMemoryVotes;
     listVotes = other.listVotes;
+    setDiskVotes = other.setDiskVotes;
+    pDiskRef = other.pDiskRef;
     RebuildIndex();
     return *this;
 }
@@ -95,3 +250,29 @@ void CGovernanceObjectVoteFile::RebuildIndex()
         }
     }
 }
+
+void CGovernanceObjectVoteFile::FlushVotes()
+{
+    if(nMemoryVotes <= MAX_MEMORY_VOTES || !pgovernancevotedb) {
+        return;
+    }
+
+    // the oldest votes are at the back of the list, flush them in batches
+    // by keeping only half of the memory limit
+    int nKeep = MAX_MEMORY_VOTES / 2;
+    vote_l_it itFirst = listVotes.begin();
+    std::advance(itFirst, nKeep);
+    std::vector<CGovernanceVote> vecFlush(itFirst, listVotes.end());
+    if(!pgovernancevotedb->WriteVotes(vecFlush)) {
+        LogPrintf("CGovernanceObjectVoteFile::FlushVotes -- failed to write %d votes for %s\n", vecFlush.size(), nParentHash.ToString());
+        return;
+    }
+
+    for(size_t i = 0; i < vecFlush.size(); ++i) {
+        uint256 nHash = vecFlush[i].GetHash();
+        mapVoteIndex.erase(nHash);
+        setDiskVotes.insert(nHash);
+    }
+    listVotes.erase(itFirst, listVotes.end());
+    nMemoryVotes = nKeep;
+}
@@ -8,18 +8,57 @@
 
 #include <list>
 #include <map>
+#include <set>
 
+#include "dbwrapper.h"
 #include "governance-vote.h"
 #include "serialize.h"
 #include "uint256.h"
 
+#include <boost/shared_ptr.hpp>
+
+class CGovernanceVoteDB;
+
+extern CGovernanceVoteDB* pgovernancevotedb;
+
+/** LevelDB cache size of the governance vote store */
+static const size_t GOVERNANCE_VOTE_DB_CACHE = 2 << 20;
+
+/**
+ * Store for governance votes which were flushed out of memory,
+ * keyed by (object hash, vote hash)
+ */
+class CGovernanceVoteDB : public CDBWrapper
+{
+public:
+    CGovernanceVoteDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /// Write without syncing, see SyncVotes()
+    bool WriteVotes(const std::vector<CGovernanceVote>& vecVotes);
+    /// Make every vote written so far durable, before governance.dat refers to them
+    bool SyncVotes();
+    bool ReadVote(const uint256& nParentHash, const uint256& nHash, CGovernanceVote& vote);
+    bool ReadVotes(const uint256& nParentHash, std::vector<CGovernanceVote>& vecVotes);
+    bool EraseVotes(const uint256& nParentHash, const std::vector<uint256>& vecHashes);
+    /// Erase the votes of every object not in setParentHashes, returns the number of erased votes
+    int EraseVotesExcept(const std::set<uint256>& setParentHashes);
+
+private:
+    CGovernanceVoteDB(const CGovernanceVoteDB&);
+    void operator=(const CGovernanceVoteDB&);
+};
+
 /**
  * Represents the collection of votes associated with a given CGovernanceObject
  * Recently received votes are held in memory until a maximum size is reached after
- * which older votes a flushed to a disk file.
+ * which older votes are flushed to the governance vote store (pgovernancevotedb).
+ * Only the hashes of flushed votes are kept in memory, the votes themselves are
+ * read back on demand.
  *
- * Note: This is a stub implementation that doesn't limit the number of votes held
- * in memory and doesn't flush to disk.
+ * Without a vote store all votes are kept in memory.
+ *
+ * Copies of a file refer to the same votes on disk. Those are only erased
+ * from the store by the last remaining copy, and only the ones it refers to.
  */
 class CGovernanceObjectVoteFile
 {
@@ -36,8 +75,13 @@ public: // Types
 
     typedef vote_m_t::const_iterator vote_m_cit;
 
+private: // Types
+    struct disk_ref_t {};
+
 private:
-    static const int MAX_MEMORY_VOTES = -1;
+    static const int MAX_MEMORY_VOTES = 100;
+
+    uint256 nParentHash;
 
     int nMemoryVotes;
 
@@ -45,6 +89,11 @@ private:
 
     vote_m_t mapVoteIndex;
 
+    std::set<uint256> setDiskVotes;
+
+    /// Shared by all copies of this file, see OwnsDiskVotes()
+    boost::shared_ptr<disk_ref_t> pDiskRef;
+
 public:
     CGovernanceObjectVoteFile();
 
@@ -56,39 +105,66 @@ public:
     void AddVote(const CGovernanceVote& vote);
 
     /**
-     * Return true if the vote with this hash is currently cached in memory
+     * Return true if the vote with this hash is in the file, either in memory or on disk
      */
     bool HasVote(const uint256& nHash) const;
 
     /**
-     * Retrieve a vote cached in memory
+     * Retrieve a vote, reading it from disk if it is not cached in memory
      */
     bool GetVote(const uint256& nHash, CGovernanceVote& vote) const;
 
-    int GetVoteCount() {
+    int GetVoteCount() const {
+        return nMemoryVotes + (int)setDiskVotes.size();
+    }
+
+    int GetMemoryVoteCount() const {
         return nMemoryVotes;
     }
 
+    /**
+     * Return all votes, votes flushed to disk are loaded on demand
+     */
     std::vector<CGovernanceVote> GetVotes() const;
 
+    /**
+     * Return the hashes of all votes without touching the disk
+     */
+    std::vector<uint256> GetVoteHashes() const;
+
     CGovernanceObjectVoteFile& operator=(const CGovernanceObjectVoteFile& other);
 
     void RemoveVotesFromMasternode(const CTxIn& vinMasternode);
 
+    /**
+     * Remove all votes. The votes flushed to disk are erased from the store
+     * unless another copy of the file still refers to them.
+     */
+    void Clear();
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
+        READWRITE(nParentHash);
         READWRITE(nMemoryVotes);
         READWRITE(listVotes);
+        READWRITE(setDiskVotes);
         if(ser_action.ForRead()) {
             RebuildIndex();
         }
     }
 private:
+    /// True if no other copy of this file refers to its votes on disk
+    bool OwnsDiskVotes() const {
+        return pDiskRef.unique();
+    }
+
     void RebuildIndex();
 
+    void FlushVotes();
+
 };
 
 #endif
@@ -19,7 +19,7 @@ CGovernanceManager governance;
 
 int nSubmittedFinalBudget;
 
-const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-12";
+const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-13";
 const int CGovernanceManager::MAX_TIME_FUTURE_DEVIATION = 60*60;
 const int CGovernanceManager::RELIABLE_PROPAGATION_TIME = 60;
 
@@ -261,20 +261,46 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
             return;
         }
 
-        CGovernanceException exception;
-        if(ProcessVote(pfrom, vote, exception)) {
-            LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- %s new\n", strHash);
-            masternodeSync.BumpAssetLastTime("MNGOVERNANCEOBJECTVOTE");
-            vote.Relay();
-        }
-        else {
-            LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- Rejected vote, error = %s\n", exception.what());
-            if((exception.GetNodePenalty() != 0) && masternodeSync.IsSynced()) {
-                Misbehaving(pfrom->GetId(), exception.GetNodePenalty());
+        // verify the signature off this thread if the masternode is known,
+        // VoteSignatureChecked() takes it from there
+        masternode_info_t infoMn = mnodeman.GetMasternodeInfo(vote.GetVinMasternode());
+        if(infoMn.fInfoValid) {
+            std::vector<CMessageSigCheck> vChecks(1, CMessageSigCheck(infoMn.pubKeyMasternode, vote.GetSignature(), vote.GetSignatureMessage()));
+            pfrom->AddRef();
+            if(!messageSigQueue.Add(vChecks, std::bind(&CGovernanceManager::VoteSignatureChecked, this, pfrom, vote, std::placeholders::_1))) {
+                LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- signature queue is full, dropping vote: %s\n", strHash);
+                pfrom->Release();
             }
             return;
         }
 
+        ProcessVoteMessage(pfrom, vote);
+    }
+}
+
+void CGovernanceManager::VoteSignatureChecked(CNode* pfrom, CGovernanceVote vote, const std::vector<CMessageSigCheck>& vChecks)
+{
+    vote.checkedSig.Set(vChecks[0]);
+    ProcessVoteMessage(pfrom, vote);
+    pfrom->Release();
+}
+
+void CGovernanceManager::ProcessVoteMessage(CNode* pfrom, const CGovernanceVote& vote)
+{
+    std::string strHash = vote.GetHash().ToString();
+
+    CGovernanceException exception;
+    if(ProcessVote(pfrom, vote, exception)) {
+        LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- %s new\n", strHash);
+        masternodeSync.BumpAssetLastTime("MNGOVERNANCEOBJECTVOTE");
+        vote.Relay();
+    }
+    else {
+        LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- Rejected vote, error = %s\n", exception.what());
+        if((exception.GetNodePenalty() != 0) && masternodeSync.IsSynced()) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), exception.GetNodePenalty());
+        }
     }
 }
 
@@ -540,6 +566,9 @@ void CGovernanceManager::UpdateCachesAndClean()
                 }
             }
 
+            // Drop the votes flushed to the vote store
+            pObj->GetVoteFile().Clear();
+
             int64_t nSuperblockCycleSeconds = Params().GetConsensus().nSuperblockCycle * Params().GetConsensus().nPowTargetSpacing;
             int64_t nTimeExpired = pObj->GetCreationTime() + 2 * nSuperblockCycleSeconds + GOVERNANCE_DELETION_DELAY;
 
@@ -606,8 +635,8 @@ std::vector<CGovernanceVote> CGovernanceManager::GetCurrentVotes(const uint256&
     // Compile a list of Masternode collateral outpoints for which to get votes
     std::vector<CTxIn> vecMNTxIn;
     if (mnCollateralOutpointFilter == CTxIn()) {
-        std::vector<CMasternode> mnlist = mnodeman.GetFullMasternodeVector();
-        for (std::vector<CMasternode>::iterator it = mnlist.begin(); it != mnlist.end(); ++it)
+        CMasternodeListSnapshotRef snapshot = mnodeman.GetMasternodeListSnapshot();
+        for (std::vector<CMasternode>::const_iterator it = snapshot->vecMasternodes.begin(); it != snapshot->vecMasternodes.end(); ++it)
         {
             vecMNTxIn.push_back(it->vin);
         }
@@ -1164,10 +1193,10 @@ void CGovernanceManager::RequestGovernanceObject(CNode* pfrom, const uint256& nH
 
         if(pObj) {
             filter = CBloomFilter(Params().GetConsensus().nGovernanceFilterElements, GOVERNANCE_FILTER_FP_RATE, GetRandInt(999999), BLOOM_UPDATE_ALL);
-            std::vector<CGovernanceVote> vecVotes = pObj->GetVoteFile().GetVotes();
-            nVoteCount = vecVotes.size();
-            for(size_t i = 0; i < vecVotes.size(); ++i) {
-                filter.insert(vecVotes[i].GetHash());
+            std::vector<uint256> vecVoteHashes = pObj->GetVoteFile().GetVoteHashes();
+            nVoteCount = vecVoteHashes.size();
+            for(size_t i = 0; i < vecVoteHashes.size(); ++i) {
+                filter.insert(vecVoteHashes[i]);
             }
         }
     }
@@ -1315,9 +1344,9 @@ void CGovernanceManager::RebuildIndexes()
     mapVoteToObject.Clear();
     for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
         CGovernanceObject& govobj = it->second;
-        std::vector<CGovernanceVote> vecVotes = govobj.GetVoteFile().GetVotes();
-        for(size_t i = 0; i < vecVotes.size(); ++i) {
-            mapVoteToObject.Insert(vecVotes[i].GetHash(), &govobj);
+        std::vector<uint256> vecVoteHashes = govobj.GetVoteFile().GetVoteHashes();
+        for(size_t i = 0; i < vecVoteHashes.size(); ++i) {
+            mapVoteToObject.Insert(vecVoteHashes[i], &govobj);
         }
     }
 }
@@ -1367,6 +1396,15 @@ void CGovernanceManager::InitOnLoad()
     LogPrintf("Preparing masternode indexes and governance triggers...\n");
     RebuildIndexes();
     AddCachedTriggers();
+    if(pgovernancevotedb) {
+        // votes of objects which didn't make it into governance.dat
+        std::set<uint256> setObjectHashes;
+        for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+            setObjectHashes.insert(it->first);
+        }
+        int nErased = pgovernancevotedb->EraseVotesExcept(setObjectHashes);
+        LogPrint("gobject", "CGovernanceManager::InitOnLoad -- erased %d orphaned votes from the vote store\n", nErased);
+    }
     LogPrintf("Masternode indexes and governance triggers prepared  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("     %s\n", ToString());
 }
@@ -445,6 +445,12 @@ private:
 
     bool ProcessVote(CNode* pfrom, const CGovernanceVote& vote, CGovernanceException& exception);
 
+    /// Process a vote message from pfrom, relaying the vote if it's new and valid
+    void ProcessVoteMessage(CNode* pfrom, const CGovernanceVote& vote);
+
+    /// Continue processing a vote from pfrom once its signature was checked on the signature queue
+    void VoteSignatureChecked(CNode* pfrom, CGovernanceVote vote, const std::vector<CMessageSigCheck>& vChecks);
+
     /// Called to indicate a requested object has been received
     bool AcceptObjectMessage(const uint256& nHash);
 
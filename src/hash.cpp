@@ -7,6 +7,9 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#include <algorithm>
+#include <string.h>
+
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -81,3 +84,195 @@ void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char he
     num[3] = (nChild >>  0) & 0xFF;
     CHMAC_SHA512(chainCode.begin(), chainCode.size()).Write(&header, 1).Write(data, 32).Write(num, 4).Finalize(output);
 }
+
+/** Run the ten X11 stages after blake512 over a blake512 digest. */
+static uint256 HashX11Stages(const uint512& hashBlake)
+{
+    sph_bmw512_context       ctx_bmw;
+    sph_groestl512_context   ctx_groestl;
+    sph_jh512_context        ctx_jh;
+    sph_keccak512_context    ctx_keccak;
+    sph_skein512_context     ctx_skein;
+    sph_luffa512_context     ctx_luffa;
+    sph_cubehash512_context  ctx_cubehash;
+    sph_shavite512_context   ctx_shavite;
+    sph_simd512_context      ctx_simd;
+    sph_echo512_context      ctx_echo;
+    uint512 hash[10];
+
+    sph_bmw512_init(&ctx_bmw);
+    sph_bmw512 (&ctx_bmw, static_cast<const void*>(&hashBlake), 64);
+    sph_bmw512_close(&ctx_bmw, static_cast<void*>(&hash[0]));
+
+    sph_groestl512_init(&ctx_groestl);
+    sph_groestl512 (&ctx_groestl, static_cast<const void*>(&hash[0]), 64);
+    sph_groestl512_close(&ctx_groestl, static_cast<void*>(&hash[1]));
+
+    sph_skein512_init(&ctx_skein);
+    sph_skein512 (&ctx_skein, static_cast<const void*>(&hash[1]), 64);
+    sph_skein512_close(&ctx_skein, static_cast<void*>(&hash[2]));
+
+    sph_jh512_init(&ctx_jh);
+    sph_jh512 (&ctx_jh, static_cast<const void*>(&hash[2]), 64);
+    sph_jh512_close(&ctx_jh, static_cast<void*>(&hash[3]));
+
+    sph_keccak512_init(&ctx_keccak);
+    sph_keccak512 (&ctx_keccak, static_cast<const void*>(&hash[3]), 64);
+    sph_keccak512_close(&ctx_keccak, static_cast<void*>(&hash[4]));
+
+    sph_luffa512_init(&ctx_luffa);
+    sph_luffa512 (&ctx_luffa, static_cast<const void*>(&hash[4]), 64);
+    sph_luffa512_close(&ctx_luffa, static_cast<void*>(&hash[5]));
+
+    sph_cubehash512_init(&ctx_cubehash);
+    sph_cubehash512 (&ctx_cubehash, static_cast<const void*>(&hash[5]), 64);
+    sph_cubehash512_close(&ctx_cubehash, static_cast<void*>(&hash[6]));
+
+    sph_shavite512_init(&ctx_shavite);
+    sph_shavite512(&ctx_shavite, static_cast<const void*>(&hash[6]), 64);
+    sph_shavite512_close(&ctx_shavite, static_cast<void*>(&hash[7]));
+
+    sph_simd512_init(&ctx_simd);
+    sph_simd512 (&ctx_simd, static_cast<const void*>(&hash[7]), 64);
+    sph_simd512_close(&ctx_simd, static_cast<void*>(&hash[8]));
+
+    sph_echo512_init(&ctx_echo);
+    sph_echo512 (&ctx_echo, static_cast<const void*>(&hash[8]), 64);
+    sph_echo512_close(&ctx_echo, static_cast<void*>(&hash[9]));
+
+    return hash[9].trim256();
+}
+
+void HashX11Many(const unsigned char* pbegin, size_t nLen, size_t nStride, size_t nCount, uint256* phashes)
+{
+    sph_blake512_context     ctx_blake;
+    static unsigned char pblank[1];
+    uint512 hashBlake;
+
+    for (size_t i = 0; i < nCount; i++) {
+        sph_blake512_init(&ctx_blake);
+        sph_blake512 (&ctx_blake, (nLen == 0 ? pblank : pbegin + i * nStride), nLen);
+        sph_blake512_close(&ctx_blake, static_cast<void*>(&hashBlake));
+        phashes[i] = HashX11Stages(hashBlake);
+    }
+}
+
+const size_t CX11HeaderHasher::HEADER_SIZE;
+const size_t CX11HeaderHasher::MIDSTATE_SIZE;
+
+CX11HeaderHasher::CX11HeaderHasher(const unsigned char* pheader)
+{
+    sph_blake512_init(&ctxMidstate);
+    sph_blake512(&ctxMidstate, pheader, MIDSTATE_SIZE);
+    memcpy(vchTail, pheader + MIDSTATE_SIZE, sizeof(vchTail));
+}
+
+uint256 CX11HeaderHasher::Hash(uint32_t nNonce) const
+{
+    uint256 hash;
+    HashNonces(nNonce, 1, &hash);
+    return hash;
+}
+
+void CX11HeaderHasher::HashNonces(uint32_t nFirstNonce, size_t nCount, uint256* phashes) const
+{
+    sph_blake512_context     ctx_blake;
+    unsigned char tail[sizeof(vchTail)];
+    memcpy(tail, vchTail, sizeof(tail));
+    uint512 hashBlake;
+
+    for (size_t i = 0; i < nCount; i++) {
+        WriteLE32(tail + sizeof(tail) - 4, nFirstNonce + (uint32_t)i);
+        ctx_blake = ctxMidstate;
+        sph_blake512 (&ctx_blake, tail, sizeof(tail));
+        sph_blake512_close(&ctx_blake, static_cast<void*>(&hashBlake));
+        phashes[i] = HashX11Stages(hashBlake);
+    }
+}
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do { \
+    v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; \
+    v0 = ROTL(v0, 32); \
+    v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; \
+    v2 = ROTL(v2, 32); \
+} while (0)
+
+CSipHasher::CSipHasher(uint64_t k0, uint64_t k1)
+{
+    v[0] = 0x736f6d6570736575ULL ^ k0;
+    v[1] = 0x646f72616e646f6dULL ^ k1;
+    v[2] = 0x6c7967656e657261ULL ^ k0;
+    v[3] = 0x7465646279746573ULL ^ k1;
+    count = 0;
+    tmp = 0;
+}
+
+CSipHasher& CSipHasher::Write(uint64_t data)
+{
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+    assert(count % 8 == 0);
+
+    v3 ^= data;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= data;
+
+    v[0] = v0;
+    v[1] = v1;
+    v[2] = v2;
+    v[3] = v3;
+
+    count += 8;
+    return *this;
+}
+
+CSipHasher& CSipHasher::Write(const unsigned char* data, size_t size)
+{
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    uint64_t t = tmp;
+    int c = count;
+
+    while (size--) {
+        t |= ((uint64_t)(*(data++))) << (8 * (c % 8));
+        c++;
+        if ((c & 7) == 0) {
+            v3 ^= t;
+            SIPROUND;
+            SIPROUND;
+            v0 ^= t;
+            t = 0;
+        }
+    }
+
+    v[0] = v0;
+    v[1] = v1;
+    v[2] = v2;
+    v[3] = v3;
+    count = c;
+    tmp = t;
+
+    return *this;
+}
+
+uint64_t CSipHasher::Finalize() const
+{
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+    uint64_t t = tmp | (((uint64_t)count) << 56);
+
+    v3 ^= t;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= t;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -275,6 +275,33 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
     return ss.GetHash();
 }
 
+/** SipHash-2-4, can be used incrementally.
+ *
+ * A fast keyed 64-bit hash, suitable for detecting tampering or corruption of
+ * data that is stored next to a secret key (it is not a replacement for a
+ * cryptographic digest of public data).
+ */
+class CSipHasher
+{
+private:
+    uint64_t v[4];
+    uint64_t tmp;
+    int count;
+
+public:
+    /** Construct a SipHash calculator initialized with 128-bit key (k0, k1) */
+    CSipHasher(uint64_t k0, uint64_t k1);
+    /** Hash a 64-bit integer worth of data
+     *  It is treated as if this was the little-endian interpretation of 8 bytes.
+     *  This function can only be used when a multiple of 8 bytes have been written so far.
+     */
+    CSipHasher& Write(uint64_t data);
+    /** Hash arbitrary bytes. */
+    CSipHasher& Write(const unsigned char* data, size_t size);
+    /** Compute the 64-bit SipHash-2-4 of the data written so far. The object remains untouched. */
+    uint64_t Finalize() const;
+};
+
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
@@ -346,4 +373,37 @@ inline uint256 HashX11(const T1 pbegin, const T1 pend)
     return hash[10].trim256();
 }
 
+/**
+ * Compute HashX11 over nCount equally sized inputs of nLen bytes, laid out
+ * nStride bytes apart starting at pbegin, writing the results to phashes.
+ * The inputs are hashed one after another, there is no multi-lane or SIMD
+ * path, so this is no faster than calling HashX11() per input.
+ */
+void HashX11Many(const unsigned char* pbegin, size_t nLen, size_t nStride, size_t nCount, uint256* phashes);
+
+/**
+ * HashX11() of an 80 byte block header for a run of nonces. The leading 64
+ * bytes (version, previous block hash and most of the merkle root) are fed
+ * into blake512 once; every nonce only copies that state, absorbs the
+ * trailing 16 bytes and runs the remaining stages. nTime and nBits are
+ * captured at construction, so build a new hasher whenever they change.
+ */
+class CX11HeaderHasher
+{
+private:
+    sph_blake512_context ctxMidstate;
+    unsigned char vchTail[16];
+
+public:
+    static const size_t HEADER_SIZE = 80;
+    static const size_t MIDSTATE_SIZE = 64;
+
+    explicit CX11HeaderHasher(const unsigned char* pheader);
+
+    /** Hash of the header with its nonce replaced by nNonce */
+    uint256 Hash(uint32_t nNonce) const;
+    /** Hashes for the nCount nonces starting at nFirstNonce, wrapping at 2^32 */
+    void HashNonces(uint32_t nFirstNonce, size_t nCount, uint256* phashes) const;
+};
+
 #endif // BITCOIN_HASH_H
@@ -0,0 +1,454 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexbuilder.h"
+
+#include "chainparams.h"
+#include "checkpoints.h"
+#include "sync.h"
+#include "txdb.h"
+#include "undo.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <map>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+/** Builds one optional index from the block files, and undoes it again for blocks that get disconnected meanwhile */
+class CIndexBuilder
+{
+public:
+    const std::string strName;
+
+    CIndexBuilder(const std::string& strNameIn, std::atomic<bool>& fIndexIn, CBlockIndex* pindexStart) :
+        strName(strNameIn), fIndex(fIndexIn), pindexBuilt(pindexStart), fEnabled(false), nTimeStart(0), nTimeStop(0), nBlocksBuilt(0) {}
+    virtual ~CIndexBuilder() {}
+
+    void Thread();
+    CIndexBuildInfo GetInfo() const;
+
+protected:
+    /** Write the entries of a block, or take them out again if !fConnect */
+    virtual bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect) = 0;
+    /** Called without cs_main once the builder has reached the tip, pindexTip */
+    virtual bool CaughtUp(const CBlockIndex* pindexTip) { return true; }
+    /** Called with cs_main held to hand the index over to ConnectBlock */
+    virtual void Enable();
+
+    std::atomic<bool>& fIndex;
+
+private:
+    mutable CCriticalSection cs;
+    CBlockIndex* pindexBuilt;
+    bool fEnabled;
+    int64_t nTimeStart;
+    int64_t nTimeStop;
+    int64_t nBlocksBuilt;
+    std::string strError;
+
+    bool Build();
+};
+
+void CIndexBuilder::Enable()
+{
+    fIndex = true;
+    pblocktree->WriteFlag(strName, true);
+}
+
+void CIndexBuilder::Thread()
+{
+    bool fBuilt = Build();
+    LOCK(cs);
+    nTimeStop = GetTimeMicros();
+    if (!fBuilt)
+        LogPrintf("Building the %s stopped: %s\n", strName, strError);
+}
+
+bool CIndexBuilder::Build()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    {
+        LOCK(cs);
+        nTimeStart = GetTimeMicros();
+    }
+    int64_t nLastLog = GetTime();
+    bool fCaughtUp = false;
+
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        // -reindex-chainstate connects the chain again from the genesis block
+        if (fReindex) {
+            MilliSleep(1000);
+            continue;
+        }
+
+        CBlockIndex* pindex;
+        bool fConnect = true;
+        {
+            LOCK(cs_main);
+            if (pindexBuilt && !chainActive.Contains(pindexBuilt)) {
+                pindex = pindexBuilt;
+                fConnect = false;
+            } else {
+                pindex = pindexBuilt ? chainActive.Next(pindexBuilt) : chainActive.Genesis();
+                if (pindex == NULL && fCaughtUp) {
+                    // No block can be connected before ConnectBlock takes over
+                    Enable();
+                    pblocktree->EraseIndexBuildCursor(strName);
+                    LOCK(cs);
+                    fEnabled = true;
+                    LogPrintf("Finished building the %s at height %d\n", strName, pindexBuilt ? pindexBuilt->nHeight : -1);
+                    return true;
+                }
+            }
+        }
+
+        if (pindex == NULL) {
+            if (!CaughtUp(pindexBuilt)) {
+                LOCK(cs);
+                strError = "failed to catch up with the tip";
+                return false;
+            }
+            fCaughtUp = true;
+            continue;
+        }
+
+        // The genesis block has no entries, as its coinbase is never connected
+        if (pindex->pprev) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockFromDisk(block, pindex, consensusParams) ||
+                !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) ||
+                blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+                LOCK(cs);
+                strError = strprintf("failed to read block %s", pindex->GetBlockHash().ToString());
+                return false;
+            }
+            if (!WriteBlock(block, blockundo, pindex, fConnect)) {
+                LOCK(cs);
+                strError = strprintf("failed to write the entries of block %s", pindex->GetBlockHash().ToString());
+                return false;
+            }
+        }
+
+        CBlockIndex* pindexNew = fConnect ? pindex : pindex->pprev;
+        if (!pblocktree->WriteIndexBuildCursor(strName, pindexNew->GetBlockHash())) {
+            LOCK(cs);
+            strError = "failed to write the build cursor";
+            return false;
+        }
+        {
+            LOCK(cs);
+            pindexBuilt = pindexNew;
+            if (fConnect)
+                nBlocksBuilt++;
+        }
+
+        if (GetTime() - nLastLog >= 60) {
+            nLastLog = GetTime();
+            CIndexBuildInfo info = GetInfo();
+            LogPrintf("Building the %s: height %d, %.1f blocks/s\n", strName, info.nHeight, info.dBlocksPerSecond);
+        }
+    }
+}
+
+CIndexBuildInfo CIndexBuilder::GetInfo() const
+{
+    CIndexBuildInfo info;
+    info.strName = strName;
+    LOCK2(cs_main, cs);
+    info.fEnabled = fEnabled;
+    info.fBuilding = !fEnabled && strError.empty();
+    info.nHeight = pindexBuilt ? pindexBuilt->nHeight : -1;
+    info.dProgress = fEnabled ? 1.0 : Checkpoints::GuessVerificationProgress(Params().Checkpoints(), pindexBuilt, false);
+    info.nBlocksBuilt = nBlocksBuilt;
+    int64_t nElapsed = (nTimeStop > 0 ? nTimeStop : GetTimeMicros()) - nTimeStart;
+    if (nTimeStart > 0 && nElapsed > 0)
+        info.dBlocksPerSecond = nBlocksBuilt * 1000000.0 / nElapsed;
+    info.strError = strError;
+    if (fEnabled)
+        info.nHeight = chainActive.Height();
+    return info;
+}
+
+static bool GetAddressKey(const CScript& scriptPubKey, int& nType, uint160& hashBytes)
+{
+    if (scriptPubKey.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(scriptPubKey.begin()+2, scriptPubKey.begin()+22));
+        nType = 2;
+    } else if (scriptPubKey.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(scriptPubKey.begin()+3, scriptPubKey.begin()+23));
+        nType = 1;
+    } else {
+        hashBytes.SetNull();
+        nType = 0;
+    }
+    return nType > 0;
+}
+
+class CTxIndexBuilder : public CIndexBuilder
+{
+public:
+    CTxIndexBuilder(CBlockIndex* pindexStart) : CIndexBuilder("txindex", fTxIndex, pindexStart) {}
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+    {
+        // Like DisconnectBlock, entries of disconnected blocks are left in place
+        if (!fConnect)
+            return true;
+        CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+        std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+        vPos.reserve(block.vtx.size());
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            vPos.push_back(std::make_pair(block.vtx[i].GetHash(), pos));
+            pos.nTxOffset += ::GetSerializeSize(block.vtx[i], SER_DISK, CLIENT_VERSION);
+        }
+        return pblocktree->WriteTxIndex(vPos);
+    }
+};
+
+class CAddressIndexBuilder : public CIndexBuilder
+{
+public:
+    CAddressIndexBuilder(CBlockIndex* pindexStart) : CIndexBuilder("addressindex", fAddressIndex, pindexStart), fBalances(false) {}
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+    {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+        int nType;
+        uint160 hashBytes;
+
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            const uint256 txhash = tx.GetHash();
+
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+                if (txundo.vprevout.size() != tx.vin.size())
+                    return error("%s: transaction and undo data inconsistent", __func__);
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const CTxInUndo& undo = txundo.vprevout[j];
+                    if (!GetAddressKey(undo.txout.scriptPubKey, nType, hashBytes))
+                        continue;
+                    addressIndex.push_back(std::make_pair(CAddressIndexKey(nType, hashBytes, pindex->nHeight, i, txhash, j, true), undo.txout.nValue * -1));
+                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(nType, hashBytes, tx.vin[j].prevout.hash, tx.vin[j].prevout.n),
+                        fConnect ? CAddressUnspentValue() : CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, undo.nHeight)));
+                }
+            }
+
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                if (!GetAddressKey(out.scriptPubKey, nType, hashBytes))
+                    continue;
+                addressIndex.push_back(std::make_pair(CAddressIndexKey(nType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+                addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(nType, hashBytes, txhash, k),
+                    fConnect ? CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight) : CAddressUnspentValue()));
+            }
+        }
+
+        if (fConnect) {
+            if (!pblocktree->WriteAddressIndex(addressIndex))
+                return false;
+        } else {
+            // Outputs spent within the block must come back before the
+            // outputs that created them go away
+            std::reverse(addressUnspentIndex.begin(), addressUnspentIndex.end());
+            if (!pblocktree->EraseAddressIndex(addressIndex))
+                return false;
+        }
+        if (fBalances && !UpdateAddressBalances(addressIndex, pindex, fConnect))
+            return false;
+        return pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex);
+    }
+
+    // Writing a block again after an interruption is harmless for the
+    // deltas and unspent outputs but not for the running totals, so the
+    // balance records are only kept up to date from here on, after being
+    // added up from the deltas
+    bool CaughtUp(const CBlockIndex* pindexTip)
+    {
+        if (!fBalances) {
+            LogPrintf("Writing the address balance records...\n");
+            if (!pblocktree->RebuildAddressBalanceIndex(pindexTip ? pindexTip->GetBlockHash() : uint256()))
+                return false;
+            fBalances = true;
+        }
+        return true;
+    }
+
+    void Enable()
+    {
+        CIndexBuilder::Enable();
+        fAddressBalanceIndex = true;
+        pblocktree->WriteFlag("addressbalanceindex", true);
+    }
+
+private:
+    bool fBalances;
+};
+
+class CSpentIndexBuilder : public CIndexBuilder
+{
+public:
+    CSpentIndexBuilder(CBlockIndex* pindexStart) : CIndexBuilder("spentindex", fSpentIndex, pindexStart) {}
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+    {
+        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+        int nType;
+        uint160 hashBytes;
+
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: transaction and undo data inconsistent", __func__);
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CTxInUndo& undo = txundo.vprevout[j];
+                GetAddressKey(undo.txout.scriptPubKey, nType, hashBytes);
+                spentIndex.push_back(std::make_pair(CSpentIndexKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n),
+                    fConnect ? CSpentIndexValue(tx.GetHash(), j, pindex->nHeight, undo.txout.nValue, nType, hashBytes) : CSpentIndexValue()));
+            }
+        }
+        return pblocktree->UpdateSpentIndex(spentIndex);
+    }
+};
+
+class CTimestampIndexBuilder : public CIndexBuilder
+{
+public:
+    CTimestampIndexBuilder(CBlockIndex* pindexStart) : CIndexBuilder("timestampindex", fTimestampIndex, pindexStart) {}
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+    {
+        // Like DisconnectBlock, entries of disconnected blocks are left in place
+        if (!fConnect)
+            return true;
+        return pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+    }
+};
+
+struct CIndexOption
+{
+    const char* pszName;
+    const char* pszArg;
+    bool fDefault;
+    std::atomic<bool>* pfIndex;
+};
+
+static const CIndexOption indexOptions[] = {
+    {"txindex", "-txindex", DEFAULT_TXINDEX, &fTxIndex},
+    {"addressindex", "-addressindex", DEFAULT_ADDRESSINDEX, &fAddressIndex},
+    {"spentindex", "-spentindex", DEFAULT_SPENTINDEX, &fSpentIndex},
+    {"timestampindex", "-timestampindex", DEFAULT_TIMESTAMPINDEX, &fTimestampIndex},
+};
+
+static CCriticalSection cs_indexbuilders;
+static std::map<std::string, boost::shared_ptr<CIndexBuilder> > mapIndexBuilders;
+
+static CIndexBuilder* NewIndexBuilder(const std::string& strName, CBlockIndex* pindexStart)
+{
+    if (strName == "txindex")
+        return new CTxIndexBuilder(pindexStart);
+    if (strName == "addressindex")
+        return new CAddressIndexBuilder(pindexStart);
+    if (strName == "spentindex")
+        return new CSpentIndexBuilder(pindexStart);
+    return new CTimestampIndexBuilder(pindexStart);
+}
+
+bool StartIndexBuilders(boost::thread_group& threadGroup, std::string& strError)
+{
+    std::vector<boost::shared_ptr<CIndexBuilder> > vBuilders;
+    {
+        LOCK(cs_main);
+
+        // Address indexes written before the balance records were added get
+        // them from their deltas
+        if (fAddressIndex && !fAddressBalanceIndex) {
+            LogPrintf("Writing the address balance records...\n");
+            if (!pblocktree->RebuildAddressBalanceIndex(chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256())) {
+                strError = _("Error writing address balance records");
+                return false;
+            }
+            fAddressBalanceIndex = true;
+            pblocktree->WriteFlag("addressbalanceindex", true);
+        }
+
+        for (unsigned int i = 0; i < ARRAYLEN(indexOptions); i++) {
+            const CIndexOption& option = indexOptions[i];
+            uint256 hashCursor;
+            bool fCursor = pblocktree->ReadIndexBuildCursor(option.pszName, hashCursor);
+            if (*option.pfIndex) {
+                // Left behind if the node stopped right after finishing a build
+                if (fCursor)
+                    pblocktree->EraseIndexBuildCursor(option.pszName);
+                continue;
+            }
+            if (!GetBoolArg(option.pszArg, option.fDefault))
+                continue;
+            if (fHavePruned) {
+                strError = strprintf(_("Cannot build the index for %s from pruned block files, you need to rebuild the database using -reindex"), option.pszArg);
+                return false;
+            }
+
+            CBlockIndex* pindexStart = NULL;
+            if (fCursor) {
+                BlockMap::iterator mi = mapBlockIndex.find(hashCursor);
+                if (mi != mapBlockIndex.end())
+                    pindexStart = mi->second;
+            }
+            LogPrintf("Building the %s in the background from height %d\n", option.pszName, pindexStart ? pindexStart->nHeight + 1 : 0);
+            vBuilders.push_back(boost::shared_ptr<CIndexBuilder>(NewIndexBuilder(option.pszName, pindexStart)));
+        }
+    }
+
+    LOCK(cs_indexbuilders);
+    mapIndexBuilders.clear();
+    for (unsigned int i = 0; i < vBuilders.size(); i++) {
+        mapIndexBuilders[vBuilders[i]->strName] = vBuilders[i];
+        boost::function<void()> builderLoop = boost::bind(&CIndexBuilder::Thread, vBuilders[i]);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, vBuilders[i]->strName.c_str(), builderLoop));
+    }
+    return true;
+}
+
+std::vector<CIndexBuildInfo> GetIndexBuildInfo()
+{
+    std::vector<CIndexBuildInfo> vInfo;
+    for (unsigned int i = 0; i < ARRAYLEN(indexOptions); i++) {
+        const CIndexOption& option = indexOptions[i];
+        {
+            LOCK(cs_indexbuilders);
+            std::map<std::string, boost::shared_ptr<CIndexBuilder> >::const_iterator it = mapIndexBuilders.find(option.pszName);
+            if (it != mapIndexBuilders.end()) {
+                vInfo.push_back(it->second->GetInfo());
+                continue;
+            }
+        }
+        CIndexBuildInfo info;
+        info.strName = option.pszName;
+        LOCK(cs_main);
+        info.fEnabled = *option.pfIndex;
+        if (info.fEnabled) {
+            info.nHeight = chainActive.Height();
+            info.dProgress = 1.0;
+        }
+        vInfo.push_back(info);
+    }
+    return vInfo;
+}
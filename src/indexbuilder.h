@@ -0,0 +1,48 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef INDEXBUILDER_H
+#define INDEXBUILDER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace boost {
+class thread_group;
+} // namespace boost
+
+/** Where one of the optional indexes stands */
+struct CIndexBuildInfo
+{
+    std::string strName;
+    //! kept up to date by ConnectBlock and usable by RPCs
+    bool fEnabled;
+    //! being built in the background
+    bool fBuilding;
+    //! the last block the index has the entries of
+    int nHeight;
+    double dProgress;
+    //! blocks added by the builder since it was started
+    int64_t nBlocksBuilt;
+    double dBlocksPerSecond;
+    std::string strError;
+
+    CIndexBuildInfo() : fEnabled(false), fBuilding(false), nHeight(-1), dProgress(0), nBlocksBuilt(0), dBlocksPerSecond(0) {}
+};
+
+/**
+ * Start building the indexes asked for with -txindex, -addressindex,
+ * -spentindex and -timestampindex that the block database does not have
+ * yet, each on a thread of its own. A builder walks the active chain from
+ * the genesis block (or from where an earlier run stopped), and once it has
+ * caught up with the tip hands the index over to ConnectBlock, so no
+ * -reindex is needed to turn an index on.
+ */
+bool StartIndexBuilders(boost::thread_group& threadGroup, std::string& strError);
+
+/** Progress of the optional indexes, enabled or being built */
+std::vector<CIndexBuildInfo> GetIndexBuildInfo();
+
+#endif // INDEXBUILDER_H
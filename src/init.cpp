@@ -20,6 +20,7 @@
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "indexbuilder.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
@@ -56,6 +57,7 @@
 #include "masternode-payments.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "messagesigqueue.h"
 #include "masternodeconfig.h"
 #include "messagesigner.h"
 #include "netfulfilledman.h"
@@ -242,8 +244,12 @@ void PrepareShutdown()
     flatdb1.Dump(mnodeman);
     CFlatDB<CMasternodePayments> flatdb2("mnpayments.dat", "magicMasternodePaymentsCache");
     flatdb2.Dump(mnpayments);
+    if (pgovernancevotedb)
+        pgovernancevotedb->SyncVotes();
     CFlatDB<CGovernanceManager> flatdb3("governance.dat", "magicGovernanceCache");
     flatdb3.Dump(governance);
+    delete pgovernancevotedb;
+    pgovernancevotedb = NULL;
     CFlatDB<CNetFulfilledRequestManager> flatdb4("netfulfilled.dat", "magicFulfilledCache");
     flatdb4.Dump(netfulfilledman);
 
@@ -426,8 +432,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
+    strUsage += HelpMessageOpt("-addressindexdbcache=<n>", _("Set the address index database cache size in megabytes (default: half of an eighth of -dbcache, 1 when the index is off)"));
+    strUsage += HelpMessageOpt("-addressindexmaxresults=<n>", strprintf(_("Largest number of address index entries one RPC call may return; calls over it have to be paged (default: %u)"), DEFAULT_ADDRESSINDEX_MAX_RESULTS));
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
+    strUsage += HelpMessageOpt("-timestampindexdbcache=<n>", _("Set the timestamp index database cache size in megabytes (default: an eighth of an eighth of -dbcache, 1 when the index is off)"));
     strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
+    strUsage += HelpMessageOpt("-spentindexdbcache=<n>", _("Set the spent index database cache size in megabytes (default: three eighths of an eighth of -dbcache, 1 when the index is off)"));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -527,6 +537,9 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+#ifdef ENABLE_WALLET
+        strUsage += HelpMessageOpt("-checkwalletbalances", strprintf("Check the running wallet balance totals against a full scan of the wallet on every balance query (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+#endif
 #ifdef ENABLE_WALLET
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
 #endif
@@ -564,6 +577,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxmsgsigcachesize=<n>", strprintf("Limit size of the masternode message signature cache to <n> MiB (default: %u)", DEFAULT_MAX_MESSAGE_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -585,6 +599,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mnconf=<file>", strprintf(_("Specify masternode configuration file (default: %s)"), "masternode.conf"));
     strUsage += HelpMessageOpt("-mnconflock=<n>", strprintf(_("Lock masternodes from masternode configuration file (default: %u)"), 1));
     strUsage += HelpMessageOpt("-masternodeprivkey=<n>", _("Set the masternode private key"));
+    strUsage += HelpMessageOpt("-mnsigthreads=<n>", strprintf(_("Set the number of threads verifying masternode message signatures (0 to %d, 0 = verify on the message handler thread, default: %d)"),
+        MAX_MESSAGE_SIGCHECK_THREADS, DEFAULT_MESSAGE_SIGCHECK_THREADS));
 
     strUsage += HelpMessageGroup(_("PrivatePay options:"));
     strUsage += HelpMessageOpt("-enableprivatepay=<n>", strprintf(_("Enable use of automated PrivatePay for funds stored in this wallet (0-1, default: %u)"), 0));
@@ -611,6 +627,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockminsize=<n>", strprintf(_("Set minimum block size in bytes (default: %u)"), DEFAULT_BLOCK_MIN_SIZE));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
+    strUsage += HelpMessageOpt("-blocktemplatemaxstaleness=<n>", strprintf(_("Rebuild the getblocktemplate template from scratch at least every <n> seconds, only applying mempool changes to it in between (0 to always rebuild, default: %d)"), DEFAULT_BLOCK_TEMPLATE_MAX_STALENESS));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
@@ -782,6 +799,23 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
 }
 
+/** Cache size in bytes for the database of the optional index strIndexArg:
+ *  -<index>dbcache in MiB if set, nDefault otherwise. A database whose index
+ *  is off gets no more than 1 MiB.
+ */
+static int64_t GetIndexDBCache(const std::string& strIndexArg, bool fIndexDefault, int64_t nDefault)
+{
+    int64_t nCache = nDefault;
+    if (mapArgs.count(strIndexArg + "dbcache")) {
+        nCache = GetArg(strIndexArg + "dbcache", 0) << 20;
+        nCache = std::max<int64_t>(nCache, 1 << 20);
+        nCache = std::min<int64_t>(nCache, nMaxDbCache << 20);
+    }
+    if (nCache > (1 << 20) && !GetBoolArg(strIndexArg, fIndexDefault))
+        nCache = (1 << 20);
+    return nCache;
+}
+
 /** Sanity checks
  *  Ensure that Pura Core is running in a usable environment with all
  *  necessary library support.
@@ -1169,6 +1203,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
+    fCheckWalletBalances = GetBoolArg("-checkwalletbalances", chainparams.DefaultConsistencyChecks());
 
     std::string strWalletFile = GetArg("-wallet", "wallet.dat");
 #endif // ENABLE_WALLET
@@ -1505,11 +1540,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", DEFAULT_TXINDEX))
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
+    // The optional indexes share an eighth of the rest by default: half for the
+    // address index, as it takes most of the writes, three eighths for the
+    // spent index and an eighth for the timestamp index
+    int64_t nIndexDBCache = nTotalCache / 8;
+    int64_t nAddressIndexDBCache = GetIndexDBCache("-addressindex", DEFAULT_ADDRESSINDEX, nIndexDBCache / 2);
+    int64_t nSpentIndexDBCache = GetIndexDBCache("-spentindex", DEFAULT_SPENTINDEX, nIndexDBCache * 3 / 8);
+    int64_t nTimestampIndexDBCache = GetIndexDBCache("-timestampindex", DEFAULT_TIMESTAMPINDEX, nIndexDBCache / 8);
+    nTotalCache -= nAddressIndexDBCache + nSpentIndexDBCache + nTimestampIndexDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for spent index database\n", nSpentIndexDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for timestamp index database\n", nTimestampIndexDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
@@ -1529,11 +1575,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinscatcher;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, nAddressIndexDBCache, nSpentIndexDBCache, nTimestampIndexDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                if (!pblocktree->MigrateIndexes()) {
+                    strLoadError = _("Error moving indexes to their own databases");
+                    break;
+                }
+
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
                     //If we're reindexing in prune mode, wipe away unusable block files and all undo data files
@@ -1557,9 +1608,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
+                // Check for changed -txindex state. Turning an index on only
+                // needs it to be built, which is done in the background.
+                if (fTxIndex && !GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to turn off -txindex");
                     break;
                 }
 
@@ -1851,6 +1903,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             MilliSleep(10);
     }
 
+    // Build the indexes turned on after the block database was created
+    std::string strIndexError;
+    if (!StartIndexBuilders(threadGroup, strIndexError))
+        return InitError(strIndexError);
+
     // ********************************************************* Step 11a: setup PrivatePay
     fMasterNode = GetBoolArg("-masternode", false);
 
@@ -1920,6 +1977,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
     LogPrintf("fLiteMode %d\n", fLiteMode);
+
+    if(!fLiteMode) {
+        int nMessageSigCheckThreads = std::max(0, std::min((int)GetArg("-mnsigthreads", DEFAULT_MESSAGE_SIGCHECK_THREADS), MAX_MESSAGE_SIGCHECK_THREADS));
+        LogPrintf("Using %u threads for masternode message signature verification\n", nMessageSigCheckThreads);
+        for (int i = 0; i < nMessageSigCheckThreads; i++)
+            threadGroup.create_thread(boost::bind(&CMessageSigQueue::Thread, &messageSigQueue));
+    }
     LogPrintf("nInstaPayDepth %d\n", nInstaPayDepth);
     LogPrintf("PrivatePay rounds %d\n", privatePayClient.nPrivatePayRounds);
     LogPrintf("PrivatePay amount %d\n", privatePayClient.nPrivatePayAmount);
@@ -1940,6 +2004,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return InitError(_("Failed to load masternode cache from") + "\n" + (pathDB / strDBName).string());
     }
 
+    if(!fLiteMode) {
+        // votes flushed out of governance.dat, nothing refers to them if governance.dat is skipped
+        pgovernancevotedb = new CGovernanceVoteDB(GOVERNANCE_VOTE_DB_CACHE, false, !mnodeman.size());
+    }
+
     if(mnodeman.size()) {
         strDBName = "mnpayments.dat";
         uiInterface.InitMessage(_("Loading masternode payment cache..."));
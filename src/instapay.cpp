@@ -37,6 +37,164 @@ CInstaPay instapay;
 // step 3) Once there are COutPointLock::SIGNATURES_REQUIRED valid "txvote" messages per each spent outpoint
 //         for a corresponding "txlreg" message, all outpoints from that tx are treated as locked
 
+//
+// CTxLockLatencyStats
+//
+
+void CTxLockLatencyStats::Add(int64_t nLatencyMicros)
+{
+    int nBucket = 0;
+    while(nBucket < BUCKETS - 1 && nLatencyMicros >= GetBucketLimitMillis(nBucket) * 1000) {
+        nBucket++;
+    }
+    vBuckets[nBucket]++;
+    nCount++;
+    nTotalMicros += nLatencyMicros;
+    nMaxMicros = std::max(nMaxMicros, nLatencyMicros);
+}
+
+int64_t CTxLockLatencyStats::GetBucketLimitMillis(int nBucket)
+{
+    return nBucket < BUCKETS - 1 ? (int64_t)1 << nBucket : -1;
+}
+
+bool CTxLockLatencyStats::GetPercentileMillis(double dPercentile, int64_t& nMillisRet) const
+{
+    if(nCount == 0) return false;
+
+    uint64_t nSeen = 0;
+    int nBucket = 0;
+    for(; nBucket < BUCKETS - 1; nBucket++) {
+        nSeen += vBuckets[nBucket];
+        if(nSeen > 0 && nSeen >= dPercentile * nCount) break;
+    }
+    nMillisRet = GetBucketLimitMillis(nBucket);
+    return true;
+}
+
+//
+// CTxLockVoteOrphans
+//
+
+bool CTxLockVoteOrphans::AddWaitingForTx(const CTxLockVote& vote)
+{
+    uint256 nVoteHash = vote.GetHash();
+    if(!mapVotes.insert(std::make_pair(nVoteHash, vote)).second) return false;
+    mapVotesByTx[vote.GetTxHash()].insert(nVoteHash);
+    return true;
+}
+
+bool CTxLockVoteOrphans::AddWaitingForMasternode(const CTxLockVote& vote)
+{
+    if(nVotesWaitingForMasternode >= MAX_VOTES_WAITING_FOR_MASTERNODE) return false;
+    uint256 nVoteHash = vote.GetHash();
+    if(!mapVotes.insert(std::make_pair(nVoteHash, vote)).second) return false;
+    mapVotesByMasternode[vote.GetMasternodeOutpoint()].insert(nVoteHash);
+    nVotesWaitingForMasternode++;
+    return true;
+}
+
+void CTxLockVoteOrphans::Erase(const uint256& nVoteHash)
+{
+    std::map<uint256, CTxLockVote>::iterator it = mapVotes.find(nVoteHash);
+    if(it == mapVotes.end()) return;
+
+    // the vote is in one of the indexes only, depending on what it was waiting for
+    std::map<uint256, std::set<uint256> >::iterator itTx = mapVotesByTx.find(it->second.GetTxHash());
+    if(itTx != mapVotesByTx.end() && itTx->second.erase(nVoteHash) && itTx->second.empty()) {
+        mapVotesByTx.erase(itTx);
+    }
+    std::map<COutPoint, std::set<uint256> >::iterator itMn = mapVotesByMasternode.find(it->second.GetMasternodeOutpoint());
+    if(itMn != mapVotesByMasternode.end() && itMn->second.erase(nVoteHash)) {
+        nVotesWaitingForMasternode--;
+        if(itMn->second.empty()) {
+            mapVotesByMasternode.erase(itMn);
+        }
+    }
+
+    mapVotes.erase(it);
+}
+
+std::vector<CTxLockVote> CTxLockVoteOrphans::PopVotes(const std::set<uint256>& setVoteHashes)
+{
+    std::vector<CTxLockVote> vecVotes;
+    vecVotes.reserve(setVoteHashes.size());
+    BOOST_FOREACH(const uint256& nVoteHash, setVoteHashes) {
+        vecVotes.push_back(mapVotes[nVoteHash]);
+    }
+    BOOST_FOREACH(const CTxLockVote& vote, vecVotes) {
+        Erase(vote.GetHash());
+    }
+    return vecVotes;
+}
+
+std::vector<CTxLockVote> CTxLockVoteOrphans::PopVotesForTx(const uint256& txHash)
+{
+    std::map<uint256, std::set<uint256> >::iterator it = mapVotesByTx.find(txHash);
+    if(it == mapVotesByTx.end()) return std::vector<CTxLockVote>();
+    // copy, the set is gone once the last vote is erased
+    std::set<uint256> setVoteHashes = it->second;
+    return PopVotes(setVoteHashes);
+}
+
+std::vector<CTxLockVote> CTxLockVoteOrphans::PopVotesForMasternode(const COutPoint& outpointMasternode)
+{
+    std::map<COutPoint, std::set<uint256> >::iterator it = mapVotesByMasternode.find(outpointMasternode);
+    if(it == mapVotesByMasternode.end()) return std::vector<CTxLockVote>();
+    std::set<uint256> setVoteHashes = it->second;
+    return PopVotes(setVoteHashes);
+}
+
+std::vector<uint256> CTxLockVoteOrphans::GetVoteHashesForTx(const uint256& txHash) const
+{
+    std::map<uint256, std::set<uint256> >::const_iterator it = mapVotesByTx.find(txHash);
+    if(it == mapVotesByTx.end()) return std::vector<uint256>();
+    return std::vector<uint256>(it->second.begin(), it->second.end());
+}
+
+int CTxLockVoteOrphans::CountVotesForTxAndOutPoint(const uint256& txHash, const COutPoint& outpoint) const
+{
+    std::map<uint256, std::set<uint256> >::const_iterator it = mapVotesByTx.find(txHash);
+    if(it == mapVotesByTx.end()) return 0;
+
+    int nCountVotes = 0;
+    BOOST_FOREACH(const uint256& nVoteHash, it->second) {
+        std::map<uint256, CTxLockVote>::const_iterator itVote = mapVotes.find(nVoteHash);
+        if(itVote != mapVotes.end() && itVote->second.GetOutpoint() == outpoint) {
+            nCountVotes++;
+        }
+    }
+    return nCountVotes;
+}
+
+std::vector<COutPoint> CTxLockVoteOrphans::GetWaitedForMasternodes() const
+{
+    std::vector<COutPoint> vecOutpoints;
+    vecOutpoints.reserve(mapVotesByMasternode.size());
+    std::map<COutPoint, std::set<uint256> >::const_iterator it = mapVotesByMasternode.begin();
+    while(it != mapVotesByMasternode.end()) {
+        vecOutpoints.push_back(it->first);
+        ++it;
+    }
+    return vecOutpoints;
+}
+
+std::vector<CTxLockVote> CTxLockVoteOrphans::RemoveExpired(int64_t nTimeCutoff)
+{
+    std::vector<CTxLockVote> vecExpired;
+    std::map<uint256, CTxLockVote>::iterator it = mapVotes.begin();
+    while(it != mapVotes.end()) {
+        if(it->second.GetTimeCreated() < nTimeCutoff) {
+            vecExpired.push_back(it->second);
+        }
+        ++it;
+    }
+    BOOST_FOREACH(const CTxLockVote& vote, vecExpired) {
+        Erase(vote.GetHash());
+    }
+    return vecExpired;
+}
+
 //
 // CInstaPay
 //
@@ -58,53 +216,75 @@ void CInstaPay::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStrea
         CTxLockVote vote;
         vRecv >> vote;
 
-        LOCK(cs_main);
-#ifdef ENABLE_WALLET
-        if (pwalletMain)
-            LOCK(pwalletMain->cs_wallet);
-#endif
-        LOCK(cs_instapay);
-
-
         uint256 nVoteHash = vote.GetHash();
 
-        if(mapTxLockVotes.count(nVoteHash)) return;
-        mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+        {
+            LOCK(cs_instapay);
+            if(mapTxLockVotes.count(nVoteHash)) return;
+            mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+        }
 
+        // verify the signature off this thread if the masternode is known,
+        // TxLockVoteSignatureChecked() takes it from there
+        masternode_info_t infoMn = mnodeman.GetMasternodeInfo(CTxIn(vote.GetMasternodeOutpoint()));
+        if(infoMn.fInfoValid) {
+            std::vector<CMessageSigCheck> vChecks(1, CMessageSigCheck(infoMn.pubKeyMasternode, vote.GetSignature(), vote.GetSignatureMessage()));
+            pfrom->AddRef();
+            if(messageSigQueue.Add(vChecks, std::bind(&CInstaPay::TxLockVoteSignatureChecked, this, pfrom, vote, std::placeholders::_1))) return;
+            LogPrint("instapay", "TXLOCKVOTE -- signature queue is full, dropping vote: hash=%s\n", nVoteHash.ToString());
+            {
+                // forget the vote so that it can be accepted once it's announced again
+                LOCK(cs_instapay);
+                mapTxLockVotes.erase(nVoteHash);
+            }
+            pfrom->Release();
+            return;
+        }
+
+        // neither cs_main nor cs_instapay are held while the vote is validated
         ProcessTxLockVote(pfrom, vote);
 
         return;
     }
 }
 
-bool CInstaPay::ProcessTxLockRequest(const CTxLockRequest& txLockRequest)
+void CInstaPay::TxLockVoteSignatureChecked(CNode* pfrom, CTxLockVote vote, const std::vector<CMessageSigCheck>& vChecks)
 {
-    LOCK2(cs_main, cs_instapay);
+    vote.checkedSig.Set(vChecks[0]);
+    ProcessTxLockVote(pfrom, vote);
+    pfrom->Release();
+}
 
+bool CInstaPay::ProcessTxLockRequest(const CTxLockRequest& txLockRequest)
+{
     uint256 txHash = txLockRequest.GetHash();
 
-    // Check to see if we conflict with existing completed lock,
-    // fail if so, there can't be 2 completed locks for the same outpoint
-    BOOST_FOREACH(const CTxIn& txin, txLockRequest.vin) {
-        std::map<COutPoint, uint256>::iterator it = mapLockedOutpoints.find(txin.prevout);
-        if(it != mapLockedOutpoints.end()) {
-            // Conflicting with complete lock, ignore this one
-            // (this could be the one we have but we don't want to try to lock it twice anyway)
-            LogPrintf("CInstaPay::ProcessTxLockRequest -- WARNING: Found conflicting completed Transaction Lock, skipping current one, txid=%s, completed lock txid=%s\n",
-                    txLockRequest.GetHash().ToString(), it->second.ToString());
-            return false;
+    {
+        LOCK(cs_instapay);
+
+        // Check to see if we conflict with existing completed lock,
+        // fail if so, there can't be 2 completed locks for the same outpoint
+        BOOST_FOREACH(const CTxIn& txin, txLockRequest.vin) {
+            std::map<COutPoint, uint256>::iterator it = mapLockedOutpoints.find(txin.prevout);
+            if(it != mapLockedOutpoints.end()) {
+                // Conflicting with complete lock, ignore this one
+                // (this could be the one we have but we don't want to try to lock it twice anyway)
+                LogPrintf("CInstaPay::ProcessTxLockRequest -- WARNING: Found conflicting completed Transaction Lock, skipping current one, txid=%s, completed lock txid=%s\n",
+                        txLockRequest.GetHash().ToString(), it->second.ToString());
+                return false;
+            }
         }
-    }
 
-    // Check to see if there are votes for conflicting request,
-    // if so - do not fail, just warn user
-    BOOST_FOREACH(const CTxIn& txin, txLockRequest.vin) {
-        std::map<COutPoint, std::set<uint256> >::iterator it = mapVotedOutpoints.find(txin.prevout);
-        if(it != mapVotedOutpoints.end()) {
-            BOOST_FOREACH(const uint256& hash, it->second) {
-                if(hash != txLockRequest.GetHash()) {
-                    LogPrint("instapay", "CInstaPay::ProcessTxLockRequest -- Double spend attempt! %s\n", txin.prevout.ToStringShort());
-                    // do not fail here, let it go and see which one will get the votes to be locked
+        // Check to see if there are votes for conflicting request,
+        // if so - do not fail, just warn user
+        BOOST_FOREACH(const CTxIn& txin, txLockRequest.vin) {
+            std::map<COutPoint, std::set<uint256> >::iterator it = mapVotedOutpoints.find(txin.prevout);
+            if(it != mapVotedOutpoints.end()) {
+                BOOST_FOREACH(const uint256& hash, it->second) {
+                    if(hash != txLockRequest.GetHash()) {
+                        LogPrint("instapay", "CInstaPay::ProcessTxLockRequest -- Double spend attempt! %s\n", txin.prevout.ToStringShort());
+                        // do not fail here, let it go and see which one will get the votes to be locked
+                    }
                 }
             }
         }
@@ -117,15 +297,13 @@ bool CInstaPay::ProcessTxLockRequest(const CTxLockRequest& txLockRequest)
     }
     LogPrintf("CInstaPay::ProcessTxLockRequest -- accepted, txid=%s\n", txHash.ToString());
 
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
-    CTxLockCandidate& txLockCandidate = itLockCandidate->second;
-    Vote(txLockCandidate);
-    ProcessOrphanTxLockVotes();
+    Vote(txHash);
+    ProcessOrphanTxLockVotes(txHash);
 
     // Masternodes will sometimes propagate votes before the transaction is known to the client.
     // If this just happened - lock inputs, resolve conflicting locks, update transaction status
     // forcing external script notification.
-    TryToFinalizeLockCandidate(txLockCandidate);
+    TryToFinalizeLockCandidate(txHash);
 
     return true;
 }
@@ -156,21 +334,29 @@ bool CInstaPay::CreateTxLockCandidate(const CTxLockRequest& txLockRequest)
     return true;
 }
 
-void CInstaPay::Vote(CTxLockCandidate& txLockCandidate)
+void CInstaPay::Vote(const uint256& txHash)
 {
     if(!fMasterNode) return;
 
-    LOCK2(cs_main, cs_instapay);
+    std::vector<COutPoint> vecOutpoints;
+    {
+        LOCK(cs_instapay);
+        std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+        if(itLockCandidate == mapTxLockCandidates.end()) return;
+        std::map<COutPoint, COutPointLock>::iterator itOutpointLock = itLockCandidate->second.mapOutPointLocks.begin();
+        while(itOutpointLock != itLockCandidate->second.mapOutPointLocks.end()) {
+            vecOutpoints.push_back(itOutpointLock->first);
+            ++itOutpointLock;
+        }
+    }
 
-    uint256 txHash = txLockCandidate.GetHash();
     // check if we need to vote on this candidate's outpoints,
     // it's possible that we need to vote for several of them
-    std::map<COutPoint, COutPointLock>::iterator itOutpointLock = txLockCandidate.mapOutPointLocks.begin();
-    while(itOutpointLock != txLockCandidate.mapOutPointLocks.end()) {
+    BOOST_FOREACH(const COutPoint& outpoint, vecOutpoints) {
 
-        int nPrevoutHeight = GetUTXOHeight(itOutpointLock->first);
+        int nPrevoutHeight = GetUTXOHeight(outpoint);
         if(nPrevoutHeight == -1) {
-            LogPrint("instapay", "CInstaPay::Vote -- Failed to find UTXO %s\n", itOutpointLock->first.ToStringShort());
+            LogPrint("instapay", "CInstaPay::Vote -- Failed to find UTXO %s\n", outpoint.ToStringShort());
             return;
         }
 
@@ -180,20 +366,24 @@ void CInstaPay::Vote(CTxLockCandidate& txLockCandidate)
 
         if(n == -1) {
             LogPrint("instapay", "CInstaPay::Vote -- Can't calculate rank for masternode %s\n", activeMasternode.vin.prevout.ToStringShort());
-            ++itOutpointLock;
             continue;
         }
 
         int nSignaturesTotal = COutPointLock::SIGNATURES_TOTAL;
         if(n > nSignaturesTotal) {
             LogPrint("instapay", "CInstaPay::Vote -- Masternode not in the top %d (%d)\n", nSignaturesTotal, n);
-            ++itOutpointLock;
             continue;
         }
 
         LogPrint("instapay", "CInstaPay::Vote -- In the top %d (%d)\n", nSignaturesTotal, n);
 
-        std::map<COutPoint, std::set<uint256> >::iterator itVoted = mapVotedOutpoints.find(itOutpointLock->first);
+        LOCK(cs_instapay);
+
+        std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+        if(itLockCandidate == mapTxLockCandidates.end()) return; // removed meanwhile
+        std::map<COutPoint, COutPointLock>::iterator itOutpointLock = itLockCandidate->second.mapOutPointLocks.find(outpoint);
+
+        std::map<COutPoint, std::set<uint256> >::iterator itVoted = mapVotedOutpoints.find(outpoint);
 
         // Check to see if we already voted for this outpoint,
         // refuse to vote twice or to include the same outpoint in another tx
@@ -201,23 +391,22 @@ void CInstaPay::Vote(CTxLockCandidate& txLockCandidate)
         if(itVoted != mapVotedOutpoints.end()) {
             BOOST_FOREACH(const uint256& hash, itVoted->second) {
                 std::map<uint256, CTxLockCandidate>::iterator it2 = mapTxLockCandidates.find(hash);
-                if(it2->second.HasMasternodeVoted(itOutpointLock->first, activeMasternode.vin.prevout)) {
+                if(it2->second.HasMasternodeVoted(outpoint, activeMasternode.vin.prevout)) {
                     // we already voted for this outpoint to be included either in the same tx or in a competing one,
                     // skip it anyway
                     fAlreadyVoted = true;
                     LogPrintf("CInstaPay::Vote -- WARNING: We already voted for this outpoint, skipping: txHash=%s, outpoint=%s\n",
-                            txHash.ToString(), itOutpointLock->first.ToStringShort());
+                            txHash.ToString(), outpoint.ToStringShort());
                     break;
                 }
             }
         }
         if(fAlreadyVoted) {
-            ++itOutpointLock;
             continue; // skip to the next outpoint
         }
 
         // we haven't voted for this outpoint yet, let's try to do this now
-        CTxLockVote vote(txHash, itOutpointLock->first, activeMasternode.vin.prevout);
+        CTxLockVote vote(txHash, outpoint, activeMasternode.vin.prevout);
 
         if(!vote.Sign()) {
             LogPrintf("CInstaPay::Vote -- Failed to sign consensus vote\n");
@@ -233,161 +422,194 @@ void CInstaPay::Vote(CTxLockCandidate& txLockCandidate)
         mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
         if(itOutpointLock->second.AddVote(vote)) {
             LogPrintf("CInstaPay::Vote -- Vote created successfully, relaying: txHash=%s, outpoint=%s, vote=%s\n",
-                    txHash.ToString(), itOutpointLock->first.ToStringShort(), nVoteHash.ToString());
+                    txHash.ToString(), outpoint.ToStringShort(), nVoteHash.ToString());
 
             if(itVoted == mapVotedOutpoints.end()) {
                 std::set<uint256> setHashes;
                 setHashes.insert(txHash);
-                mapVotedOutpoints.insert(std::make_pair(itOutpointLock->first, setHashes));
+                mapVotedOutpoints.insert(std::make_pair(outpoint, setHashes));
             } else {
-                mapVotedOutpoints[itOutpointLock->first].insert(txHash);
-                if(mapVotedOutpoints[itOutpointLock->first].size() > 1) {
+                mapVotedOutpoints[outpoint].insert(txHash);
+                if(mapVotedOutpoints[outpoint].size() > 1) {
                     // it's ok to continue, just warn user
                     LogPrintf("CInstaPay::Vote -- WARNING: Vote conflicts with some existing votes: txHash=%s, outpoint=%s, vote=%s\n",
-                            txHash.ToString(), itOutpointLock->first.ToStringShort(), nVoteHash.ToString());
+                            txHash.ToString(), outpoint.ToStringShort(), nVoteHash.ToString());
                 }
             }
 
             vote.Relay();
         }
-
-        ++itOutpointLock;
     }
 }
 
 //received a consensus vote
 bool CInstaPay::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote)
 {
-    // cs_main, cs_wallet and cs_instapay should be already locked
-    AssertLockHeld(cs_main);
-#ifdef ENABLE_WALLET
-    if (pwalletMain)
-        AssertLockHeld(pwalletMain->cs_wallet);
-#endif
-    AssertLockHeld(cs_instapay);
+    // Must be called without cs_instapay held. The vote is validated against the masternode
+    // ranks and the utxo set with the short cs_main locks IsValid() takes for its lookups only,
+    // cs_main and cs_wallet are needed again only if the vote completes a lock.
 
     uint256 txHash = vote.GetTxHash();
 
     if(!vote.IsValid(pfrom)) {
         // could be because of missing MN
         LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Vote is invalid, txid=%s\n", txHash.ToString());
+        if(!mnodeman.Has(CTxIn(vote.GetMasternodeOutpoint()))) {
+            LOCK(cs_instapay);
+            if(txLockVotesOrphan.AddWaitingForMasternode(vote)) {
+                // IsValid() asked for this masternode already, check the vote again once it's announced
+                LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s unknown masternode\n",
+                        txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
+            }
+        }
         return false;
     }
 
-    // Masternodes will sometimes propagate votes before the transaction is known to the client,
-    // will actually process only after the lock request itself has arrived
+    bool fReprocessLockRequest = false;
+    CTxLockRequest txLockRequestReprocess;
+    {
+        LOCK(cs_instapay);
 
-    std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.find(txHash);
-    if(it == mapTxLockCandidates.end()) {
-        if(!mapTxLockVotesOrphan.count(vote.GetHash())) {
-            mapTxLockVotesOrphan[vote.GetHash()] = vote;
-            LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s new\n",
-                    txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
-            bool fReprocess = true;
-            std::map<uint256, CTxLockRequest>::iterator itLockRequest = mapLockRequestAccepted.find(txHash);
-            if(itLockRequest == mapLockRequestAccepted.end()) {
-                itLockRequest = mapLockRequestRejected.find(txHash);
-                if(itLockRequest == mapLockRequestRejected.end()) {
-                    // still too early, wait for tx lock request
-                    fReprocess = false;
+        // Masternodes will sometimes propagate votes before the transaction is known to the client,
+        // will actually process only after the lock request itself has arrived
+
+        std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.find(txHash);
+        if(it == mapTxLockCandidates.end()) {
+            if(txLockVotesOrphan.AddWaitingForTx(vote)) {
+                LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s new\n",
+                        txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
+                bool fReprocess = true;
+                std::map<uint256, CTxLockRequest>::iterator itLockRequest = mapLockRequestAccepted.find(txHash);
+                if(itLockRequest == mapLockRequestAccepted.end()) {
+                    itLockRequest = mapLockRequestRejected.find(txHash);
+                    if(itLockRequest == mapLockRequestRejected.end()) {
+                        // still too early, wait for tx lock request
+                        fReprocess = false;
+                    }
+                }
+                if(fReprocess && IsEnoughOrphanVotesForTx(itLockRequest->second)) {
+                    // We have enough votes for corresponding lock to complete,
+                    // tx lock request should already be received at this stage.
+                    LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Found enough orphan votes, reprocessing Transaction Lock Request: txid=%s\n", txHash.ToString());
+                    fReprocessLockRequest = true;
+                    txLockRequestReprocess = itLockRequest->second;
                 }
+            } else {
+                LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s seen\n",
+                        txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
             }
-            if(fReprocess && IsEnoughOrphanVotesForTx(itLockRequest->second)) {
-                // We have enough votes for corresponding lock to complete,
-                // tx lock request should already be received at this stage.
-                LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Found enough orphan votes, reprocessing Transaction Lock Request: txid=%s\n", txHash.ToString());
-                ProcessTxLockRequest(itLockRequest->second);
+
+            if(!fReprocessLockRequest) {
+                // This tracks those messages and allows only the same rate as of the rest of the network
+                // TODO: make sure this works good enough for multi-quorum
+
+                int nMasternodeOrphanExpireTime = GetTime() + 60*10; // keep time data for 10 minutes
+                if(!mapMasternodeOrphanVotes.count(vote.GetMasternodeOutpoint())) {
+                    mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
+                } else {
+                    int64_t nPrevOrphanVote = mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()];
+                    if(nPrevOrphanVote > GetTime() && nPrevOrphanVote > GetAverageMasternodeOrphanVoteTime()) {
+                        LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- masternode is spamming orphan Transaction Lock Votes: txid=%s  masternode=%s\n",
+                                txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
+                        // Misbehaving(pfrom->id, 1);
+                        return false;
+                    }
+                    // not spamming, refresh
+                    mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
+                }
+
                 return true;
             }
         } else {
-            LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s seen\n",
-                    txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
-        }
+            LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Transaction Lock Vote, txid=%s\n", txHash.ToString());
+
+            std::map<COutPoint, std::set<uint256> >::iterator it1 = mapVotedOutpoints.find(vote.GetOutpoint());
+            if(it1 != mapVotedOutpoints.end()) {
+                BOOST_FOREACH(const uint256& hash, it1->second) {
+                    if(hash != txHash) {
+                        // same outpoint was already voted to be locked by another tx lock request,
+                        // find out if the same mn voted on this outpoint before
+                        std::map<uint256, CTxLockCandidate>::iterator it2 = mapTxLockCandidates.find(hash);
+                        if(it2->second.HasMasternodeVoted(vote.GetOutpoint(), vote.GetMasternodeOutpoint())) {
+                            // yes, it did, refuse to accept a vote to include the same outpoint in another tx
+                            // from the same masternode.
+                            // TODO: apply pose ban score to this masternode?
+                            // NOTE: if we decide to apply pose ban score here, this vote must be relayed further
+                            // to let all other nodes know about this node's misbehaviour and let them apply
+                            // pose ban score too.
+                            LogPrintf("CInstaPay::ProcessTxLockVote -- masternode sent conflicting votes! %s\n", vote.GetMasternodeOutpoint().ToStringShort());
+                            return false;
+                        }
+                    }
+                }
+                // we have votes by other masternodes only (so far), let's continue and see who will win
+                it1->second.insert(txHash);
+            } else {
+                std::set<uint256> setHashes;
+                setHashes.insert(txHash);
+                mapVotedOutpoints.insert(std::make_pair(vote.GetOutpoint(), setHashes));
+            }
 
-        // This tracks those messages and allows only the same rate as of the rest of the network
-        // TODO: make sure this works good enough for multi-quorum
+            CTxLockCandidate& txLockCandidate = it->second;
 
-        int nMasternodeOrphanExpireTime = GetTime() + 60*10; // keep time data for 10 minutes
-        if(!mapMasternodeOrphanVotes.count(vote.GetMasternodeOutpoint())) {
-            mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
-        } else {
-            int64_t nPrevOrphanVote = mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()];
-            if(nPrevOrphanVote > GetTime() && nPrevOrphanVote > GetAverageMasternodeOrphanVoteTime()) {
-                LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- masternode is spamming orphan Transaction Lock Votes: txid=%s  masternode=%s\n",
-                        txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
-                // Misbehaving(pfrom->id, 1);
+            if(!txLockCandidate.AddVote(vote)) {
+                // this should never happen
                 return false;
             }
-            // not spamming, refresh
-            mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
-        }
 
-        return true;
-    }
-
-    LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Transaction Lock Vote, txid=%s\n", txHash.ToString());
-
-    std::map<COutPoint, std::set<uint256> >::iterator it1 = mapVotedOutpoints.find(vote.GetOutpoint());
-    if(it1 != mapVotedOutpoints.end()) {
-        BOOST_FOREACH(const uint256& hash, it1->second) {
-            if(hash != txHash) {
-                // same outpoint was already voted to be locked by another tx lock request,
-                // find out if the same mn voted on this outpoint before
-                std::map<uint256, CTxLockCandidate>::iterator it2 = mapTxLockCandidates.find(hash);
-                if(it2->second.HasMasternodeVoted(vote.GetOutpoint(), vote.GetMasternodeOutpoint())) {
-                    // yes, it did, refuse to accept a vote to include the same outpoint in another tx
-                    // from the same masternode.
-                    // TODO: apply pose ban score to this masternode?
-                    // NOTE: if we decide to apply pose ban score here, this vote must be relayed further
-                    // to let all other nodes know about this node's misbehaviour and let them apply
-                    // pose ban score too.
-                    LogPrintf("CInstaPay::ProcessTxLockVote -- masternode sent conflicting votes! %s\n", vote.GetMasternodeOutpoint().ToStringShort());
-                    return false;
-                }
-            }
+            int nSignatures = txLockCandidate.CountVotes();
+            int nSignaturesMax = txLockCandidate.txLockRequest.GetMaxSignatures();
+            LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Transaction Lock signatures count: %d/%d, vote hash=%s\n",
+                    nSignatures, nSignaturesMax, vote.GetHash().ToString());
         }
-        // we have votes by other masternodes only (so far), let's continue and see who will win
-        it1->second.insert(txHash);
-    } else {
-        std::set<uint256> setHashes;
-        setHashes.insert(txHash);
-        mapVotedOutpoints.insert(std::make_pair(vote.GetOutpoint(), setHashes));
     }
 
-    CTxLockCandidate& txLockCandidate = it->second;
-
-    if(!txLockCandidate.AddVote(vote)) {
-        // this should never happen
-        return false;
+    if(fReprocessLockRequest) {
+        ProcessTxLockRequest(txLockRequestReprocess);
+        return true;
     }
 
-    int nSignatures = txLockCandidate.CountVotes();
-    int nSignaturesMax = txLockCandidate.txLockRequest.GetMaxSignatures();
-    LogPrint("instapay", "CInstaPay::ProcessTxLockVote -- Transaction Lock signatures count: %d/%d, vote hash=%s\n",
-            nSignatures, nSignaturesMax, vote.GetHash().ToString());
-
-    TryToFinalizeLockCandidate(txLockCandidate);
+    TryToFinalizeLockCandidate(txHash);
 
     vote.Relay();
 
     return true;
 }
 
-void CInstaPay::ProcessOrphanTxLockVotes()
+void CInstaPay::ProcessOrphanTxLockVotes(const uint256& txHash)
 {
-    LOCK(cs_main);
-#ifdef ENABLE_WALLET
-    if (pwalletMain)
-        LOCK(pwalletMain->cs_wallet);
-#endif
-    LOCK(cs_instapay);
+    // Only the votes waiting for this lock request are unblocked, they are not orphans anymore
+    // whatever the result of processing them is.
+    std::vector<CTxLockVote> vecVotes;
+    {
+        LOCK(cs_instapay);
+        vecVotes = txLockVotesOrphan.PopVotesForTx(txHash);
+    }
 
-    std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin();
-    while(it != mapTxLockVotesOrphan.end()) {
-        if(ProcessTxLockVote(NULL, it->second)) {
-            mapTxLockVotesOrphan.erase(it++);
-        } else {
-            ++it;
+    BOOST_FOREACH(CTxLockVote& vote, vecVotes) {
+        ProcessTxLockVote(NULL, vote);
+    }
+}
+
+void CInstaPay::CheckMasternodeOrphanVotes()
+{
+    std::vector<COutPoint> vecOutpoints;
+    {
+        LOCK(cs_instapay);
+        vecOutpoints = txLockVotesOrphan.GetWaitedForMasternodes();
+    }
+
+    BOOST_FOREACH(const COutPoint& outpointMasternode, vecOutpoints) {
+        if(!mnodeman.Has(CTxIn(outpointMasternode))) continue;
+        std::vector<CTxLockVote> vecVotes;
+        {
+            LOCK(cs_instapay);
+            vecVotes = txLockVotesOrphan.PopVotesForMasternode(outpointMasternode);
+        }
+        BOOST_FOREACH(CTxLockVote& vote, vecVotes) {
+            LogPrint("instapay", "CInstaPay::CheckMasternodeOrphanVotes -- Reprocessing orphan vote: txid=%s  masternode=%s\n",
+                    vote.GetTxHash().ToString(), outpointMasternode.ToStringShort());
+            ProcessTxLockVote(NULL, vote);
         }
     }
 }
@@ -407,24 +629,20 @@ bool CInstaPay::IsEnoughOrphanVotesForTx(const CTxLockRequest& txLockRequest)
 
 bool CInstaPay::IsEnoughOrphanVotesForTxAndOutPoint(const uint256& txHash, const COutPoint& outpoint)
 {
-    // Scan orphan votes to check if this outpoint has enough orphan votes to be locked in some tx.
-    LOCK2(cs_main, cs_instapay);
-    int nCountVotes = 0;
-    std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin();
-    while(it != mapTxLockVotesOrphan.end()) {
-        if(it->second.GetTxHash() == txHash && it->second.GetOutpoint() == outpoint) {
-            nCountVotes++;
-            if(nCountVotes >= COutPointLock::SIGNATURES_REQUIRED) {
-                return true;
-            }
-        }
-        ++it;
-    }
-    return false;
+    // Count orphan votes to check if this outpoint has enough orphan votes to be locked in some tx.
+    LOCK(cs_instapay);
+    return txLockVotesOrphan.CountVotesForTxAndOutPoint(txHash, outpoint) >= COutPointLock::SIGNATURES_REQUIRED;
 }
 
-void CInstaPay::TryToFinalizeLockCandidate(const CTxLockCandidate& txLockCandidate)
+void CInstaPay::TryToFinalizeLockCandidate(const uint256& txHash)
 {
+    {
+        // most votes don't complete a lock, find that out without cs_main
+        LOCK(cs_instapay);
+        std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+        if(itLockCandidate == mapTxLockCandidates.end() || !itLockCandidate->second.IsAllOutPointsReady()) return;
+    }
+
     LOCK(cs_main);
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -432,13 +650,17 @@ void CInstaPay::TryToFinalizeLockCandidate(const CTxLockCandidate& txLockCandida
 #endif
     LOCK(cs_instapay);
 
-    uint256 txHash = txLockCandidate.txLockRequest.GetHash();
+    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    if(itLockCandidate == mapTxLockCandidates.end()) return;
+    const CTxLockCandidate& txLockCandidate = itLockCandidate->second;
+
     if(txLockCandidate.IsAllOutPointsReady() && !IsLockedInstaPayTransaction(txHash)) {
         // we have enough votes now
         LogPrint("instapay", "CInstaPay::TryToFinalizeLockCandidate -- Transaction Lock is ready to complete, txid=%s\n", txHash.ToString());
         if(ResolveConflicts(txLockCandidate, Params().GetConsensus().nInstaPayKeepLock)) {
             LockTransactionInputs(txLockCandidate);
             UpdateLockedTransaction(txLockCandidate);
+            lockLatencyStats.Add(GetTimeMicros() - txLockCandidate.GetTimeCreatedMicros());
         }
     }
 }
@@ -647,16 +869,11 @@ void CInstaPay::CheckAndRemove()
     }
 
     // remove expired orphan votes
-    std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(GetTime() - itOrphanVote->second.GetTimeCreated() > ORPHAN_VOTE_SECONDS) {
-            LogPrint("instapay", "CInstaPay::CheckAndRemove -- Removing expired orphan vote: txid=%s  masternode=%s\n",
-                    itOrphanVote->second.GetTxHash().ToString(), itOrphanVote->second.GetMasternodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itOrphanVote->first);
-            mapTxLockVotesOrphan.erase(itOrphanVote++);
-        } else {
-            ++itOrphanVote;
-        }
+    std::vector<CTxLockVote> vecExpiredOrphans = txLockVotesOrphan.RemoveExpired(GetTime() - ORPHAN_VOTE_SECONDS);
+    BOOST_FOREACH(const CTxLockVote& vote, vecExpiredOrphans) {
+        LogPrint("instapay", "CInstaPay::CheckAndRemove -- Removing expired orphan vote: txid=%s  masternode=%s\n",
+                vote.GetTxHash().ToString(), vote.GetMasternodeOutpoint().ToStringShort());
+        mapTxLockVotes.erase(vote.GetHash());
     }
 
     // remove expired masternode orphan votes (DOS protection)
@@ -811,23 +1028,23 @@ void CInstaPay::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 
     if (tx.IsCoinBase()) return;
 
-    LOCK2(cs_main, cs_instapay);
-
     uint256 txHash = tx.GetHash();
 
     // When tx is 0-confirmed or conflicted, pblock is NULL and nHeightNew should be set to -1
-    CBlockIndex* pblockindex = NULL;
+    int nHeightNew = -1;
     if(pblock) {
         uint256 blockHash = pblock->GetHash();
+        LOCK(cs_main);
         BlockMap::iterator mi = mapBlockIndex.find(blockHash);
         if(mi == mapBlockIndex.end() || !mi->second) {
             // shouldn't happen
             LogPrint("instapay", "CTxLockRequest::SyncTransaction -- Failed to find block %s\n", blockHash.ToString());
             return;
         }
-        pblockindex = mi->second;
+        nHeightNew = mi->second->nHeight;
     }
-    int nHeightNew = pblockindex ? pblockindex->nHeight : -1;
+
+    LOCK(cs_instapay);
 
     LogPrint("instapay", "CInstaPay::SyncTransaction -- txid=%s nHeightNew=%d\n", txHash.ToString(), nHeightNew);
 
@@ -859,17 +1076,19 @@ void CInstaPay::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 
     // check orphan votes
-    std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(itOrphanVote->second.GetTxHash() == txHash) {
-            LogPrint("instapay", "CInstaPay::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
-                    txHash.ToString(), nHeightNew, itOrphanVote->first.ToString());
-            mapTxLockVotes[itOrphanVote->first].SetConfirmedHeight(nHeightNew);
-        }
-        ++itOrphanVote;
+    BOOST_FOREACH(const uint256& nVoteHash, txLockVotesOrphan.GetVoteHashesForTx(txHash)) {
+        LogPrint("instapay", "CInstaPay::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
+                txHash.ToString(), nHeightNew, nVoteHash.ToString());
+        mapTxLockVotes[nVoteHash].SetConfirmedHeight(nHeightNew);
     }
 }
 
+CTxLockLatencyStats CInstaPay::GetLockLatencyStats()
+{
+    LOCK(cs_instapay);
+    return lockLatencyStats;
+}
+
 std::string CInstaPay::ToString()
 {
     LOCK(cs_instapay);
@@ -1055,10 +1274,15 @@ uint256 CTxLockVote::GetHash() const
     return ss.GetHash();
 }
 
+std::string CTxLockVote::GetSignatureMessage() const
+{
+    return txHash.ToString() + outpoint.ToStringShort();
+}
+
 bool CTxLockVote::CheckSignature() const
 {
     std::string strError;
-    std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
+    std::string strMessage = GetSignatureMessage();
 
     masternode_info_t infoMn = mnodeman.GetMasternodeInfo(CTxIn(outpointMasternode));
 
@@ -1067,7 +1291,7 @@ bool CTxLockVote::CheckSignature() const
         return false;
     }
 
-    if(!CMessageSigner::VerifyMessage(infoMn.pubKeyMasternode, vchMasternodeSignature, strMessage, strError)) {
+    if(!checkedSig.Verify(infoMn.pubKeyMasternode, vchMasternodeSignature, strMessage, strError)) {
         LogPrintf("CTxLockVote::CheckSignature -- VerifyMessage() failed, error: %s\n", strError);
         return false;
     }
@@ -5,9 +5,12 @@
 #ifndef INSTAPAY_H
 #define INSTAPAY_H
 
+#include "messagesigqueue.h"
 #include "net.h"
 #include "primitives/transaction.h"
 
+class CBlock;
+class CBlockIndex;
 class CTxLockVote;
 class COutPointLock;
 class CTxLockRequest;
@@ -34,6 +37,85 @@ extern bool fEnableInstaPay;
 extern int nInstaPayDepth;
 extern int nCompleteTXLocks;
 
+/**
+ * Distribution of the time it takes for an accepted lock request to get locked,
+ * bucketed by powers of two milliseconds. Guarded by CInstaPay::cs_instapay.
+ */
+class CTxLockLatencyStats
+{
+private:
+    std::vector<uint64_t> vBuckets;
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+
+public:
+    // bucket n counts latencies below 2^n ms, the last one counts everything slower
+    static const int BUCKETS = 17;
+
+    CTxLockLatencyStats() :
+        vBuckets(BUCKETS, 0),
+        nCount(0),
+        nTotalMicros(0),
+        nMaxMicros(0)
+        {}
+
+    void Add(int64_t nLatencyMicros);
+
+    uint64_t GetCount() const { return nCount; }
+    int64_t GetAverageMicros() const { return nCount ? nTotalMicros / nCount : 0; }
+    int64_t GetMaxMicros() const { return nMaxMicros; }
+    uint64_t GetBucketCount(int nBucket) const { return vBuckets[nBucket]; }
+    // upper bound of the bucket in ms, -1 for the last one
+    static int64_t GetBucketLimitMillis(int nBucket);
+    // upper bound of the bucket the given share of all latencies falls in, -1 if it's the last one,
+    // false if there are no latencies yet
+    bool GetPercentileMillis(double dPercentile, int64_t& nMillisRet) const;
+};
+
+/**
+ * Orphan transaction lock votes indexed by what they are waiting for:
+ * votes that passed validation wait for their lock request (by tx hash),
+ * votes from masternodes we don't know yet wait for the masternode
+ * announcement (by masternode outpoint). Not thread safe, guarded by
+ * CInstaPay::cs_instapay.
+ */
+class CTxLockVoteOrphans
+{
+private:
+    std::map<uint256, CTxLockVote> mapVotes; // vote hash - vote
+    std::map<uint256, std::set<uint256> > mapVotesByTx; // tx hash - vote hash set
+    std::map<COutPoint, std::set<uint256> > mapVotesByMasternode; // mn outpoint - vote hash set
+    size_t nVotesWaitingForMasternode;
+
+    std::vector<CTxLockVote> PopVotes(const std::set<uint256>& setVoteHashes);
+
+public:
+    // votes from unknown masternodes can't be validated, don't let them take unlimited memory
+    static const size_t MAX_VOTES_WAITING_FOR_MASTERNODE = 1000;
+
+    CTxLockVoteOrphans() : nVotesWaitingForMasternode(0) {}
+
+    bool Has(const uint256& nVoteHash) const { return mapVotes.count(nVoteHash); }
+    size_t size() const { return mapVotes.size(); }
+
+    bool AddWaitingForTx(const CTxLockVote& vote);
+    bool AddWaitingForMasternode(const CTxLockVote& vote);
+    void Erase(const uint256& nVoteHash);
+
+    // remove and return votes unblocked by a lock request / masternode announcement
+    std::vector<CTxLockVote> PopVotesForTx(const uint256& txHash);
+    std::vector<CTxLockVote> PopVotesForMasternode(const COutPoint& outpointMasternode);
+
+    bool HasVotesForTx(const uint256& txHash) const { return mapVotesByTx.count(txHash); }
+    std::vector<uint256> GetVoteHashesForTx(const uint256& txHash) const;
+    int CountVotesForTxAndOutPoint(const uint256& txHash, const COutPoint& outpoint) const;
+    std::vector<COutPoint> GetWaitedForMasternodes() const;
+
+    // remove votes created before nTimeCutoff
+    std::vector<CTxLockVote> RemoveExpired(int64_t nTimeCutoff);
+};
+
 class CInstaPay
 {
 private:
@@ -46,7 +128,9 @@ private:
     std::map<uint256, CTxLockRequest> mapLockRequestAccepted; // tx hash - tx
     std::map<uint256, CTxLockRequest> mapLockRequestRejected; // tx hash - tx
     std::map<uint256, CTxLockVote> mapTxLockVotes; // vote hash - vote
-    std::map<uint256, CTxLockVote> mapTxLockVotesOrphan; // vote hash - vote
+    CTxLockVoteOrphans txLockVotesOrphan;
+
+    CTxLockLatencyStats lockLatencyStats;
 
     std::map<uint256, CTxLockCandidate> mapTxLockCandidates; // tx hash - lock candidate
 
@@ -57,16 +141,18 @@ private:
     std::map<COutPoint, int64_t> mapMasternodeOrphanVotes; // mn outpoint - time
 
     bool CreateTxLockCandidate(const CTxLockRequest& txLockRequest);
-    void Vote(CTxLockCandidate& txLockCandidate);
+    void Vote(const uint256& txHash);
 
     //process consensus vote message
     bool ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote);
-    void ProcessOrphanTxLockVotes();
+    /// Continue processing a vote from pfrom once its signature was checked on the signature queue
+    void TxLockVoteSignatureChecked(CNode* pfrom, CTxLockVote vote, const std::vector<CMessageSigCheck>& vChecks);
+    void ProcessOrphanTxLockVotes(const uint256& txHash);
     bool IsEnoughOrphanVotesForTx(const CTxLockRequest& txLockRequest);
     bool IsEnoughOrphanVotesForTxAndOutPoint(const uint256& txHash, const COutPoint& outpoint);
     int64_t GetAverageMasternodeOrphanVoteTime();
 
-    void TryToFinalizeLockCandidate(const CTxLockCandidate& txLockCandidate);
+    void TryToFinalizeLockCandidate(const uint256& txHash);
     void LockTransactionInputs(const CTxLockCandidate& txLockCandidate);
     //update UI and notify external script if any
     void UpdateLockedTransaction(const CTxLockCandidate& txLockCandidate);
@@ -97,6 +183,9 @@ public:
     // get the actual uber og accepted lock signatures
     int GetTransactionLockSignatures(const uint256& txHash);
 
+    // reprocess orphan votes from masternodes which were added to the list
+    void CheckMasternodeOrphanVotes();
+
     // remove expired entries from maps
     void CheckAndRemove();
     // verify if transaction lock timed out
@@ -107,6 +196,8 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindex);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
 
+    CTxLockLatencyStats GetLockLatencyStats();
+
     std::string ToString();
 };
 
@@ -148,13 +239,17 @@ private:
     int64_t nTimeCreated;
 
 public:
+    // result of an earlier check on the signature queue, not serialized
+    CCheckedSignature checkedSig;
+
     CTxLockVote() :
         txHash(),
         outpoint(),
         outpointMasternode(),
         vchMasternodeSignature(),
         nConfirmedHeight(-1),
-        nTimeCreated(GetTime())
+        nTimeCreated(GetTime()),
+        checkedSig()
         {}
 
     CTxLockVote(const uint256& txHashIn, const COutPoint& outpointIn, const COutPoint& outpointMasternodeIn) :
@@ -163,7 +258,8 @@ public:
         outpointMasternode(outpointMasternodeIn),
         vchMasternodeSignature(),
         nConfirmedHeight(-1),
-        nTimeCreated(GetTime())
+        nTimeCreated(GetTime()),
+        checkedSig()
         {}
 
     ADD_SERIALIZE_METHODS;
@@ -181,6 +277,7 @@ public:
     uint256 GetTxHash() const { return txHash; }
     COutPoint GetOutpoint() const { return outpoint; }
     COutPoint GetMasternodeOutpoint() const { return outpointMasternode; }
+    const std::vector<unsigned char>& GetSignature() const { return vchMasternodeSignature; }
     int64_t GetTimeCreated() const { return nTimeCreated; }
 
     bool IsValid(CNode* pnode) const;
@@ -188,6 +285,7 @@ public:
     bool IsExpired(int nHeight) const;
 
     bool Sign();
+    std::string GetSignatureMessage() const;
     bool CheckSignature() const;
 
     void Relay() const;
@@ -223,10 +321,12 @@ class CTxLockCandidate
 {
 private:
     int nConfirmedHeight; // when corresponding tx is 0-confirmed or conflicted, nConfirmedHeight is -1
+    int64_t nTimeCreatedMicros;
 
 public:
     CTxLockCandidate(const CTxLockRequest& txLockRequestIn) :
         nConfirmedHeight(-1),
+        nTimeCreatedMicros(GetTimeMicros()),
         txLockRequest(txLockRequestIn),
         mapOutPointLocks()
         {}
@@ -235,6 +335,7 @@ public:
     std::map<COutPoint, COutPointLock> mapOutPointLocks;
 
     uint256 GetHash() const { return txLockRequest.GetHash(); }
+    int64_t GetTimeCreatedMicros() const { return nTimeCreatedMicros; }
 
     void AddOutPointLock(const COutPoint& outpoint);
     bool AddVote(const CTxLockVote& vote);
@@ -17,6 +17,8 @@
 
 /** Object for who's going to get paid on which blocks */
 CMasternodePayments mnpayments;
+/** Who actually got paid in which blocks */
+CMasternodePaymentIndex mnpaymentindex;
 
 CCriticalSection cs_vecPayees;
 CCriticalSection cs_mapMasternodeBlocks;
@@ -384,36 +386,60 @@ void CMasternodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand,
             return;
         }
 
-        int nDos = 0;
-        if(!vote.CheckSignature(mnInfo.pubKeyMasternode, pCurrentBlockIndex->nHeight, nDos)) {
-            if(nDos) {
-                LogPrintf("MASTERNODEPAYMENTVOTE -- ERROR: invalid signature\n");
-                Misbehaving(pfrom->GetId(), nDos);
-            } else {
-                // only warn about anything non-critical (i.e. nDos == 0) in debug mode
-                LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- WARNING: invalid signature\n");
+        // verify the signature off this thread, PaymentVoteSignatureChecked() takes it from there,
+        // with the height the vote was checked against so far rather than whatever the tip is by then
+        std::vector<CMessageSigCheck> vChecks(1, CMessageSigCheck(mnInfo.pubKeyMasternode, vote.vchSig, vote.GetSignatureMessage()));
+        pfrom->AddRef();
+        if(!messageSigQueue.Add(vChecks, std::bind(&CMasternodePayments::PaymentVoteSignatureChecked, this, pfrom, vote, mnInfo.pubKeyMasternode, pCurrentBlockIndex->nHeight, std::placeholders::_1))) {
+            LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- signature queue is full, dropping vote: hash=%s\n", nHash.ToString());
+            // forget the vote so that it can be accepted once it's announced again
+            {
+                LOCK(cs_mapMasternodePaymentVotes);
+                mapMasternodePaymentVotes.erase(nHash);
             }
-            // Either our info or vote info could be outdated.
-            // In case our info is outdated, ask for an update,
-            mnodeman.AskForMN(pfrom, vote.vinMasternode);
-            // but there is nothing we can do if vote info itself is outdated
-            // (i.e. it was signed by a mn which changed its key),
-            // so just quit here.
-            return;
+            pfrom->Release();
         }
+    }
+}
 
-        CTxDestination address1;
-        ExtractDestination(vote.payee, address1);
-        CBitcoinAddress address2(address1);
+void CMasternodePayments::PaymentVoteSignatureChecked(CNode* pfrom, CMasternodePaymentVote vote, const CPubKey& pubKeyMasternode, int nCachedBlockHeight, const std::vector<CMessageSigCheck>& vChecks)
+{
+    vote.checkedSig.Set(vChecks[0]);
 
-        LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- vote: address=%s, nBlockHeight=%d, nHeight=%d, prevout=%s, hash=%s new\n",
-                    address2.ToString(), vote.nBlockHeight, pCurrentBlockIndex->nHeight, vote.vinMasternode.prevout.ToStringShort(), nHash.ToString());
+    uint256 nHash = vote.GetHash();
 
-        if(AddPaymentVote(vote)){
-            vote.Relay();
-            masternodeSync.BumpAssetLastTime("MASTERNODEPAYMENTVOTE");
+    int nDos = 0;
+    if(!vote.CheckSignature(pubKeyMasternode, nCachedBlockHeight, nDos)) {
+        if(nDos) {
+            LogPrintf("MASTERNODEPAYMENTVOTE -- ERROR: invalid signature\n");
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDos);
+        } else {
+            // only warn about anything non-critical (i.e. nDos == 0) in debug mode
+            LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- WARNING: invalid signature\n");
         }
+        // Either our info or vote info could be outdated.
+        // In case our info is outdated, ask for an update,
+        mnodeman.AskForMN(pfrom, vote.vinMasternode);
+        // but there is nothing we can do if vote info itself is outdated
+        // (i.e. it was signed by a mn which changed its key),
+        // so just quit here.
+        pfrom->Release();
+        return;
+    }
+
+    CTxDestination address1;
+    ExtractDestination(vote.payee, address1);
+    CBitcoinAddress address2(address1);
+
+    LogPrint("mnpayments", "MASTERNODEPAYMENTVOTE -- vote: address=%s, nBlockHeight=%d, nHeight=%d, prevout=%s, hash=%s new\n",
+                address2.ToString(), vote.nBlockHeight, nCachedBlockHeight, vote.vinMasternode.prevout.ToStringShort(), nHash.ToString());
+
+    if(AddPaymentVote(vote)){
+        vote.Relay();
+        masternodeSync.BumpAssetLastTime("MASTERNODEPAYMENTVOTE");
     }
+    pfrom->Release();
 }
 
 bool CMasternodePaymentVote::Sign()
@@ -467,6 +493,24 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
     return false;
 }
 
+std::vector<CScript> CMasternodePayments::GetScheduledPayees(int nNotBlockHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::vector<CScript> vecPayees;
+    if(!pCurrentBlockIndex) return vecPayees;
+
+    CScript payee;
+    for(int64_t h = pCurrentBlockIndex->nHeight; h <= pCurrentBlockIndex->nHeight + 8; h++){
+        if(h == nNotBlockHeight) continue;
+        if(mapMasternodeBlocks.count(h) && mapMasternodeBlocks[h].GetBestPayee(payee)) {
+            vecPayees.push_back(payee);
+        }
+    }
+
+    return vecPayees;
+}
+
 bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
 {
     uint256 blockHash = uint256();
@@ -785,17 +829,22 @@ void CMasternodePaymentVote::Relay()
     g_connman->RelayInv(inv);
 }
 
+std::string CMasternodePaymentVote::GetSignatureMessage() const
+{
+    return vinMasternode.prevout.ToStringShort() +
+                boost::lexical_cast<std::string>(nBlockHeight) +
+                ScriptToAsmStr(payee);
+}
+
 bool CMasternodePaymentVote::CheckSignature(const CPubKey& pubKeyMasternode, int nValidationHeight, int &nDos)
 {
     // do not ban by default
     nDos = 0;
 
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                boost::lexical_cast<std::string>(nBlockHeight) +
-                ScriptToAsmStr(payee);
+    std::string strMessage = GetSignatureMessage();
 
     std::string strError = "";
-    if (!CMessageSigner::VerifyMessage(pubKeyMasternode, vchSig, strMessage, strError)) {
+    if (!checkedSig.Verify(pubKeyMasternode, vchSig, strMessage, strError)) {
         // Only ban for future block vote when we are already synced.
         // Otherwise it could be the case when MN which signed this vote is using another key now
         // and we have no idea about the old one.
@@ -955,3 +1004,145 @@ void CMasternodePayments::UpdatedBlockTip(const CBlockIndex *pindex)
 
     ProcessBlock(pindex->nHeight + 10);
 }
+
+std::vector<CScript> CMasternodePaymentIndex::GetBlockPayees(const CBlock& block, int nHeight)
+{
+    std::vector<CScript> vecPayees;
+    if(block.vtx.empty()) return vecPayees;
+
+    CAmount nMasternodePayment = GetMasternodePayment(nHeight, block.vtx[0].GetValueOut());
+
+    BOOST_FOREACH(const CTxOut& txout, block.vtx[0].vout) {
+        if(txout.nValue == nMasternodePayment) {
+            vecPayees.push_back(txout.scriptPubKey);
+        }
+    }
+    return vecPayees;
+}
+
+void CMasternodePaymentIndex::AddBlock(int nHeight, int64_t nTime, const std::vector<CScript>& vecPayees)
+{
+    RemoveBlock(nHeight);
+    BOOST_FOREACH(const CScript& payee, vecPayees) {
+        mapPayments[payee][nHeight] = nTime;
+    }
+    mapPayeesByHeight[nHeight] = vecPayees;
+}
+
+void CMasternodePaymentIndex::RemoveBlock(int nHeight)
+{
+    std::map<int, std::vector<CScript> >::iterator it = mapPayeesByHeight.find(nHeight);
+    if(it == mapPayeesByHeight.end()) return;
+
+    BOOST_FOREACH(const CScript& payee, it->second) {
+        std::map<CScript, std::map<int, int64_t> >::iterator itPayee = mapPayments.find(payee);
+        if(itPayee == mapPayments.end()) continue;
+        itPayee->second.erase(nHeight);
+        if(itPayee->second.empty()) mapPayments.erase(itPayee);
+    }
+    mapPayeesByHeight.erase(it);
+}
+
+void CMasternodePaymentIndex::BlockConnected(const CBlock& block, const CBlockIndex* pindex)
+{
+    std::vector<CScript> vecPayees = GetBlockPayees(block, pindex->nHeight);
+    int nLimit = mnpayments.GetStorageLimit();
+
+    LOCK(cs);
+
+    AddBlock(pindex->nHeight, pindex->GetBlockTime(), vecPayees);
+    if(nHeightIndexedFrom == -1 || nHeightIndexedFrom > pindex->nHeight) {
+        nHeightIndexedFrom = pindex->nHeight;
+    }
+
+    // forget blocks that fell out of the payment votes storage window
+    int nHeightKeepFrom = pindex->nHeight - nLimit + 1;
+    while(!mapPayeesByHeight.empty() && mapPayeesByHeight.begin()->first < nHeightKeepFrom) {
+        RemoveBlock(mapPayeesByHeight.begin()->first);
+    }
+    nHeightIndexedFrom = std::max(nHeightIndexedFrom, nHeightKeepFrom);
+}
+
+void CMasternodePaymentIndex::BlockDisconnected(const CBlock& block, const CBlockIndex* pindex)
+{
+    LOCK(cs);
+
+    RemoveBlock(pindex->nHeight);
+    if(nHeightIndexedFrom >= pindex->nHeight) {
+        nHeightIndexedFrom = -1;
+    }
+}
+
+void CMasternodePaymentIndex::Backfill(const CBlockIndex* pindexTip, int nBlocks)
+{
+    if(!pindexTip || nBlocks <= 0) return;
+
+    int nHeightFirst = std::max(0, pindexTip->nHeight - nBlocks + 1);
+    int nHeightLast;
+    int nHeightIndexedFromOld;
+    {
+        LOCK(cs);
+        if(nHeightIndexedFrom != -1 && nHeightIndexedFrom <= nHeightFirst) return;
+        nHeightLast = nHeightIndexedFrom == -1 ? pindexTip->nHeight : nHeightIndexedFrom - 1;
+        nHeightIndexedFromOld = nHeightIndexedFrom;
+    }
+    if(nHeightLast < nHeightFirst) return;
+
+    // Only the block positions are taken under cs_main, the blocks are read without it
+    std::vector<std::pair<const CBlockIndex*, CDiskBlockPos> > vecPositions;
+    {
+        LOCK(cs_main);
+        for(const CBlockIndex* pindex = pindexTip->GetAncestor(nHeightLast); pindex && pindex->nHeight >= nHeightFirst; pindex = pindex->pprev) {
+            if(!(pindex->nStatus & BLOCK_HAVE_DATA)) break;
+            vecPositions.push_back(std::make_pair(pindex, pindex->GetBlockPos()));
+        }
+    }
+
+    LogPrint("mnpayments", "CMasternodePaymentIndex::Backfill -- indexing blocks %d-%d\n", nHeightFirst, nHeightLast);
+
+    std::vector<std::pair<const CBlockIndex*, std::vector<CScript> > > vecBlocks;
+    for(size_t i = 0; i < vecPositions.size(); i++) {
+        const CBlockIndex* pindex = vecPositions[i].first;
+        CBlock block;
+        if(!ReadBlockFromDisk(block, vecPositions[i].second, Params().GetConsensus()) || block.GetHash() != pindex->GetBlockHash()) {
+            // pruned or unreadable, index what we have up to here
+            LogPrintf("CMasternodePaymentIndex::Backfill -- can't read block %d, stopping\n", pindex->nHeight);
+            break;
+        }
+        vecBlocks.push_back(std::make_pair(pindex, GetBlockPayees(block, pindex->nHeight)));
+    }
+    if(vecBlocks.empty()) return;
+
+    LOCK2(cs_main, cs);
+    // The chain moved in a way that leaves a gap while these were being read, the next call starts over
+    if(!chainActive.Contains(vecBlocks.front().first)) return;
+    if(nHeightIndexedFrom == -1 ? nHeightIndexedFromOld != -1 : nHeightIndexedFrom != nHeightLast + 1) return;
+    for(size_t i = 0; i < vecBlocks.size(); i++) {
+        AddBlock(vecBlocks[i].first->nHeight, vecBlocks[i].first->GetBlockTime(), vecBlocks[i].second);
+    }
+    nHeightIndexedFrom = vecBlocks.back().first->nHeight;
+}
+
+std::vector<std::pair<int, int64_t> > CMasternodePaymentIndex::GetPayments(const CScript& payee, int nHeightMin, int nHeightMax) const
+{
+    std::vector<std::pair<int, int64_t> > vecPayments;
+
+    LOCK(cs);
+
+    std::map<CScript, std::map<int, int64_t> >::const_iterator itPayee = mapPayments.find(payee);
+    if(itPayee == mapPayments.end()) return vecPayments;
+
+    std::map<int, int64_t>::const_reverse_iterator it(itPayee->second.upper_bound(nHeightMax));
+    for(; it != itPayee->second.rend() && it->first > nHeightMin; ++it) {
+        vecPayments.push_back(*it);
+    }
+    return vecPayments;
+}
+
+void CMasternodePaymentIndex::Clear()
+{
+    LOCK(cs);
+    mapPayments.clear();
+    mapPayeesByHeight.clear();
+    nHeightIndexedFrom = -1;
+}
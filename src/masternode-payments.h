@@ -14,6 +14,7 @@
 #include "utilstrencodings.h"
 
 class CMasternodePayments;
+class CMasternodePaymentIndex;
 class CMasternodePaymentVote;
 class CMasternodeBlockPayees;
 
@@ -32,6 +33,7 @@ extern CCriticalSection cs_mapMasternodeBlocks;
 extern CCriticalSection cs_mapMasternodePayeeVotes;
 
 extern CMasternodePayments mnpayments;
+extern CMasternodePaymentIndex mnpaymentindex;
 
 /// TODO: all 4 functions do not belong here really, they should be refactored/moved somewhere (main.cpp ?)
 bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockReward, std::string &strErrorRet);
@@ -115,19 +117,23 @@ public:
     int nBlockHeight;
     CScript payee;
     std::vector<unsigned char> vchSig;
+    // result of an earlier check on the signature queue, not serialized
+    CCheckedSignature checkedSig;
 
     CMasternodePaymentVote() :
         vinMasternode(),
         nBlockHeight(0),
         payee(),
-        vchSig()
+        vchSig(),
+        checkedSig()
         {}
 
     CMasternodePaymentVote(CTxIn vinMasternode, int nBlockHeight, CScript payee) :
         vinMasternode(vinMasternode),
         nBlockHeight(nBlockHeight),
         payee(payee),
-        vchSig()
+        vchSig(),
+        checkedSig()
         {}
 
     ADD_SERIALIZE_METHODS;
@@ -148,6 +154,7 @@ public:
         return ss.GetHash();
     }
 
+    std::string GetSignatureMessage() const;
     bool Sign();
     bool CheckSignature(const CPubKey& pubKeyMasternode, int nValidationHeight, int &nDos);
 
@@ -204,11 +211,15 @@ public:
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
+    /// Best payees of the blocks IsScheduled() looks at
+    std::vector<CScript> GetScheduledPayees(int nNotBlockHeight);
 
     bool CanVote(COutPoint outMasternode, int nBlockHeight);
 
     int GetMinMasternodePaymentsProto();
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Finish processing a payment vote from pfrom received at nCachedBlockHeight once its signature was checked on the signature queue
+    void PaymentVoteSignatureChecked(CNode* pfrom, CMasternodePaymentVote vote, const CPubKey& pubKeyMasternode, int nCachedBlockHeight, const std::vector<CMessageSigCheck>& vChecks);
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, int nBlockHeight, CAmount blockReward, CTxOut& txoutMasternodeRet);
     std::string ToString() const;
@@ -222,4 +233,45 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindex);
 };
 
+/**
+ * Masternode payments made by the coinbases of the active chain, by payee.
+ *
+ * Maintained from ConnectTip/DisconnectTip so that last paid blocks can be
+ * looked up instead of re-reading candidate blocks from disk for every
+ * masternode. Only the last GetStorageLimit() blocks are kept, the same
+ * window the payment votes are stored for.
+ */
+class CMasternodePaymentIndex
+{
+private:
+    mutable CCriticalSection cs;
+
+    // payee -> (height -> block time) of the blocks paying it
+    std::map<CScript, std::map<int, int64_t> > mapPayments;
+    // height -> payees paid by that block
+    std::map<int, std::vector<CScript> > mapPayeesByHeight;
+    // all blocks from this height up to the tip are indexed, -1 if none
+    int nHeightIndexedFrom;
+
+    void AddBlock(int nHeight, int64_t nTime, const std::vector<CScript>& vecPayees);
+    void RemoveBlock(int nHeight);
+
+public:
+    CMasternodePaymentIndex() : nHeightIndexedFrom(-1) {}
+
+    /// Return the masternode payees paid by a block's coinbase
+    static std::vector<CScript> GetBlockPayees(const CBlock& block, int nHeight);
+
+    void BlockConnected(const CBlock& block, const CBlockIndex* pindex);
+    void BlockDisconnected(const CBlock& block, const CBlockIndex* pindex);
+
+    /// Make sure the last nBlocks blocks up to pindexTip are indexed, reading missing ones from disk
+    void Backfill(const CBlockIndex* pindexTip, int nBlocks);
+
+    /// Return the (height, time) of the payments to payee in (nHeightMin, nHeightMax], most recent first
+    std::vector<std::pair<int, int64_t> > GetPayments(const CScript& payee, int nHeightMin, int nHeightMax) const;
+
+    void Clear();
+};
+
 #endif
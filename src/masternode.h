@@ -7,6 +7,7 @@
 #define MASTERNODE_H
 
 #include "key.h"
+#include "messagesigqueue.h"
 #include "validation.h"
 #include "spork.h"
 
@@ -39,6 +40,8 @@ public:
     bool fSentinelIsCurrent = false; // true if last sentinel ping was actual
     // MSB is always 0, other 3 bits corresponds to x.x.x version scheme
     uint32_t nSentinelVersion{DEFAULT_SENTINEL_VERSION};
+    // result of an earlier check on the signature queue, not serialized
+    CCheckedSignature checkedSig{};
 
     CMasternodePing() = default;
 
@@ -72,6 +75,7 @@ public:
 
     bool IsExpired() const { return GetTime() - sigTime > MASTERNODE_NEW_START_REQUIRED_SECONDS; }
 
+    std::string GetSignatureMessage() const;
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool CheckSignature(CPubKey& pubKeyMasternode, int &nDos);
     bool SimpleCheck(int& nDos);
@@ -200,6 +204,9 @@ public:
 
     // CALCULATE A RANK AGAINST OF GIVEN BLOCK
     arith_uint256 CalculateScore(const uint256& blockHash);
+    // same as above, with the block part of the score (see GetBlockScoreHash) computed once for all masternodes
+    arith_uint256 CalculateScore(const uint256& blockHash, const arith_uint256& hashBlockScore);
+    static arith_uint256 GetBlockScoreHash(const uint256& blockHash);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -268,8 +275,8 @@ public:
 
     int GetCollateralAge();
 
-    int GetLastPaidTime() { return nTimeLastPaid; }
-    int GetLastPaidBlock() { return nBlockLastPaid; }
+    int GetLastPaidTime() const { return nTimeLastPaid; }
+    int GetLastPaidBlock() const { return nBlockLastPaid; }
     void UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack);
 
     // KEEP TRACK OF EACH GOVERNANCE ITEM INCASE THIS NODE GOES OFFLINE, SO WE CAN RECALC THEIR STATUS
@@ -316,11 +323,13 @@ class CMasternodeBroadcast : public CMasternode
 public:
 
     bool fRecovery;
+    // result of an earlier check on the signature queue, not serialized
+    CCheckedSignature checkedSig;
 
-    CMasternodeBroadcast() : CMasternode(), fRecovery(false) {}
-    CMasternodeBroadcast(const CMasternode& mn) : CMasternode(mn), fRecovery(false) {}
+    CMasternodeBroadcast() : CMasternode(), fRecovery(false), checkedSig() {}
+    CMasternodeBroadcast(const CMasternode& mn) : CMasternode(mn), fRecovery(false), checkedSig() {}
     CMasternodeBroadcast(CService addrNew, CTxIn vinNew, CPubKey pubKeyCollateralAddressNew, CPubKey pubKeyMasternodeNew, int nProtocolVersionIn) :
-        CMasternode(addrNew, vinNew, pubKeyCollateralAddressNew, pubKeyMasternodeNew, nProtocolVersionIn), fRecovery(false) {}
+        CMasternode(addrNew, vinNew, pubKeyCollateralAddressNew, pubKeyMasternodeNew, nProtocolVersionIn), fRecovery(false), checkedSig() {}
 
     ADD_SERIALIZE_METHODS;
 
@@ -353,6 +362,7 @@ public:
     bool Update(CMasternode* pmn, int& nDos);
     bool CheckOutpoint(int& nDos);
 
+    std::string GetSignatureMessage() const;
     bool Sign(CKey& keyCollateralAddress);
     bool CheckSignature(int& nDos);
     void Relay();
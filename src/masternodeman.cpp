@@ -6,12 +6,15 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "governance.h"
+#include "instapay.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
 #include "messagesigner.h"
 #include "netfulfilledman.h"
 #include "privatepay-client.h"
+#include "random.h"
+#include "script/standard.h"
 #include "util.h"
 
 /** Masternode manager */
@@ -19,15 +22,6 @@ CMasternodeMan mnodeman;
 
 const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-5";
 
-struct CompareLastPaidBlock
-{
-    bool operator()(const std::pair<int, CMasternode*>& t1,
-                    const std::pair<int, CMasternode*>& t2) const
-    {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
-    }
-};
-
 struct CompareScoreMN
 {
     bool operator()(const std::pair<int64_t, CMasternode*>& t1,
@@ -98,9 +92,77 @@ void CMasternodeIndex::RebuildIndex()
     }
 }
 
+CMasternodeKeyHasher::CMasternodeKeyHasher()
+{
+    GetRandBytes((unsigned char*)&k0, sizeof(k0));
+    GetRandBytes((unsigned char*)&k1, sizeof(k1));
+}
+
+size_t CMasternodeKeyHasher::operator()(const COutPoint& outpoint) const
+{
+    return CSipHasher(k0, k1).Write(outpoint.hash.begin(), outpoint.hash.size()).Write((const unsigned char*)&outpoint.n, sizeof(outpoint.n)).Finalize();
+}
+
+size_t CMasternodeKeyHasher::operator()(const CScript& script) const
+{
+    return CSipHasher(k0, k1).Write(&script[0], script.size()).Finalize();
+}
+
+size_t CMasternodeKeyHasher::operator()(const CPubKey& pubkey) const
+{
+    return CSipHasher(k0, k1).Write(pubkey.begin(), pubkey.size()).Finalize();
+}
+
+int CMasternodeRankCache::ranking_t::GetRank(const COutPoint& outpoint) const
+{
+    boost::unordered_map<COutPoint, int, CMasternodeKeyHasher>::const_iterator it = mapRanks.find(outpoint);
+    return it == mapRanks.end() ? -1 : it->second;
+}
+
+CMasternode* CMasternodeRankCache::ranking_t::GetByRank(int nRank) const
+{
+    if(nRank < 1 || nRank > (int)vecRanked.size()) return NULL;
+    return vecRanked[nRank - 1];
+}
+
+const CMasternodeRankCache::ranking_t* CMasternodeRankCache::Get(const uint256& blockHash, int nMinProtocol, filter_t filter, int64_t nNow)
+{
+    std::map<key_t, ranking_t>::iterator it = mapRankings.find(std::make_pair(blockHash, std::make_pair(nMinProtocol, (int)filter)));
+    if(it == mapRankings.end()) {
+        nMisses++;
+        return NULL;
+    }
+    if(nNow - it->second.nTimeCreated > MASTERNODE_CHECK_SECONDS) {
+        mapRankings.erase(it);
+        nMisses++;
+        return NULL;
+    }
+    nHits++;
+    return &it->second;
+}
+
+const CMasternodeRankCache::ranking_t& CMasternodeRankCache::Insert(const uint256& blockHash, int nMinProtocol, filter_t filter, ranking_t& ranking)
+{
+    if(mapRankings.size() >= MAX_CACHED_RANKINGS) {
+        std::map<key_t, ranking_t>::iterator itOldest = mapRankings.begin();
+        for(std::map<key_t, ranking_t>::iterator it = mapRankings.begin(); it != mapRankings.end(); ++it) {
+            if(it->second.nTimeCreated < itOldest->second.nTimeCreated) itOldest = it;
+        }
+        mapRankings.erase(itOldest);
+    }
+    ranking_t& rankingStored = mapRankings[std::make_pair(blockHash, std::make_pair(nMinProtocol, (int)filter))];
+    rankingStored.nTimeCreated = ranking.nTimeCreated;
+    rankingStored.vecRanked.swap(ranking.vecRanked);
+    rankingStored.mapRanks.swap(ranking.mapRanks);
+    return rankingStored;
+}
+
 CMasternodeMan::CMasternodeMan()
 : cs(),
-  vMasternodes(),
+  mapMasternodes(),
+  mapMasternodesByOutpoint(),
+  mapMasternodesByPayee(),
+  mapMasternodesByPubKey(),
   mAskedUsForMasternodeList(),
   mWeAskedForMasternodeList(),
   mWeAskedForMasternodeListEntry(),
@@ -116,6 +178,9 @@ CMasternodeMan::CMasternodeMan()
   fMasternodesRemoved(false),
   vecDirtyGovernanceObjectHashes(),
   nLastWatchdogVoteTime(0),
+  rankCache(),
+  nListVersion(0),
+  listSnapshot(),
   mapSeenMasternodeBroadcast(),
   mapSeenMasternodePing(),
   nDsqCount(0)
@@ -128,7 +193,8 @@ bool CMasternodeMan::Add(CMasternode &mn)
     CMasternode *pmn = Find(mn.vin);
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
-        vMasternodes.push_back(mn);
+        CMasternode& mnNew = mapMasternodes.insert(std::make_pair(mn.vin.prevout, mn)).first->second;
+        AddToIndexes(mnNew);
         indexMasternodes.AddMasternodeVIN(mn.vin);
         fMasternodesAdded = true;
         return true;
@@ -172,7 +238,11 @@ void CMasternodeMan::Check()
 
     LogPrint("masternode", "CMasternodeMan::Check -- nLastWatchdogVoteTime=%d, IsWatchdogActive()=%d\n", nLastWatchdogVoteTime, IsWatchdogActive());
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    // states are about to be re-evaluated
+    ListChanged();
+
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         mn.Check();
     }
 }
@@ -191,30 +261,31 @@ void CMasternodeMan::CheckAndRemove()
         Check();
 
         // Remove spent masternodes, prepare structures and make requests to reasure the state of inactive ones
-        std::vector<CMasternode>::iterator it = vMasternodes.begin();
+        std::map<COutPoint, CMasternode>::iterator it = mapMasternodes.begin();
         std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
         // ask for up to MNB_RECOVERY_MAX_ASK_ENTRIES masternode entries at a time
         int nAskForMnbRecovery = MNB_RECOVERY_MAX_ASK_ENTRIES;
-        while(it != vMasternodes.end()) {
-            CMasternodeBroadcast mnb = CMasternodeBroadcast(*it);
+        while(it != mapMasternodes.end()) {
+            CMasternodeBroadcast mnb = CMasternodeBroadcast(it->second);
             uint256 hash = mnb.GetHash();
             // If collateral was spent ...
-            if ((*it).IsOutpointSpent()) {
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing Masternode: %s  addr=%s  %i now\n", (*it).GetStateString(), (*it).addr.ToString(), size() - 1);
+            if (it->second.IsOutpointSpent()) {
+                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing Masternode: %s  addr=%s  %i now\n", it->second.GetStateString(), it->second.addr.ToString(), size() - 1);
 
                 // erase all of the broadcasts we've seen from this txin, ...
                 mapSeenMasternodeBroadcast.erase(hash);
-                mWeAskedForMasternodeListEntry.erase((*it).vin.prevout);
+                mWeAskedForMasternodeListEntry.erase(it->first);
 
                 // and finally remove it from the list
-                it->FlagGovernanceItemsAsDirty();
-                it = vMasternodes.erase(it);
+                it->second.FlagGovernanceItemsAsDirty();
+                RemoveFromIndexes(it->second);
+                mapMasternodes.erase(it++);
                 fMasternodesRemoved = true;
             } else {
                 bool fAsk = pCurrentBlockIndex &&
                             (nAskForMnbRecovery > 0) &&
                             masternodeSync.IsSynced() &&
-                            it->IsNewStartRequired() &&
+                            it->second.IsNewStartRequired() &&
                             !IsMnbRecoveryRequested(hash);
                 if(fAsk) {
                     // this mn is in a non-recoverable state and we haven't asked other nodes yet
@@ -228,7 +299,7 @@ void CMasternodeMan::CheckAndRemove()
                     // ask first MNB_RECOVERY_QUORUM_TOTAL masternodes we can connect to and we haven't asked recently
                     for(int i = 0; setRequested.size() < MNB_RECOVERY_QUORUM_TOTAL && i < (int)vecMasternodeRanks.size(); i++) {
                         // avoid banning
-                        if(mWeAskedForMasternodeListEntry.count(it->vin.prevout) && mWeAskedForMasternodeListEntry[it->vin.prevout].count(vecMasternodeRanks[i].second.addr)) continue;
+                        if(mWeAskedForMasternodeListEntry.count(it->first) && mWeAskedForMasternodeListEntry[it->first].count(vecMasternodeRanks[i].second.addr)) continue;
                         // didn't ask recently, ok to ask now
                         CService addr = vecMasternodeRanks[i].second.addr;
                         setRequested.insert(addr);
@@ -236,7 +307,7 @@ void CMasternodeMan::CheckAndRemove()
                         fAskedForMnbRecovery = true;
                     }
                     if(fAskedForMnbRecovery) {
-                        LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Recovery initiated, masternode=%s\n", it->vin.prevout.ToStringShort());
+                        LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Recovery initiated, masternode=%s\n", it->first.ToStringShort());
                         nAskForMnbRecovery--;
                     }
                     // wait for mnb recovery replies for MNB_RECOVERY_WAIT_SECONDS seconds
@@ -368,7 +439,12 @@ void CMasternodeMan::CheckAndRemove()
 void CMasternodeMan::Clear()
 {
     LOCK(cs);
-    vMasternodes.clear();
+    mapMasternodes.clear();
+    mapMasternodesByOutpoint.clear();
+    mapMasternodesByPayee.clear();
+    mapMasternodesByPubKey.clear();
+    setMasternodesByLastPaid.clear();
+    ListChanged();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -386,7 +462,8 @@ int CMasternodeMan::CountMasternodes(int nProtocolVersion)
     int nCount = 0;
     nProtocolVersion = nProtocolVersion == -1 ? mnpayments.GetMinMasternodePaymentsProto() : nProtocolVersion;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         if(mn.nProtocolVersion < nProtocolVersion) continue;
         nCount++;
     }
@@ -400,7 +477,8 @@ int CMasternodeMan::CountEnabled(int nProtocolVersion)
     int nCount = 0;
     nProtocolVersion = nProtocolVersion == -1 ? mnpayments.GetMinMasternodePaymentsProto() : nProtocolVersion;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         if(mn.nProtocolVersion < nProtocolVersion || !mn.IsEnabled()) continue;
         nCount++;
     }
@@ -414,10 +492,10 @@ int CMasternodeMan::CountByIP(int nNetworkType)
     LOCK(cs);
     int nNodeCount = 0;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-        if ((nNetworkType == NET_IPV4 && mn.addr.IsIPv4()) ||
-            (nNetworkType == NET_TOR  && mn.addr.IsTor())  ||
-            (nNetworkType == NET_IPV6 && mn.addr.IsIPv6())) {
+    for (auto& mnpair : mapMasternodes)
+        if ((nNetworkType == NET_IPV4 && mnpair.second.addr.IsIPv4()) ||
+            (nNetworkType == NET_TOR  && mnpair.second.addr.IsTor())  ||
+            (nNetworkType == NET_IPV6 && mnpair.second.addr.IsIPv6())) {
                 nNodeCount++;
         }
 
@@ -446,40 +524,133 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
     LogPrint("masternode", "CMasternodeMan::DsegUpdate -- asked %s for the list\n", pnode->addr.ToString());
 }
 
+void CMasternodeMan::AddToIndexes(CMasternode& mn)
+{
+    ListChanged();
+    mapMasternodesByOutpoint[mn.vin.prevout] = &mn;
+    mapMasternodesByPayee.insert(std::make_pair(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), mn.vin.prevout));
+    mapMasternodesByPubKey.insert(std::make_pair(mn.pubKeyMasternode, mn.vin.prevout));
+    setMasternodesByLastPaid.insert(std::make_pair(mn.GetLastPaidBlock(), &mn));
+}
+
+template<typename Map, typename Key>
+static void EraseIndexEntry(Map& mapIndex, const Key& key, const COutPoint& outpoint)
+{
+    std::pair<typename Map::iterator, typename Map::iterator> range = mapIndex.equal_range(key);
+    for (typename Map::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == outpoint) {
+            mapIndex.erase(it);
+            return;
+        }
+    }
+}
+
+void CMasternodeMan::RemoveFromIndexes(const CMasternode& mn)
+{
+    // cached rankings point into mapMasternodes
+    ListChanged();
+    mapMasternodesByOutpoint.erase(mn.vin.prevout);
+    EraseIndexEntry(mapMasternodesByPayee, GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), mn.vin.prevout);
+    EraseIndexEntry(mapMasternodesByPubKey, mn.pubKeyMasternode, mn.vin.prevout);
+    setMasternodesByLastPaid.erase(std::make_pair(mn.GetLastPaidBlock(), const_cast<CMasternode*>(&mn)));
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    ListChanged();
+    mapMasternodesByOutpoint.clear();
+    mapMasternodesByPayee.clear();
+    mapMasternodesByPubKey.clear();
+    setMasternodesByLastPaid.clear();
+    for (auto& mnpair : mapMasternodes) {
+        AddToIndexes(mnpair.second);
+    }
+}
+
+void CMasternodeMan::UpdatePubKeyIndex(CMasternode& mn, const CPubKey& pubKeyMasternodeOld)
+{
+    if(mn.pubKeyMasternode == pubKeyMasternodeOld) return;
+    EraseIndexEntry(mapMasternodesByPubKey, pubKeyMasternodeOld, mn.vin.prevout);
+    mapMasternodesByPubKey.insert(std::make_pair(mn.pubKeyMasternode, mn.vin.prevout));
+}
+
+void CMasternodeMan::UpdateLastPaidIndex(CMasternode& mn, int nBlockLastPaidOld)
+{
+    if(mn.GetLastPaidBlock() == nBlockLastPaidOld) return;
+    setMasternodesByLastPaid.erase(std::make_pair(nBlockLastPaidOld, &mn));
+    setMasternodesByLastPaid.insert(std::make_pair(mn.GetLastPaidBlock(), &mn));
+}
+
+template<typename Iterator>
+CMasternode* CMasternodeMan::FindFirst(Iterator itBegin, Iterator itEnd)
+{
+    // several masternodes can share a key, return the lowest outpoint
+    // to stay independent of the hash table's iteration order
+    const COutPoint* pBest = NULL;
+    for (Iterator it = itBegin; it != itEnd; ++it) {
+        if(!pBest || it->second < *pBest) pBest = &it->second;
+    }
+    if(!pBest) return NULL;
+    std::map<COutPoint, CMasternode>::iterator it = mapMasternodes.find(*pBest);
+    return it == mapMasternodes.end() ? NULL : &it->second;
+}
+
 CMasternode* CMasternodeMan::Find(const CScript &payee)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()) == payee)
-            return &mn;
-    }
-    return NULL;
+    auto range = mapMasternodesByPayee.equal_range(payee);
+    return FindFirst(range.first, range.second);
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    auto it = mapMasternodesByOutpoint.find(vin.prevout);
+    return it == mapMasternodesByOutpoint.end() ? NULL : it->second;
 }
 
 CMasternode* CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
+    auto range = mapMasternodesByPubKey.equal_range(pubKeyMasternode);
+    return FindFirst(range.first, range.second);
+}
+
+std::vector<CMasternode> CMasternodeMan::GetFullMasternodeVector()
+{
+    return GetMasternodeListSnapshot()->vecMasternodes;
+}
+
+CMasternodeListSnapshotRef CMasternodeMan::GetMasternodeListSnapshot()
+{
+    CMasternodeListSnapshotRef snapshot = std::atomic_load(&listSnapshot);
+    if(snapshot && snapshot->nVersion == nListVersion) {
+        return snapshot;
+    }
+
+    // the list changed since the last snapshot, the first reader rebuilds it
+    LOCK(cs);
+    PublishSnapshot();
+    return std::atomic_load(&listSnapshot);
+}
+
+void CMasternodeMan::PublishSnapshot()
+{
+    AssertLockHeld(cs);
+
+    CMasternodeListSnapshotRef snapshot = std::atomic_load(&listSnapshot);
+    if(snapshot && snapshot->nVersion == nListVersion) return;
+
+    std::shared_ptr<CMasternodeListSnapshot> snapshotNew = std::make_shared<CMasternodeListSnapshot>();
+    snapshotNew->nVersion = nListVersion;
+    snapshotNew->vecMasternodes.reserve(mapMasternodes.size());
+    for (const auto& mnpair : mapMasternodes) {
+        snapshotNew->vecMasternodes.push_back(mnpair.second);
     }
-    return NULL;
+    std::atomic_store(&listSnapshot, CMasternodeListSnapshotRef(snapshotNew));
 }
 
 bool CMasternodeMan::Get(const CPubKey& pubKeyMasternode, CMasternode& masternode)
@@ -555,60 +726,75 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     LOCK2(cs_main,cs);
 
     CMasternode *pBestMasternode = NULL;
-    std::vector<std::pair<int, CMasternode*> > vecMasternodeLastPaid;
+
+    int nMnCount = CountEnabled();
+    int nMinProtocol = mnpayments.GetMinMasternodePaymentsProto();
+    int64_t nAdjustedTime = GetAdjustedTime();
+
+    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
+    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
+    //  -- (chance per block * chances before IsScheduled will fire)
+    int nTenthNetwork = std::max(nMnCount/10, 1);
+    std::vector<CMasternode*> vecOldestTenth;
+    vecOldestTenth.reserve(nTenthNetwork);
+
+    // masternodes that are in the list (up to 8 entries ahead of current block to allow propagation),
+    // resolved once through the payee index instead of hashing every masternode's payee
+    std::set<COutPoint> setScheduled;
+    BOOST_FOREACH(const CScript& payee, mnpayments.GetScheduledPayees(nBlockHeight)) {
+        auto range = mapMasternodesByPayee.equal_range(payee);
+        for (auto it = range.first; it != range.second; ++it) {
+            setScheduled.insert(it->second);
+        }
+    }
 
     /*
-        Make a vector with all of the last paid times
+        Walk all masternodes from the oldest last paid block to the most recent one,
+        count the eligible ones and keep the first tenth of the network
     */
 
-    int nMnCount = CountEnabled();
-    BOOST_FOREACH(CMasternode &mn, vMasternodes)
+    nCount = 0;
+    for (const auto& lastpaid : setMasternodesByLastPaid)
     {
+        CMasternode& mn = *lastpaid.second;
         if(!mn.IsValidForPayment()) continue;
 
         //check protocol version
-        if(mn.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
+        if(mn.nProtocolVersion < nMinProtocol) continue;
 
-        //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if(mnpayments.IsScheduled(mn, nBlockHeight)) continue;
+        //it's in the list -- so let's skip it
+        if(setScheduled.count(mn.vin.prevout)) continue;
 
         //it's too new, wait for a cycle
-        if(fFilterSigTime && mn.sigTime + (nMnCount*2.6*60) > GetAdjustedTime()) continue;
+        if(fFilterSigTime && mn.sigTime + (nMnCount*2.6*60) > nAdjustedTime) continue;
 
         //make sure it has at least as many confirmations as there are masternodes
         if(mn.GetCollateralAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mn.GetLastPaidBlock(), &mn));
+        nCount++;
+        if((int)vecOldestTenth.size() < nTenthNetwork) {
+            vecOldestTenth.push_back(&mn);
+        }
     }
 
-    nCount = (int)vecMasternodeLastPaid.size();
-
     //when the network is in the process of upgrading, don't penalize nodes that recently restarted
     if(fFilterSigTime && nCount < nMnCount/3) return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCount);
 
-    // Sort them low to high
-    sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), CompareLastPaidBlock());
-
     uint256 blockHash;
     if(!GetBlockHash(blockHash, nBlockHeight - 101)) {
         LogPrintf("CMasternode::GetNextMasternodeInQueueForPayment -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", nBlockHeight - 101);
         return NULL;
     }
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
-    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
-    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
-    //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = nMnCount/10;
-    int nCountTenth = 0;
+
+    arith_uint256 hashBlockScore = CMasternode::GetBlockScoreHash(blockHash);
     arith_uint256 nHighest = 0;
-    BOOST_FOREACH (PAIRTYPE(int, CMasternode*)& s, vecMasternodeLastPaid){
-        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+    BOOST_FOREACH(CMasternode* pmn, vecOldestTenth) {
+        arith_uint256 nScore = pmn->CalculateScore(blockHash, hashBlockScore);
         if(nScore > nHighest){
             nHighest = nScore;
-            pBestMasternode = s.second;
+            pBestMasternode = pmn;
         }
-        nCountTenth++;
-        if(nCountTenth >= nTenthNetwork) break;
     }
     return pBestMasternode;
 }
@@ -627,7 +813,8 @@ masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &v
 
     // fill a vector of pointers
     std::vector<CMasternode*> vpMasternodesShuffled;
-    BOOST_FOREACH(CMasternode &mn, vMasternodes) {
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         vpMasternodesShuffled.push_back(&mn);
     }
 
@@ -656,68 +843,73 @@ masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &v
     return masternode_info_t();
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+const CMasternodeRankCache::ranking_t& CMasternodeMan::GetRanking(const uint256& blockHash, int nMinProtocol, CMasternodeRankCache::filter_t filter)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
+    AssertLockHeld(cs);
 
-    //make sure we know about this block
-    uint256 blockHash = uint256();
-    if(!GetBlockHash(blockHash, nBlockHeight)) return -1;
+    int64_t nNow = GetTime();
+    const CMasternodeRankCache::ranking_t* pranking = rankCache.Get(blockHash, nMinProtocol, filter, nNow);
+    if(pranking) return *pranking;
 
-    LOCK(cs);
+    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
+    vecMasternodeScores.reserve(mapMasternodes.size());
+    arith_uint256 hashBlockScore = CMasternode::GetBlockScoreHash(blockHash);
 
     // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         if(mn.nProtocolVersion < nMinProtocol) continue;
-        if(fOnlyActive) {
-            if(!mn.IsEnabled()) continue;
-        }
-        else {
-            if(!mn.IsValidForPayment()) continue;
-        }
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
+        if(filter == CMasternodeRankCache::FILTER_ENABLED && !mn.IsEnabled()) continue;
+        if(filter == CMasternodeRankCache::FILTER_VALID_FOR_PAYMENT && !mn.IsValidForPayment()) continue;
+
+        int64_t nScore = mn.CalculateScore(blockHash, hashBlockScore).GetCompact(false);
 
         vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
     }
 
     sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
 
+    CMasternodeRankCache::ranking_t ranking;
+    ranking.nTimeCreated = nNow;
+    ranking.vecRanked.reserve(vecMasternodeScores.size());
     int nRank = 0;
     BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& scorePair, vecMasternodeScores) {
         nRank++;
-        if(scorePair.second->vin.prevout == vin.prevout) return nRank;
+        ranking.vecRanked.push_back(scorePair.second);
+        ranking.mapRanks[scorePair.second->vin.prevout] = nRank;
     }
 
-    return -1;
+    return rankCache.Insert(blockHash, nMinProtocol, filter, ranking);
 }
 
-std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int nBlockHeight, int nMinProtocol)
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
-    std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
-
     //make sure we know about this block
     uint256 blockHash = uint256();
-    if(!GetBlockHash(blockHash, nBlockHeight)) return vecMasternodeRanks;
+    if(!GetBlockHash(blockHash, nBlockHeight)) return -1;
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    return GetRanking(blockHash, nMinProtocol, fOnlyActive ? CMasternodeRankCache::FILTER_ENABLED : CMasternodeRankCache::FILTER_VALID_FOR_PAYMENT).GetRank(vin.prevout);
+}
 
-        if(mn.nProtocolVersion < nMinProtocol || !mn.IsEnabled()) continue;
+std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int nBlockHeight, int nMinProtocol)
+{
+    std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
 
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
+    //make sure we know about this block
+    uint256 blockHash = uint256();
+    if(!GetBlockHash(blockHash, nBlockHeight)) return vecMasternodeRanks;
 
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
+    LOCK(cs);
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    const CMasternodeRankCache::ranking_t& ranking = GetRanking(blockHash, nMinProtocol, CMasternodeRankCache::FILTER_ENABLED);
 
+    vecMasternodeRanks.reserve(ranking.vecRanked.size());
     int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores) {
+    BOOST_FOREACH (CMasternode* pmn, ranking.vecRanked) {
         nRank++;
-        vecMasternodeRanks.push_back(std::make_pair(nRank, *s.second));
+        vecMasternodeRanks.push_back(std::make_pair(nRank, *pmn));
     }
 
     return vecMasternodeRanks;
@@ -725,8 +917,6 @@ std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
-
     LOCK(cs);
 
     uint256 blockHash;
@@ -735,28 +925,7 @@ CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, in
         return NULL;
     }
 
-    // Fill scores
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.nProtocolVersion < nMinProtocol) continue;
-        if(fOnlyActive && !mn.IsEnabled()) continue;
-
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores){
-        rank++;
-        if(rank == nRank) {
-            return s.second;
-        }
-    }
-
-    return NULL;
+    return GetRanking(blockHash, nMinProtocol, fOnlyActive ? CMasternodeRankCache::FILTER_ENABLED : CMasternodeRankCache::FILTER_NONE).GetByRank(nRank);
 }
 
 void CMasternodeMan::ProcessMasternodeConnections()
@@ -815,6 +984,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         LogPrint("masternode", "MNANNOUNCE -- Masternode announce, masternode=%s\n", mnb.vin.prevout.ToStringShort());
 
+        if (CheckMnbSignaturesAsync(pfrom, mnb)) return;
+
         int nDos = 0;
 
         if (CheckMnbAndUpdateMasternodeList(pfrom, mnb, nDos)) {
@@ -838,40 +1009,17 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s\n", mnp.vin.prevout.ToStringShort());
 
-        // Need LOCK2 here to ensure consistent locking order because the CheckAndUpdate call below locks cs_main
-        LOCK2(cs_main, cs);
-
-        if(mapSeenMasternodePing.count(nHash)) return; //seen
-        mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
+        {
+            LOCK(cs);
+            if(mapSeenMasternodePing.count(nHash)) return; //seen
+            mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
+        }
 
         LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s new\n", mnp.vin.prevout.ToStringShort());
 
-        // see if we have this Masternode
-        CMasternode* pmn = mnodeman.Find(mnp.vin);
-
-        // if masternode uses sentinel ping instead of watchdog
-        // we shoud update nTimeLastWatchdogVote here if sentinel
-        // ping flag is actual
-        if(pmn && mnp.fSentinelIsCurrent)
-            pmn->UpdateWatchdogVoteTime(mnp.sigTime);
-
-        // too late, new MNANNOUNCE is required
-        if(pmn && pmn->IsNewStartRequired()) return;
-
-        int nDos = 0;
-        if(mnp.CheckAndUpdate(pmn, false, nDos)) return;
-
-        if(nDos > 0) {
-            // if anything significant failed, mark that node
-            Misbehaving(pfrom->GetId(), nDos);
-        } else if(pmn != NULL) {
-            // nothing significant failed, mn is a known one too
-            return;
-        }
+        if (CheckMnpSignatureAsync(pfrom, mnp)) return;
 
-        // something significant is broken or mn is unknown,
-        // we might have to ask for a masternode entry once
-        AskForMN(pfrom, mnp.vin);
+        ProcessMasternodePing(pfrom, mnp);
 
     } else if (strCommand == NetMsgType::PPEG) { //Get Masternode list or specific entry
         // Ignore such requests until we are fully synced.
@@ -904,7 +1052,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         int nInvCount = 0;
 
-        BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        for (auto& mnpair : mapMasternodes) {
+            CMasternode& mn = mnpair.second;
             if (vin != CTxIn() && vin != mn.vin) continue; // asked for specific vin but we are not there yet
             if (mn.addr.IsRFC1918() || mn.addr.IsLocal()) continue; // do not send local network masternode
             if (mn.IsUpdateRequired()) continue; // do not send outdated masternodes
@@ -999,7 +1148,8 @@ void CMasternodeMan::DoFullVerificationStep()
     if(nOffset >= (int)vecMasternodeRanks.size()) return;
 
     std::vector<CMasternode*> vSortedByAddr;
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         vSortedByAddr.push_back(&mn);
     }
 
@@ -1039,7 +1189,7 @@ void CMasternodeMan::DoFullVerificationStep()
 
 void CMasternodeMan::CheckSameAddr()
 {
-    if(!masternodeSync.IsSynced() || vMasternodes.empty()) return;
+    if(!masternodeSync.IsSynced() || mapMasternodes.empty()) return;
 
     std::vector<CMasternode*> vBan;
     std::vector<CMasternode*> vSortedByAddr;
@@ -1050,7 +1200,8 @@ void CMasternodeMan::CheckSameAddr()
         CMasternode* pprevMasternode = NULL;
         CMasternode* pverifiedMasternode = NULL;
 
-        BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        for (auto& mnpair : mapMasternodes) {
+            CMasternode& mn = mnpair.second;
             vSortedByAddr.push_back(&mn);
         }
 
@@ -1081,12 +1232,13 @@ void CMasternodeMan::CheckSameAddr()
             }
             pprevMasternode = pmn;
         }
-    }
 
-    // ban duplicates
-    BOOST_FOREACH(CMasternode* pmn, vBan) {
-        LogPrintf("CMasternodeMan::CheckSameAddr -- increasing PoSe ban score for masternode %s\n", pmn->vin.prevout.ToStringShort());
-        pmn->IncreasePoSeBanScore();
+        // ban duplicates
+        BOOST_FOREACH(CMasternode* pmn, vBan) {
+            LogPrintf("CMasternodeMan::CheckSameAddr -- increasing PoSe ban score for masternode %s\n", pmn->vin.prevout.ToStringShort());
+            pmn->IncreasePoSeBanScore();
+        }
+        if(!vBan.empty()) EntryChanged();
     }
 }
 
@@ -1201,23 +1353,24 @@ void CMasternodeMan::ProcessVerifyReply(CNode* pnode, CMasternodeVerification& m
 
         CMasternode* prealMasternode = NULL;
         std::vector<CMasternode*> vpMasternodesToBan;
-        std::vector<CMasternode>::iterator it = vMasternodes.begin();
+        std::map<COutPoint, CMasternode>::iterator it = mapMasternodes.begin();
         std::string strMessage1 = strprintf("%s%d%s", pnode->addr.ToString(false), mnv.nonce, blockHash.ToString());
-        while(it != vMasternodes.end()) {
-            if(CAddress(it->addr, NODE_NETWORK) == pnode->addr) {
-                if(CMessageSigner::VerifyMessage(it->pubKeyMasternode, mnv.vchSig1, strMessage1, strError)) {
+        while(it != mapMasternodes.end()) {
+            if(CAddress(it->second.addr, NODE_NETWORK) == pnode->addr) {
+                if(CMessageSigner::VerifyMessage(it->second.pubKeyMasternode, mnv.vchSig1, strMessage1, strError)) {
                     // found it!
-                    prealMasternode = &(*it);
-                    if(!it->IsPoSeVerified()) {
-                        it->DecreasePoSeBanScore();
+                    prealMasternode = &it->second;
+                    if(!it->second.IsPoSeVerified()) {
+                        it->second.DecreasePoSeBanScore();
+                        EntryChanged();
                     }
                     netfulfilledman.AddFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-done");
 
                     // we can only broadcast it if we are an activated masternode
                     if(activeMasternode.vin == CTxIn()) continue;
                     // update ...
-                    mnv.addr = it->addr;
-                    mnv.vin1 = it->vin;
+                    mnv.addr = it->second.addr;
+                    mnv.vin1 = it->second.vin;
                     mnv.vin2 = activeMasternode.vin;
                     std::string strMessage2 = strprintf("%s%d%s%s%s", mnv.addr.ToString(false), mnv.nonce, blockHash.ToString(),
                                             mnv.vin1.prevout.ToStringShort(), mnv.vin2.prevout.ToStringShort());
@@ -1238,7 +1391,7 @@ void CMasternodeMan::ProcessVerifyReply(CNode* pnode, CMasternodeVerification& m
                     mnv.Relay();
 
                 } else {
-                    vpMasternodesToBan.push_back(&(*it));
+                    vpMasternodesToBan.push_back(&it->second);
                 }
             }
             ++it;
@@ -1256,6 +1409,7 @@ void CMasternodeMan::ProcessVerifyReply(CNode* pnode, CMasternodeVerification& m
         // increase ban score for everyone else
         BOOST_FOREACH(CMasternode* pmn, vpMasternodesToBan) {
             pmn->IncreasePoSeBanScore();
+            EntryChanged();
             LogPrint("masternode", "CMasternodeMan::ProcessVerifyBroadcast -- increased PoSe ban score for %s addr %s, new score %d\n",
                         prealMasternode->vin.prevout.ToStringShort(), pnode->addr.ToString(), pmn->nPoSeBanScore);
         }
@@ -1347,6 +1501,7 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
 
         if(!pmn1->IsPoSeVerified()) {
             pmn1->DecreasePoSeBanScore();
+            EntryChanged();
         }
         mnv.Relay();
 
@@ -1355,9 +1510,11 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
 
         // increase ban score for everyone else with the same addr
         int nCount = 0;
-        BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        for (auto& mnpair : mapMasternodes) {
+            CMasternode& mn = mnpair.second;
             if(mn.addr != mnv.addr || mn.vin.prevout == mnv.vin1.prevout) continue;
             mn.IncreasePoSeBanScore();
+            EntryChanged();
             nCount++;
             LogPrint("masternode", "CMasternodeMan::ProcessVerifyBroadcast -- increased PoSe ban score for %s addr %s, new score %d\n",
                         mn.vin.prevout.ToStringShort(), mn.addr.ToString(), mn.nPoSeBanScore);
@@ -1371,11 +1528,13 @@ std::string CMasternodeMan::ToString() const
 {
     std::ostringstream info;
 
-    info << "Masternodes: " << (int)vMasternodes.size() <<
+    info << "Masternodes: " << (int)mapMasternodes.size() <<
             ", peers who asked us for Masternode list: " << (int)mAskedUsForMasternodeList.size() <<
             ", peers we asked for Masternode list: " << (int)mWeAskedForMasternodeList.size() <<
             ", entries in Masternode list we asked for: " << (int)mWeAskedForMasternodeListEntry.size() <<
             ", masternode index size: " << indexMasternodes.GetSize() <<
+            ", cached rankings: " << (int)rankCache.size() <<
+            " (hits: " << rankCache.GetHits() << ", misses: " << rankCache.GetMisses() << ")" <<
             ", nDsqCount: " << (int)nDsqCount;
 
     return info.str();
@@ -1396,7 +1555,11 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         }
     } else {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-        if(pmn->UpdateFromNewBroadcast(mnb)) {
+        CPubKey pubKeyMasternodeOld = pmn->pubKeyMasternode;
+        bool fUpdated = pmn->UpdateFromNewBroadcast(mnb);
+        UpdatePubKeyIndex(*pmn, pubKeyMasternodeOld);
+        ListChanged();
+        if(fUpdated) {
             masternodeSync.BumpAssetLastTime("CMasternodeMan::UpdateMasternodeList - seen");
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
         }
@@ -1458,7 +1621,11 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
         CMasternode* pmn = Find(mnb.vin);
         if(pmn) {
             CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-            if(!mnb.Update(pmn, nDos)) {
+            CPubKey pubKeyMasternodeOld = pmn->pubKeyMasternode;
+            bool fUpdated = mnb.Update(pmn, nDos);
+            UpdatePubKeyIndex(*pmn, pubKeyMasternodeOld);
+            ListChanged();
+            if(!fUpdated) {
                 LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- Update() failed, masternode=%s\n", mnb.vin.prevout.ToStringShort());
                 return false;
             }
@@ -1496,26 +1663,156 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
     return true;
 }
 
-void CMasternodeMan::UpdateLastPaid()
+bool CMasternodeMan::CheckMnbSignaturesAsync(CNode* pfrom, const CMasternodeBroadcast& mnb)
 {
-    LOCK(cs);
+    uint256 hash = mnb.GetHash();
+    {
+        LOCK(cs);
+        // seen broadcasts need no signature checks, they might answer recovery requests though
+        if(mapSeenMasternodeBroadcast.count(hash)) return false;
+        // already being checked, drop the duplicate just like a seen one
+        if(!setMnbSigCheckPending.insert(hash).second) return true;
+    }
+
+    std::vector<CMessageSigCheck> vChecks;
+    vChecks.push_back(CMessageSigCheck(mnb.pubKeyCollateralAddress, mnb.vchSig, mnb.GetSignatureMessage()));
+    if(mnb.lastPing != CMasternodePing()) {
+        // the ping is checked against the key of the broadcast it comes with
+        vChecks.push_back(CMessageSigCheck(mnb.pubKeyMasternode, mnb.lastPing.vchSig, mnb.lastPing.GetSignatureMessage()));
+    }
+    pfrom->AddRef();
+    if(!messageSigQueue.Add(vChecks, std::bind(&CMasternodeMan::MnbSignaturesChecked, this, pfrom, mnb, std::placeholders::_1))) {
+        LogPrint("masternode", "CMasternodeMan::CheckMnbSignaturesAsync -- signature queue is full, dropping broadcast: masternode=%s\n", mnb.vin.prevout.ToStringShort());
+        {
+            LOCK(cs);
+            setMnbSigCheckPending.erase(hash);
+        }
+        pfrom->Release();
+    }
+    return true;
+}
 
-    if(fLiteMode || !pCurrentBlockIndex) return;
-    if(!masternodeSync.IsWinnersListSynced() || vMasternodes.empty()) return;
+bool CMasternodeMan::CheckMnpSignatureAsync(CNode* pfrom, const CMasternodePing& mnp)
+{
+    CPubKey pubKeyMasternode;
+    {
+        LOCK(cs);
+        CMasternode* pmn = Find(mnp.vin);
+        // pings of unknown masternodes and pings arriving too early are rejected
+        // by CheckAndUpdate() before it gets to the signature, no need to queue those
+        if(!pmn || pmn->IsPingedWithin(MASTERNODE_MIN_MNP_SECONDS - 60, mnp.sigTime)) return false;
+        pubKeyMasternode = pmn->pubKeyMasternode;
+    }
+
+    std::vector<CMessageSigCheck> vChecks(1, CMessageSigCheck(pubKeyMasternode, mnp.vchSig, mnp.GetSignatureMessage()));
+    pfrom->AddRef();
+    if(!messageSigQueue.Add(vChecks, std::bind(&CMasternodeMan::MnpSignatureChecked, this, pfrom, mnp, std::placeholders::_1))) {
+        LogPrint("masternode", "CMasternodeMan::CheckMnpSignatureAsync -- signature queue is full, dropping ping: masternode=%s\n", mnp.vin.prevout.ToStringShort());
+        {
+            LOCK(cs);
+            mapSeenMasternodePing.erase(mnp.GetHash());
+        }
+        pfrom->Release();
+    }
+    return true;
+}
+
+void CMasternodeMan::MnpSignatureChecked(CNode* pfrom, CMasternodePing mnp, const std::vector<CMessageSigCheck>& vChecks)
+{
+    mnp.checkedSig.Set(vChecks[0]);
+    ProcessMasternodePing(pfrom, mnp);
+    pfrom->Release();
+}
+
+void CMasternodeMan::ProcessMasternodePing(CNode* pfrom, CMasternodePing& mnp)
+{
+    // Need LOCK2 here to ensure consistent locking order because the CheckAndUpdate call below locks cs_main
+    LOCK2(cs_main, cs);
+
+    // see if we have this Masternode
+    CMasternode* pmn = Find(mnp.vin);
+    if(pmn) EntryChanged();
 
-    static bool IsFirstRun = true;
-    // Do full scan on first run or if we are not a masternode
-    // (MNs should update this info on every block, so limited scan should be enough for them)
-    int nMaxBlocksToScanBack = (IsFirstRun || !fMasterNode) ? mnpayments.GetStorageLimit() : LAST_PAID_SCAN_BLOCKS;
+    // if masternode uses sentinel ping instead of watchdog
+    // we shoud update nTimeLastWatchdogVote here if sentinel
+    // ping flag is actual
+    if(pmn && mnp.fSentinelIsCurrent)
+        pmn->UpdateWatchdogVoteTime(mnp.sigTime);
+
+    // too late, new MNANNOUNCE is required
+    if(pmn && pmn->IsNewStartRequired()) return;
 
-    // LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d, IsFirstRun=%s\n",
-    //                         pCurrentBlockIndex->nHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
+    int nDos = 0;
+    if(mnp.CheckAndUpdate(pmn, false, nDos)) return;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-        mn.UpdateLastPaid(pCurrentBlockIndex, nMaxBlocksToScanBack);
+    if(nDos > 0) {
+        // if anything significant failed, mark that node
+        Misbehaving(pfrom->GetId(), nDos);
+    } else if(pmn != NULL) {
+        // nothing significant failed, mn is a known one too
+        return;
     }
 
-    IsFirstRun = false;
+    // something significant is broken or mn is unknown,
+    // we might have to ask for a masternode entry once
+    AskForMN(pfrom, mnp.vin);
+}
+
+void CMasternodeMan::MnbSignaturesChecked(CNode* pfrom, CMasternodeBroadcast mnb, const std::vector<CMessageSigCheck>& vChecks)
+{
+    mnb.checkedSig.Set(vChecks[0]);
+    if(vChecks.size() > 1) {
+        mnb.lastPing.checkedSig.Set(vChecks[1]);
+    }
+
+    int nDos = 0;
+    if (CheckMnbAndUpdateMasternodeList(pfrom, mnb, nDos)) {
+        // use announced Masternode as a peer
+        g_connman->AddNewAddress(CAddress(mnb.addr, NODE_NETWORK), pfrom->addr, 2*60*60);
+    } else if(nDos > 0) {
+        LOCK(cs_main);
+        Misbehaving(pfrom->GetId(), nDos);
+    }
+
+    {
+        LOCK(cs);
+        setMnbSigCheckPending.erase(mnb.GetHash());
+    }
+
+    if(fMasternodesAdded) {
+        NotifyMasternodeUpdates();
+    }
+    pfrom->Release();
+}
+
+void CMasternodeMan::UpdateLastPaid()
+{
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs);
+        pindex = pCurrentBlockIndex;
+    }
+    if(fLiteMode || !pindex) return;
+    if(!masternodeSync.IsWinnersListSynced()) return;
+
+    // Payments are looked up in mnpaymentindex which is kept up to date on every block,
+    // so scanning the whole payment votes window is cheap. Blocks connected before
+    // the index was populated (e.g. on startup) are read from disk once here.
+    int nMaxBlocksToScanBack = mnpayments.GetStorageLimit();
+    mnpaymentindex.Backfill(pindex, nMaxBlocksToScanBack);
+
+    LOCK(cs);
+
+    // LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d\n",
+    //                         pindex->nHeight, nMaxBlocksToScanBack);
+
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
+        int nBlockLastPaidOld = mn.GetLastPaidBlock();
+        mn.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+        UpdateLastPaidIndex(mn, nBlockLastPaidOld);
+    }
+    EntryChanged();
 }
 
 bool CMasternodeMan::UpdateLastDsq(const CTxIn& vin)
@@ -1527,9 +1824,20 @@ bool CMasternodeMan::UpdateLastDsq(const CTxIn& vin)
         return false;
     pMN->nLastDsq = nDsqCount;
     pMN->fAllowMixingTx = true;
+    EntryChanged();
     return true;
 }
 
+void CMasternodeMan::DisallowMixing(const CTxIn& vin)
+{
+    LOCK(cs);
+    CMasternode* pMN = Find(vin);
+    if(!pMN)
+        return;
+    pMN->fAllowMixingTx = false;
+    EntryChanged();
+}
+
 void CMasternodeMan::CheckAndRebuildMasternodeIndex()
 {
     LOCK(cs);
@@ -1542,14 +1850,14 @@ void CMasternodeMan::CheckAndRebuildMasternodeIndex()
         return;
     }
 
-    if(indexMasternodes.GetSize() <= int(vMasternodes.size())) {
+    if(indexMasternodes.GetSize() <= int(mapMasternodes.size())) {
         return;
     }
 
     indexMasternodesOld = indexMasternodes;
     indexMasternodes.Clear();
-    for(size_t i = 0; i < vMasternodes.size(); ++i) {
-        indexMasternodes.AddMasternodeVIN(vMasternodes[i].vin);
+    for (const auto& mnpair : mapMasternodes) {
+        indexMasternodes.AddMasternodeVIN(mnpair.second.vin);
     }
 
     fIndexRebuilt = true;
@@ -1565,6 +1873,7 @@ void CMasternodeMan::UpdateWatchdogVoteTime(const CTxIn& vin)
     }
     pMN->UpdateWatchdogVoteTime();
     nLastWatchdogVoteTime = GetTime();
+    EntryChanged();
 }
 
 bool CMasternodeMan::IsWatchdogActive()
@@ -1582,15 +1891,18 @@ bool CMasternodeMan::AddGovernanceVote(const CTxIn& vin, uint256 nGovernanceObje
         return false;
     }
     pMN->AddGovernanceVote(nGovernanceObjectHash);
+    EntryChanged();
     return true;
 }
 
 void CMasternodeMan::RemoveGovernanceObject(uint256 nGovernanceObjectHash)
 {
     LOCK(cs);
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    for (auto& mnpair : mapMasternodes) {
+        CMasternode& mn = mnpair.second;
         mn.RemoveGovernanceObject(nGovernanceObjectHash);
     }
+    EntryChanged();
 }
 
 void CMasternodeMan::CheckMasternode(const CTxIn& vin, bool fForce)
@@ -1600,6 +1912,7 @@ void CMasternodeMan::CheckMasternode(const CTxIn& vin, bool fForce)
     if(!pMN)  {
         return;
     }
+    ListChanged();
     pMN->Check(fForce);
 }
 
@@ -1610,6 +1923,7 @@ void CMasternodeMan::CheckMasternode(const CPubKey& pubKeyMasternode, bool fForc
     if(!pMN)  {
         return;
     }
+    ListChanged();
     pMN->Check(fForce);
 }
 
@@ -1651,6 +1965,7 @@ void CMasternodeMan::SetMasternodeLastPing(const CTxIn& vin, const CMasternodePi
         return;
     }
     pMN->lastPing = mnp;
+    EntryChanged();
     // if masternode uses sentinel ping instead of watchdog
     // we shoud update nTimeLastWatchdogVote here if sentinel
     // ping flag is actual
@@ -1667,7 +1982,12 @@ void CMasternodeMan::SetMasternodeLastPing(const CTxIn& vin, const CMasternodePi
 
 void CMasternodeMan::UpdatedBlockTip(const CBlockIndex *pindex)
 {
-    pCurrentBlockIndex = pindex;
+    {
+        LOCK(cs);
+        // rankings are calculated for the new tip, the entries themselves didn't change
+        rankCache.Clear();
+        pCurrentBlockIndex = pindex;
+    }
     LogPrint("masternode", "CMasternodeMan::UpdatedBlockTip -- pCurrentBlockIndex->nHeight=%d\n", pCurrentBlockIndex->nHeight);
 
     CheckSameAddr();
@@ -1692,6 +2012,7 @@ void CMasternodeMan::NotifyMasternodeUpdates()
     if(fMasternodesAddedLocal) {
         governance.CheckMasternodeOrphanObjects();
         governance.CheckMasternodeOrphanVotes();
+        instapay.CheckMasternodeOrphanVotes();
     }
     if(fMasternodesRemovedLocal) {
         governance.UpdateCachesAndClean();
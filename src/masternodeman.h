@@ -9,12 +9,38 @@
 #include "masternode.h"
 #include "sync.h"
 
+#include <atomic>
+#include <memory>
+
+#include <boost/unordered_map.hpp>
+
 using namespace std;
 
 class CMasternodeMan;
+class CMasternodeListSnapshot;
+
+typedef std::shared_ptr<const CMasternodeListSnapshot> CMasternodeListSnapshotRef;
 
 extern CMasternodeMan mnodeman;
 
+/**
+ * Immutable copy of the masternode list.
+ *
+ * Built by CMasternodeMan under its lock for the first reader after the list
+ * changed, and shared by all readers until the next change, so walking the whole
+ * list (RPC, GUI, governance) doesn't need to hold CMasternodeMan::cs and stall
+ * message processing. Changing the list only bumps its version, it never copies.
+ */
+class CMasternodeListSnapshot
+{
+public:
+    std::vector<CMasternode> vecMasternodes;
+    // list version this was copied from
+    int nVersion;
+
+    CMasternodeListSnapshot() : vecMasternodes(), nVersion(0) {}
+};
+
 /**
  * Provides a forward and reverse index between MN vin's and integers.
  *
@@ -79,6 +105,93 @@ private:
 
 };
 
+/**
+ * Salted hasher for the lookup indexes of CMasternodeMan.
+ *
+ * The keys (collateral outpoints, payee scripts and masternode pubkeys) are
+ * chosen by remote peers, so the hash is keyed per process to keep them from
+ * crafting collisions.
+ */
+class CMasternodeKeyHasher
+{
+private:
+    uint64_t k0;
+    uint64_t k1;
+
+public:
+    CMasternodeKeyHasher();
+
+    size_t operator()(const COutPoint& outpoint) const;
+    size_t operator()(const CScript& script) const;
+    size_t operator()(const CPubKey& pubkey) const;
+};
+
+/**
+ * Masternode rankings for a block, computed once and reused.
+ *
+ * Ranking costs two SHA256d per masternode and a full sort, and InstaPay vote
+ * validation, payment votes and PrivatePay queue checks keep asking for the
+ * same few heights. A ranking is keyed by (block hash, min protocol, filter)
+ * and dropped when the masternode list changes, on a new tip, or after
+ * MASTERNODE_CHECK_SECONDS, the interval at which masternode states are
+ * re-evaluated anyway.
+ */
+class CMasternodeRankCache
+{
+public:
+    /// Which masternodes take part in a ranking
+    enum filter_t {
+        FILTER_NONE,
+        FILTER_ENABLED,
+        FILTER_VALID_FOR_PAYMENT
+    };
+
+    struct ranking_t
+    {
+        int64_t nTimeCreated;
+        /// masternodes ordered by rank, best first; valid until the cache is cleared
+        std::vector<CMasternode*> vecRanked;
+        /// 1-based rank of every ranked masternode
+        boost::unordered_map<COutPoint, int, CMasternodeKeyHasher> mapRanks;
+
+        int GetRank(const COutPoint& outpoint) const;
+        CMasternode* GetByRank(int nRank) const;
+    };
+
+private:
+    static const size_t MAX_CACHED_RANKINGS = 32;
+
+    typedef std::pair<uint256, std::pair<int, int> > key_t;
+
+    std::map<key_t, ranking_t> mapRankings;
+
+    uint64_t nHits;
+    uint64_t nMisses;
+
+public:
+    CMasternodeRankCache() : nHits(0), nMisses(0) {}
+
+    /// Return the ranking for the key if it is cached and still fresh at nNow, NULL otherwise
+    const ranking_t* Get(const uint256& blockHash, int nMinProtocol, filter_t filter, int64_t nNow);
+    /// Store a ranking, evicting the oldest one when full, and return the stored copy
+    const ranking_t& Insert(const uint256& blockHash, int nMinProtocol, filter_t filter, ranking_t& ranking);
+
+    void Clear() { mapRankings.clear(); }
+
+    size_t size() const { return mapRankings.size(); }
+    uint64_t GetHits() const { return nHits; }
+    uint64_t GetMisses() const { return nMisses; }
+};
+
+struct CompareLastPaidBlock
+{
+    bool operator()(const std::pair<int, CMasternode*>& t1,
+                    const std::pair<int, CMasternode*>& t2) const
+    {
+        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
+    }
+};
+
 class CMasternodeMan
 {
 public:
@@ -98,8 +211,6 @@ private:
 
     static const int PPEG_UPDATE_SECONDS        = 3 * 60 * 60;
 
-    static const int LAST_PAID_SCAN_BLOCKS      = 100;
-
     static const int MIN_POSE_PROTO_VERSION     = 70203;
     static const int MAX_POSE_CONNECTIONS       = 10;
     static const int MAX_POSE_RANK              = 10;
@@ -111,15 +222,22 @@ private:
     static const int MNB_RECOVERY_WAIT_SECONDS      = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS     = 3 * 60 * 60;
 
-
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
     // Keep track of current block index
     const CBlockIndex *pCurrentBlockIndex;
 
-    // map to hold all MNs
-    std::vector<CMasternode> vMasternodes;
+    // map to hold all MNs, keyed by collateral outpoint; entries never move,
+    // so pointers returned by Find() stay valid until the entry is removed
+    std::map<COutPoint, CMasternode> mapMasternodes;
+    // lookup indexes into mapMasternodes, kept in sync by Add/Remove
+    boost::unordered_map<COutPoint, CMasternode*, CMasternodeKeyHasher> mapMasternodesByOutpoint;
+    // payee scripts and masternode pubkeys are not unique, several MNs may share one
+    boost::unordered_multimap<CScript, COutPoint, CMasternodeKeyHasher> mapMasternodesByPayee;
+    boost::unordered_multimap<CPubKey, COutPoint, CMasternodeKeyHasher> mapMasternodesByPubKey;
+    // payment queue order: oldest last paid block first, ties broken by collateral outpoint
+    std::set<std::pair<int, CMasternode*>, CompareLastPaidBlock> setMasternodesByLastPaid;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -128,6 +246,8 @@ private:
     std::map<COutPoint, std::map<CNetAddr, int64_t> > mWeAskedForMasternodeListEntry;
     // who we asked for the masternode verification
     std::map<CNetAddr, CMasternodeVerification> mWeAskedForVerification;
+    // new broadcasts whose signatures are being checked on the signature queue
+    std::set<uint256> setMnbSigCheckPending;
 
     // these maps are used for masternode recovery from MASTERNODE_NEW_START_REQUIRED state
     std::map<uint256, std::pair< int64_t, std::set<CNetAddr> > > mMnbRecoveryRequests;
@@ -153,8 +273,39 @@ private:
 
     int64_t nLastWatchdogVoteTime;
 
+    /// Cached masternode rankings, must be cleared whenever entries are added, removed or re-checked
+    CMasternodeRankCache rankCache;
+
+    /// Bumped under cs whenever the list or one of its entries changes
+    std::atomic<int> nListVersion;
+    /// Last published snapshot, only accessed through std::atomic_load/std::atomic_store
+    CMasternodeListSnapshotRef listSnapshot;
+
     friend class CMasternodeSync;
 
+    /// Get (and cache) the ranking of masternodes for a block
+    const CMasternodeRankCache::ranking_t& GetRanking(const uint256& blockHash, int nMinProtocol, CMasternodeRankCache::filter_t filter);
+
+    /// Insert/remove an entry of mapMasternodes into/from the lookup indexes
+    void AddToIndexes(CMasternode& mn);
+    void RemoveFromIndexes(const CMasternode& mn);
+    /// Rebuild all lookup indexes from mapMasternodes
+    void RebuildIndexes();
+    /// Re-index an entry whose pubKeyMasternode may have changed from pubKeyMasternodeOld
+    void UpdatePubKeyIndex(CMasternode& mn, const CPubKey& pubKeyMasternodeOld);
+    /// Re-index an entry whose last paid block may have changed from nBlockLastPaidOld
+    void UpdateLastPaidIndex(CMasternode& mn, int nBlockLastPaidOld);
+    /// Pick the first entry in mapMasternodes order among several index matches
+    template<typename Iterator>
+    CMasternode* FindFirst(Iterator itBegin, Iterator itEnd);
+
+    /// Entries were added, removed or re-checked, drop cached rankings and the list snapshot
+    void ListChanged() { rankCache.Clear(); ++nListVersion; }
+    /// Fields of an entry that don't affect rankings were updated, drop the list snapshot
+    void EntryChanged() { ++nListVersion; }
+    /// Build a new snapshot if the list changed since the last one, cs must be held
+    void PublishSnapshot();
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, std::pair<int64_t, CMasternodeBroadcast> > mapSeenMasternodeBroadcast;
@@ -180,7 +331,22 @@ public:
             READWRITE(strVersion);
         }
 
-        READWRITE(vMasternodes);
+        // stored as a plain vector, as it was before the list was indexed
+        std::vector<CMasternode> vecMasternodes;
+        if(!ser_action.ForRead()) {
+            vecMasternodes.reserve(mapMasternodes.size());
+            for (const auto& mnpair : mapMasternodes) {
+                vecMasternodes.push_back(mnpair.second);
+            }
+        }
+        READWRITE(vecMasternodes);
+        if(ser_action.ForRead()) {
+            mapMasternodes.clear();
+            for (const auto& mn : vecMasternodes) {
+                mapMasternodes.insert(std::make_pair(mn.vin.prevout, mn));
+            }
+            RebuildIndexes();
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -293,7 +459,9 @@ public:
     /// Find a random entry
     masternode_info_t FindRandomNotInVec(const std::vector<CTxIn> &vecToExclude, int nProtocolVersion = -1);
 
-    std::vector<CMasternode> GetFullMasternodeVector() { return vMasternodes; }
+    std::vector<CMasternode> GetFullMasternodeVector();
+    /// Get a read-only copy of the list, shared with other readers until the list changes
+    CMasternodeListSnapshotRef GetMasternodeListSnapshot();
 
     std::vector<std::pair<int, CMasternode> > GetMasternodeRanks(int nBlockHeight = -1, int nMinProtocol=0);
     int GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nMinProtocol=0, bool fOnlyActive=true);
@@ -312,7 +480,7 @@ public:
     void ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerification& mnv);
 
     /// Return the number of (unique) Masternodes
-    int size() { return vMasternodes.size(); }
+    int size() { return mapMasternodes.size(); }
 
     std::string ToString() const;
 
@@ -320,10 +488,22 @@ public:
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
     /// Perform complete check and only then update list and maps
     bool CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBroadcast mnb, int& nDos);
+    /// Queue the signatures of a new broadcast for verification, returns false if it should be processed right away
+    bool CheckMnbSignaturesAsync(CNode* pfrom, const CMasternodeBroadcast& mnb);
+    /// Continue processing a broadcast from pfrom once its signatures were checked on the signature queue
+    void MnbSignaturesChecked(CNode* pfrom, CMasternodeBroadcast mnb, const std::vector<CMessageSigCheck>& vChecks);
+    /// Queue the signature of a new ping for verification, returns false if it should be processed right away
+    bool CheckMnpSignatureAsync(CNode* pfrom, const CMasternodePing& mnp);
+    /// Continue processing a ping from pfrom once its signature was checked on the signature queue
+    void MnpSignatureChecked(CNode* pfrom, CMasternodePing mnp, const std::vector<CMessageSigCheck>& vChecks);
+    /// Update the masternode list with a new ping from pfrom
+    void ProcessMasternodePing(CNode* pfrom, CMasternodePing& mnp);
     bool IsMnbRecoveryRequested(const uint256& hash) { return mMnbRecoveryRequests.count(hash); }
 
     void UpdateLastPaid();
     bool UpdateLastDsq(const CTxIn& vin);
+    /// The masternode used up its mixing transaction, it needs a new dsq to send another one
+    void DisallowMixing(const CTxIn& vin);
 
     void CheckAndRebuildMasternodeIndex();
 
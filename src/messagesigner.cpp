@@ -5,11 +5,100 @@
 
 #include "base58.h"
 #include "hash.h"
+#include "memusage.h"
+#include "random.h"
 #include "validation.h" // For strMessageMagic
 #include "messagesigner.h"
 #include "tinyformat.h"
+#include "util.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
+
+namespace {
+
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ */
+class CHashSignatureCacheHasher
+{
+public:
+    size_t operator()(const uint256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Valid hash signature cache, modelled on the script signature cache. Masternode
+ * pings, payment votes, governance votes etc are relayed by many peers and are
+ * checked again on recovery and orphan reprocessing, each check being a full
+ * public key recovery.
+ */
+class CHashSignatureCache
+{
+private:
+    //! Entries are SHA256(nonce || signed hash || public key || signature):
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CHashSignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_sigcache;
+
+public:
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    CHashSignatureCache() : nHits(0), nMisses(0)
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.count(entry);
+    }
+
+    void Set(const uint256& entry)
+    {
+        size_t nMaxCacheSize = GetArg("-maxmsgsigcachesize", DEFAULT_MAX_MESSAGE_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
+        {
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s)) {
+                setValid.erase(*it);
+            }
+        }
+
+        setValid.insert(entry);
+    }
+
+    void GetSize(size_t& nEntries, size_t& nUsage)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nEntries = setValid.size();
+        nUsage = memusage::DynamicUsage(setValid);
+    }
+};
+
+CHashSignatureCache hashSignatureCache;
+
+}
+
 bool CMessageSigner::GetKeysFromSecret(const std::string strSecret, CKey& keyRet, CPubKey& pubkeyRet)
 {
     CBitcoinSecret vchSecret;
@@ -47,6 +136,14 @@ bool CHashSigner::SignHash(const uint256& hash, const CKey key, std::vector<unsi
 
 bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
+    uint256 entry;
+    hashSignatureCache.ComputeEntry(entry, hash, vchSig, pubkey);
+    if(hashSignatureCache.Get(entry)) {
+        ++hashSignatureCache.nHits;
+        return true;
+    }
+    ++hashSignatureCache.nMisses;
+
     CPubKey pubkeyFromSig;
     if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
         strErrorRet = "Error recovering public key.";
@@ -60,5 +157,15 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey pubkey, const st
         return false;
     }
 
+    hashSignatureCache.Set(entry);
     return true;
 }
+
+CHashSignatureCacheStats CHashSigner::GetCacheStats()
+{
+    CHashSignatureCacheStats stats;
+    stats.nHits = hashSignatureCache.nHits;
+    stats.nMisses = hashSignatureCache.nMisses;
+    hashSignatureCache.GetSize(stats.nEntries, stats.nUsage);
+    return stats;
+}
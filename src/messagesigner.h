@@ -8,6 +8,18 @@
 
 #include "key.h"
 
+/** Default for -maxmsgsigcachesize, the size of the cache of valid hash signatures in megabytes */
+static const unsigned int DEFAULT_MAX_MESSAGE_SIG_CACHE_SIZE = 8;
+
+/** Usage statistics of the CHashSigner::VerifyHash cache */
+struct CHashSignatureCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    size_t nEntries;
+    size_t nUsage;
+};
+
 /** Helper class for signing messages and checking their signatures
  */
 class CMessageSigner
@@ -29,7 +41,10 @@ public:
     /// Sign the hash, returns true if successful
     static bool SignHash(const uint256& hash, const CKey key, std::vector<unsigned char>& vchSigRet);
     /// Verify the hash signature, returns true if succcessful
+    /// Valid signatures are cached, so repeated checks of the same signed hash are cheap
     static bool VerifyHash(const uint256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
+    /// Return the hit/miss counters and size of the signature cache
+    static CHashSignatureCacheStats GetCacheStats();
 };
 
 #endif
@@ -0,0 +1,129 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messagesigqueue.h"
+#include "hash.h"
+#include "messagesigner.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+CMessageSigQueue messageSigQueue;
+
+bool CMessageSigCheck::operator()()
+{
+    std::string strError;
+    fValid = CMessageSigner::VerifyMessage(pubkey, vchSig, strMessage, strError);
+    return fValid;
+}
+
+uint256 CCheckedSignature::GetHash(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << pubkey << vchSig << strMessage;
+    return ss.GetHash();
+}
+
+void CCheckedSignature::Set(const CMessageSigCheck& check)
+{
+    hash = GetHash(check.pubkey, check.vchSig, check.strMessage);
+    fValid = check.fValid;
+}
+
+bool CCheckedSignature::Verify(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSig, const std::string& strMessage, std::string& strErrorRet) const
+{
+    if(hash.IsNull() || hash != GetHash(pubkeyIn, vchSig, strMessage)) {
+        return CMessageSigner::VerifyMessage(pubkeyIn, vchSig, strMessage, strErrorRet);
+    }
+    if(!fValid) {
+        strErrorRet = "signature verification failed";
+    }
+    return fValid;
+}
+
+void CMessageSigQueue::Process(CBatch& batch)
+{
+    for(size_t i = 0; i < batch.vChecks.size(); ++i) {
+        batch.vChecks[i]();
+    }
+    batch.callback(batch.vChecks);
+}
+
+void CMessageSigQueue::Thread()
+{
+    RenameThread("pura-sigcheck");
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        ++nWorkers;
+        condProgress.notify_all();
+    }
+    try {
+        while(true) {
+            CBatch batch;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while(queue.empty()) {
+                    condWorker.wait(lock);
+                }
+                batch = std::move(queue.front());
+                queue.pop_front();
+                ++nBusy;
+            }
+            try {
+                Process(batch);
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "pura-sigcheck");
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                --nBusy;
+                condProgress.notify_all();
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        --nWorkers;
+        throw;
+    }
+}
+
+bool CMessageSigQueue::Add(const std::vector<CMessageSigCheck>& vChecks, const callback_t& callback)
+{
+    CBatch batch;
+    batch.vChecks = vChecks;
+    batch.callback = callback;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if(nWorkers > 0) {
+            if(queue.size() >= nMaxQueueSize) return false;
+            queue.push_back(std::move(batch));
+            condWorker.notify_one();
+            return true;
+        }
+    }
+    Process(batch);
+    return true;
+}
+
+size_t CMessageSigQueue::size()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queue.size();
+}
+
+void CMessageSigQueue::WaitForWorkers(int nCount)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(nWorkers < nCount) {
+        condProgress.wait(lock);
+    }
+}
+
+void CMessageSigQueue::Flush()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(!queue.empty() || nBusy > 0) {
+        condProgress.wait(lock);
+    }
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MESSAGESIGQUEUE_H
+#define MESSAGESIGQUEUE_H
+
+#include "pubkey.h"
+#include "uint256.h"
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CMessageSigQueue;
+
+extern CMessageSigQueue messageSigQueue;
+
+/** Default number of message signature verification threads, 0 verifies on the message handler thread */
+static const int DEFAULT_MESSAGE_SIGCHECK_THREADS = 2;
+/** Maximum number of message signature verification threads */
+static const int MAX_MESSAGE_SIGCHECK_THREADS = 16;
+
+/** A message signature to verify, see CMessageSigner::VerifyMessage */
+class CMessageSigCheck
+{
+public:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+    bool fValid;
+
+    CMessageSigCheck() : fValid(false) {}
+    CMessageSigCheck(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn) :
+        pubkey(pubkeyIn), vchSig(vchSigIn), strMessage(strMessageIn), fValid(false) {}
+
+    bool operator()();
+};
+
+/**
+ * Result of a signature check done on the signature queue, kept with the message
+ * (not serialized) so that it passes the usual checks without being verified again.
+ * The result only applies to the key, signature and message it was verified with.
+ */
+class CCheckedSignature
+{
+private:
+    //! Hash of the key, signature and message that were checked, null if none
+    uint256 hash;
+    bool fValid;
+
+    static uint256 GetHash(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage);
+
+public:
+    CCheckedSignature() : hash(), fValid(false) {}
+
+    void Set(const CMessageSigCheck& check);
+
+    /// Verify the message signature unless the same one was already checked against the same key
+    bool Verify(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSig, const std::string& strMessage, std::string& strErrorRet) const;
+};
+
+/**
+ * Queue for message signatures (masternode announcements, payment votes etc) to be
+ * verified away from the message handler thread.
+ *
+ * Modelled after CCheckQueue, but the thread adding a batch of checks doesn't
+ * wait for them: the worker thread which verified a batch hands the results to
+ * the batch's callback, without holding any locks. When too much work is queued
+ * up already the batch is refused and the caller drops the message, the caller
+ * only verifies batches itself if no worker threads were configured at all.
+ *
+ * Used for masternode announcements and pings, payment votes, InstaPay lock
+ * votes and governance votes.
+ */
+class CMessageSigQueue
+{
+public:
+    typedef std::function<void(const std::vector<CMessageSigCheck>&)> callback_t;
+
+private:
+    struct CBatch
+    {
+        std::vector<CMessageSigCheck> vChecks;
+        callback_t callback;
+    };
+
+    //! Maximum number of batches waiting for a worker
+    size_t nMaxQueueSize;
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Notified when a worker starts and when it finished a batch
+    boost::condition_variable condProgress;
+
+    //! Batches waiting to be verified, in order of arrival
+    std::deque<CBatch> queue;
+
+    //! The number of worker threads
+    int nWorkers;
+
+    //! The number of batches taken off the queue and not done yet
+    int nBusy;
+
+    static void Process(CBatch& batch);
+
+public:
+    static const size_t DEFAULT_MAX_QUEUE_SIZE = 10000;
+
+    CMessageSigQueue(size_t nMaxQueueSizeIn = DEFAULT_MAX_QUEUE_SIZE) : nMaxQueueSize(nMaxQueueSizeIn), nWorkers(0), nBusy(0) {}
+
+    //! Worker thread
+    void Thread();
+
+    /**
+     * Verify a batch of signatures, callback is invoked with the results once done.
+     * Returns false without invoking the callback if the queue is full.
+     */
+    bool Add(const std::vector<CMessageSigCheck>& vChecks, const callback_t& callback);
+
+    size_t size();
+
+    //! Wait until at least nCount worker threads are running
+    void WaitForWorkers(int nCount);
+
+    //! Wait until the batches queued so far are verified and their callbacks returned
+    void Flush();
+};
+
+#endif
@@ -7,14 +7,19 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
+#include "txmempool.h"
 
 #include <stdint.h>
+#include <memory>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
 
 class CBlockIndex;
 class CChainParams;
 class CConnman;
 class CReserveKey;
-class CScript;
 class CWallet;
 namespace Consensus { struct Params; };
 
@@ -22,6 +27,10 @@ static const bool DEFAULT_GENERATE = false;
 static const int DEFAULT_GENERATE_THREADS = 1;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -blocktemplatemaxstaleness, in seconds */
+static const int64_t DEFAULT_BLOCK_TEMPLATE_MAX_STALENESS = 30;
+/** Incremental template updates between two that are checked with TestBlockValidity */
+static const unsigned int BLOCK_TEMPLATE_VALIDATE_INTERVAL = 10;
 
 struct CBlockTemplate
 {
@@ -30,8 +39,240 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
-/** Run the miner threads */
+// Container for tracking updates to ancestor feerate as we include (parent)
+// transactions in a block
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    int64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    int64_t nSigOpCountWithAncestors;
+};
+
+/** Comparator for CTxMemPool::txiter objects.
+ *  It simply compares the internal memory address of the CTxMemPoolEntry object
+ *  pointed to. This means it has no meaning, and is only useful for using them
+ *  as key in other indexes.
+ */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
+// except operating on CTxMemPoolModifiedEntry.
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
+
+// A comparator that sorts transactions based on number of ancestors.
+// This is sufficient to sort an ancestor package in an order that is valid
+// to appear in a block.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+// Sorts transactions by the ancestor feerate cached in the mempool
+struct CompareTxIterByAncestorFee {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::nth_index<1>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+/** Generate a new block, without valid proof-of-work */
+class BlockAssembler
+{
+private:
+    // The constructed block template
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    // A convenience pointer that always refers to the CBlock in pblocktemplate
+    CBlock* pblock;
+
+    // Configuration parameters for the block size
+    unsigned int nBlockMaxSize, nBlockMinSize, nBlockPrioritySize;
+    bool fPackageSelection;
+    bool fPrintPriority;
+
+    // Information on the current status of the block
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+
+    // Chain context for the block
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    const CChainParams& chainparams;
+    CTxMemPool& pool;
+
+    // Variables used for addScoreTxs and addPriorityTxs
+    int lastFewTxs;
+    bool blockFinished;
+
+public:
+    /** fPackageSelection chooses between ancestor feerate (package) selection
+     *  and the legacy per-transaction score selection. */
+    BlockAssembler(const CChainParams& chainparams, CTxMemPool& poolIn, bool fPackageSelectionIn = true);
+    /** Construct a new block template with coinbase to scriptPubKeyIn */
+    CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Take over a template built by CreateNewBlock on the current tip and
+     *  bring it up to date with the mempool: drop transactions that left it,
+     *  add packages for transactions that entered it at or after nTimeSince
+     *  (or for every transaction not in the template, if any were dropped)
+     *  and re-split the coinbase for the new fees.  Unlike CreateNewBlock this
+     *  neither selects payees again nor runs TestBlockValidity. */
+    CBlockTemplate* UpdateBlock(CBlockTemplate* pblocktemplateIn, int64_t nTimeSince);
+    /** Start a new template (with a placeholder coinbase) and fill it with
+     *  transactions from the mempool, without finishing or validating it. */
+    void AddTransactions(int nHeightIn, int64_t nLockTimeCutoffIn);
+
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    uint64_t GetBlockTx() const { return nBlockTx; }
+    CAmount GetFees() const { return nFees; }
+
+private:
+    // utility functions
+    /** Clear the block's state and prepare for assembling a new block */
+    void resetBlock();
+    /** Add a tx to the block */
+    void AddToBlock(CTxMemPool::txiter iter);
+
+    // Methods for how to add transactions to a block.
+    /** Add transactions based on modified feerate */
+    void addScoreTxs();
+    /** Add transactions based on tx "priority" */
+    void addPriorityTxs();
+    /** Add transactions based on feerate including unconfirmed ancestors */
+    void addPackageTxs();
+
+    // helper function for addScoreTxs and addPriorityTxs
+    /** Test if tx will still "fit" in the block */
+    bool TestForBlock(CTxMemPool::txiter iter);
+    /** Test if tx still has unconfirmed parents not yet in block */
+    bool isStillDependent(CTxMemPool::txiter iter);
+
+    // helper functions for addPackageTxs()
+    /** Remove confirmed (inBlock) entries from given set */
+    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
+    /** Test if a new package would "fit" in the block */
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps);
+    /** Test if a set of transactions are all final */
+    bool TestPackageFinality(const CTxMemPool::setEntries& package);
+    /** Return true if given transaction from mapTx has already been evaluated
+      * or included in the block. */
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
+    /** Sort the package in an order that is valid to appear in a block */
+    void SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries);
+    /** Add descendants of given transactions to mapModifiedTx with ancestor
+      * state updated assuming given transactions are inBlock. */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+};
+
+/** Keeps the last block template handed out by getblocktemplate.  As long as
+ *  the tip does not change, mempool changes are applied to it incrementally;
+ *  it is only rebuilt from scratch for a new tip, another coinbase script, or
+ *  once the last full rebuild is older than -blocktemplatemaxstaleness
+ *  seconds.  Every BLOCK_TEMPLATE_VALIDATE_INTERVAL-th incremental update,
+ *  and every one with -checkblockindex, is checked with TestBlockValidity; a
+ *  template failing it is rebuilt from scratch.  Must be used with cs_main
+ *  held.
+ */
+class CBlockTemplateBuilder
+{
+private:
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    CScript scriptPubKey;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nTimeFullRebuild;
+    int64_t nTimeLastUpdate;
+    unsigned int nUpdatesUnchecked;
+
+    uint64_t nFullRebuilds;
+    uint64_t nIncrementalUpdates;
+
+public:
+    CBlockTemplateBuilder();
+
+    /** Return an up to date template on the current tip paying to
+     *  scriptPubKeyIn, or NULL if none could be created.  The template stays
+     *  owned by the builder and is valid until the next call. */
+    CBlockTemplate* GetBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+    /** Mempool counter the current template reflects */
+    unsigned int GetTransactionsUpdated() const { return nTransactionsUpdatedLast; }
+
+    uint64_t GetFullRebuilds() const { return nFullRebuilds; }
+    uint64_t GetIncrementalUpdates() const { return nIncrementalUpdates; }
+};
+
+/** Run the miner threads, each searching its own slice of the nonce space */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams, CConnman& connman);
+/** Combined hash rate of the miner threads over the last few seconds */
+double GetMinerHashesPerSec();
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
 /** Modify the extranonce in a block */
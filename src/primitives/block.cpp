@@ -15,6 +15,16 @@ uint256 CBlockHeader::GetHash() const
     return HashX11(BEGIN(nVersion), END(nNonce));
 }
 
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& vHashesRet)
+{
+    vHashesRet.resize(headers.size());
+    if (headers.empty())
+        return;
+    const CBlockHeader& first = headers[0];
+    HashX11Many((const unsigned char*)BEGIN(first.nVersion), END(first.nNonce) - BEGIN(first.nVersion),
+                sizeof(CBlockHeader), headers.size(), &vHashesRet[0]);
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -69,6 +69,9 @@ public:
     }
 };
 
+/** Compute the hashes of a run of headers, see HashX11Many(). */
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& vHashesRet);
+
 
 class CBlock : public CBlockHeader
 {
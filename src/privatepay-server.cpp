@@ -121,8 +121,7 @@ void CPrivatePayServer::ProcessMessage(CNode* pfrom, std::string& strCommand, CD
                 return;
             }
             mnodeman.nDsqCount++;
-            pmn->nLastDsq = mnodeman.nDsqCount;
-            pmn->fAllowMixingTx = true;
+            if(!mnodeman.UpdateLastDsq(dsq.vin)) return;
 
             LogPrint("privatepay", "PPQUEUE -- new PrivatePay queue (%s) from masternode %s\n", dsq.ToString(), pmn->addr.ToString());
             vecPrivatepayQueue.push_back(dsq);
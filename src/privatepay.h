@@ -325,7 +325,7 @@ private:
 
 public:
     static void InitStandardDenominations();
-    static std::vector<CAmount> GetStandardDenominations() { return vecStandardDenominations; }
+    static const std::vector<CAmount>& GetStandardDenominations() { return vecStandardDenominations; }
     static CAmount GetSmallestDenomination() { return vecStandardDenominations.back(); }
 
     /// Get the denominations for a specific amount of pura.
@@ -10,6 +10,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "indexbuilder.h"
 #include "consensus/validation.h"
 #include "validation.h"
 #include "policy/policy.h"
@@ -980,6 +981,46 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getindexinfo\n"
+            "\nReturns the state of the optional indexes, and how far those being built in the background have got.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                  (object) txindex, addressindex, spentindex or timestampindex\n"
+            "    \"enabled\": true|false,   (boolean) if the index is up to date and can be used\n"
+            "    \"building\": true|false,  (boolean) if the index is being built in the background\n"
+            "    \"height\": xxxxx,         (numeric) the last block the index has the entries of\n"
+            "    \"progress\": xxxx,        (numeric) estimate of build progress [0..1]\n"
+            "    \"blocks\": xxxxx,         (numeric) blocks added by the builder since it was started\n"
+            "    \"blockspersecond\": xxxx, (numeric) how fast the builder adds blocks\n"
+            "    \"error\": \"xxxx\"        (string, optional) why the build stopped\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    std::vector<CIndexBuildInfo> vInfo = GetIndexBuildInfo();
+    for (std::vector<CIndexBuildInfo>::const_iterator it = vInfo.begin(); it != vInfo.end(); ++it) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("enabled", it->fEnabled));
+        obj.push_back(Pair("building", it->fBuilding));
+        obj.push_back(Pair("height", it->nHeight));
+        obj.push_back(Pair("progress", it->dProgress));
+        obj.push_back(Pair("blocks", it->nBlocksBuilt));
+        obj.push_back(Pair("blockspersecond", it->dBlocksPerSecond));
+        if (!it->strError.empty())
+            obj.push_back(Pair("error", it->strError));
+        ret.push_back(Pair(it->strName, obj));
+    }
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
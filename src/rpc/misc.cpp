@@ -7,6 +7,8 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "instapay.h"
+#include "messagesigner.h"
 #include "init.h"
 #include "validation.h"
 #include "net.h"
@@ -180,6 +182,83 @@ UniValue mnsync(const UniValue& params, bool fHelp)
     return "failure";
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns statistics of the cache of valid masternode, governance and InstaPay message signatures.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": n,     (numeric) number of cached signatures\n"
+            "  \"usage\": n,       (numeric) memory used by the cache in bytes\n"
+            "  \"hits\": n,        (numeric) signature checks answered by the cache since startup\n"
+            "  \"misses\": n       (numeric) signature checks which needed a public key recovery since startup\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    CHashSignatureCacheStats stats = CHashSigner::GetCacheStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("entries", (uint64_t)stats.nEntries));
+    obj.push_back(Pair("usage", (uint64_t)stats.nUsage));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    return obj;
+}
+
+UniValue getinstapayinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getinstapayinfo\n"
+            "Returns the time it took accepted InstaPay lock requests to get locked since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"locks\": n,          (numeric) number of completed locks\n"
+            "  \"average_ms\": n,     (numeric) average time from lock request to lock in milliseconds\n"
+            "  \"max_ms\": n,         (numeric) slowest lock in milliseconds\n"
+            "  \"p50_ms\": n,         (numeric) half of the locks took less than this, -1 if more than the largest bucket,\n"
+            "                        omitted until there are locks\n"
+            "  \"p90_ms\": n,         (numeric) same for 90% of the locks\n"
+            "  \"p99_ms\": n,         (numeric) same for 99% of the locks\n"
+            "  \"histogram\": [       (array) number of locks per latency bucket\n"
+            "    {\n"
+            "      \"below_ms\": n,   (numeric) upper bound of the bucket in milliseconds, -1 for the last one\n"
+            "      \"count\": n       (numeric) number of locks in the bucket\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getinstapayinfo", "")
+            + HelpExampleRpc("getinstapayinfo", "")
+        );
+
+    CTxLockLatencyStats stats = instapay.GetLockLatencyStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("locks", stats.GetCount()));
+    obj.push_back(Pair("average_ms", stats.GetAverageMicros() / 1000));
+    obj.push_back(Pair("max_ms", stats.GetMaxMicros() / 1000));
+    int64_t nMillis;
+    if (stats.GetPercentileMillis(0.5, nMillis))
+        obj.push_back(Pair("p50_ms", nMillis));
+    if (stats.GetPercentileMillis(0.9, nMillis))
+        obj.push_back(Pair("p90_ms", nMillis));
+    if (stats.GetPercentileMillis(0.99, nMillis))
+        obj.push_back(Pair("p99_ms", nMillis));
+    UniValue histogram(UniValue::VARR);
+    for (int i = 0; i < CTxLockLatencyStats::BUCKETS; i++) {
+        UniValue bucket(UniValue::VOBJ);
+        bucket.push_back(Pair("below_ms", CTxLockLatencyStats::GetBucketLimitMillis(i)));
+        bucket.push_back(Pair("count", stats.GetBucketCount(i)));
+        histogram.push_back(bucket);
+    }
+    obj.push_back(Pair("histogram", histogram));
+    return obj;
+}
+
 #ifdef ENABLE_WALLET
 class DescribeAddressVisitor : public boost::static_visitor<UniValue>
 {
@@ -584,6 +663,95 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+/**
+ * Read "limit" and "cursor" of an address index request. Paged requests get
+ * at most limit entries per call; others may read up to -addressindexmaxresults
+ * entries, which is also the largest allowed limit.
+ */
+static size_t getAddressIndexLimit(const UniValue& params, bool& fPaged, std::string& strCursor)
+{
+    const int64_t nMaxResults = std::max((int64_t)1, GetArg("-addressindexmaxresults", DEFAULT_ADDRESSINDEX_MAX_RESULTS));
+    fPaged = false;
+    strCursor.clear();
+    if (!params[0].isObject())
+        return nMaxResults;
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (limitValue.isNull()) {
+        if (!cursorValue.isNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "A cursor can only be used along with a limit");
+        return nMaxResults;
+    }
+
+    int64_t nLimit = limitValue.get_int64();
+    if (nLimit < 1 || nLimit > nMaxResults)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Limit must be between 1 and %d", nMaxResults));
+    if (!cursorValue.isNull())
+        strCursor = cursorValue.get_str();
+    fPaged = true;
+    return nLimit;
+}
+
+static void throwAddressIndexLimit(size_t nLimit)
+{
+    throw JSONRPCError(RPC_INVALID_REQUEST, strprintf("More than %u results, use \"limit\" and \"cursor\" to page through them", nLimit));
+}
+
+static bool isKeyOfAddress(const CAddressIndexKey& key, const std::pair<uint160, int>& address)
+{
+    return key.hashBytes == address.first && key.type == (unsigned int)address.second;
+}
+
+static bool isKeyOfAddress(const CAddressUnspentKey& key, const std::pair<uint160, int>& address)
+{
+    return key.hashBytes == address.first && key.type == (unsigned int)address.second;
+}
+
+static bool isKeyOfAddress(const CMempoolAddressDeltaKey& key, const std::pair<uint160, int>& address)
+{
+    return key.addressBytes == address.first && key.type == address.second;
+}
+
+/** The cursor is the position of the address in the request and the last index key returned */
+template <typename Key>
+static std::string encodeAddressIndexCursor(size_t nAddress, const Key& key)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint32_t)nAddress << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template <typename Key>
+static size_t decodeAddressIndexCursor(const std::string& strCursor, const std::vector<std::pair<uint160, int> > &addresses, Key& key)
+{
+    uint32_t nAddress = 0;
+    if (IsHex(strCursor)) {
+        std::vector<unsigned char> vch(ParseHex(strCursor));
+        CDataStream ss(vch, SER_NETWORK, PROTOCOL_VERSION);
+        try {
+            ss >> nAddress >> key;
+            if (ss.empty() && nAddress < addresses.size() && isKeyOfAddress(key, addresses[nAddress]))
+                return nAddress;
+        } catch (const std::exception&) {
+        }
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+}
+
+/** Paged requests get their entries under strName, along with the cursor for the next page if there is one */
+static UniValue addressIndexPage(const std::string& strName, const UniValue& entries, bool fPaged, const std::string& strNextCursor)
+{
+    if (!fPaged)
+        return entries;
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair(strName, entries));
+    if (!strNextCursor.empty())
+        result.push_back(Pair("cursor", strNextCursor));
+    return result;
+}
+
 UniValue getaddressmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -597,8 +765,10 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"limit\"  (number, optional) Return at most this many index entries per call, in index order\n"
+            "  \"cursor\"  (string, optional) Where to continue, as returned by the previous call\n"
             "}\n"
-            "\nResult:\n"
+            "\nResult (without limit, or under \"deltas\" next to the \"cursor\" for the next page):\n"
             "[\n"
             "  {\n"
             "    \"address\"  (string) The base58check encoded address\n"
@@ -621,13 +791,36 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    bool fPaged;
+    std::string strCursor;
+    size_t nLimit = getAddressIndexLimit(params, fPaged, strCursor);
+
+    CMempoolAddressDeltaKey keyAfter(0, uint160());
+    size_t nFirst = strCursor.empty() ? 0 : decodeAddressIndexCursor(strCursor, addresses, keyAfter);
+
     std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > indexes;
+    size_t nCursorAddress = 0;
 
-    if (!mempool.getAddressIndex(addresses, indexes)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    for (size_t i = nFirst; i < addresses.size() && indexes.size() <= nLimit; i++) {
+        size_t nBefore = indexes.size();
+        std::vector<std::pair<uint160, int> > address(1, addresses[i]);
+        if (!mempool.getAddressIndex(address, indexes, (i == nFirst && !strCursor.empty()) ? &keyAfter : NULL, nLimit + 1 - nBefore)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (nBefore < nLimit && indexes.size() >= nLimit)
+            nCursorAddress = i;
+    }
+
+    std::string strNextCursor;
+    if (indexes.size() > nLimit) {
+        if (!fPaged)
+            throwAddressIndexLimit(nLimit);
+        indexes.erase(indexes.begin() + nLimit, indexes.end());
+        strNextCursor = encodeAddressIndexCursor(nCursorAddress, indexes.back().first);
     }
 
-    std::sort(indexes.begin(), indexes.end(), timestampSort);
+    if (!fPaged)
+        std::sort(indexes.begin(), indexes.end(), timestampSort);
 
     UniValue result(UniValue::VARR);
 
@@ -652,7 +845,7 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp)
         result.push_back(delta);
     }
 
-    return result;
+    return addressIndexPage("deltas", result, fPaged, strNextCursor);
 }
 
 UniValue getaddressutxos(const UniValue& params, bool fHelp)
@@ -668,8 +861,10 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"limit\"  (number, optional) Return at most this many index entries per call, in index order\n"
+            "  \"cursor\"  (string, optional) Where to continue, as returned by the previous call\n"
             "}\n"
-            "\nResult\n"
+            "\nResult (without limit, or under \"utxos\" next to the \"cursor\" for the next page)\n"
             "[\n"
             "  {\n"
             "    \"address\"  (string) The address base58check encoded\n"
@@ -691,15 +886,36 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    bool fPaged;
+    std::string strCursor;
+    size_t nLimit = getAddressIndexLimit(params, fPaged, strCursor);
+
+    CAddressUnspentKey keyAfter;
+    size_t nFirst = strCursor.empty() ? 0 : decodeAddressIndexCursor(strCursor, addresses, keyAfter);
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    size_t nCursorAddress = 0;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
+    for (size_t i = nFirst; i < addresses.size() && unspentOutputs.size() <= nLimit; i++) {
+        size_t nBefore = unspentOutputs.size();
+        if (!GetAddressUnspent(addresses[i].first, addresses[i].second, unspentOutputs,
+                               (i == nFirst && !strCursor.empty()) ? &keyAfter : NULL, nLimit + 1 - nBefore)) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
+        if (nBefore < nLimit && unspentOutputs.size() >= nLimit)
+            nCursorAddress = i;
+    }
+
+    std::string strNextCursor;
+    if (unspentOutputs.size() > nLimit) {
+        if (!fPaged)
+            throwAddressIndexLimit(nLimit);
+        unspentOutputs.erase(unspentOutputs.begin() + nLimit, unspentOutputs.end());
+        strNextCursor = encodeAddressIndexCursor(nCursorAddress, unspentOutputs.back().first);
     }
 
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+    if (!fPaged)
+        std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
 
     UniValue result(UniValue::VARR);
 
@@ -719,7 +935,7 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         result.push_back(output);
     }
 
-    return result;
+    return addressIndexPage("utxos", result, fPaged, strNextCursor);
 }
 
 UniValue getaddressdeltas(const UniValue& params, bool fHelp)
@@ -737,8 +953,10 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\"  (number, optional) Return at most this many index entries per call, in index order\n"
+            "  \"cursor\"  (string, optional) Where to continue, as returned by the previous call\n"
             "}\n"
-            "\nResult:\n"
+            "\nResult (without limit, or under \"deltas\" next to the \"cursor\" for the next page):\n"
             "[\n"
             "  {\n"
             "    \"satoshis\"  (number) The difference of satoshis\n"
@@ -774,18 +992,37 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    if (start <= 0 || end <= 0) {
+        start = 0;
+        end = 0;
+    }
+
+    bool fPaged;
+    std::string strCursor;
+    size_t nLimit = getAddressIndexLimit(params, fPaged, strCursor);
+
+    CAddressIndexKey keyAfter;
+    size_t nFirst = strCursor.empty() ? 0 : decodeAddressIndexCursor(strCursor, addresses, keyAfter);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    size_t nCursorAddress = 0;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
+    for (size_t i = nFirst; i < addresses.size() && addressIndex.size() <= nLimit; i++) {
+        size_t nBefore = addressIndex.size();
+        if (!GetAddressIndex(addresses[i].first, addresses[i].second, addressIndex, start, end,
+                             (i == nFirst && !strCursor.empty()) ? &keyAfter : NULL, nLimit + 1 - nBefore)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
+        if (nBefore < nLimit && addressIndex.size() >= nLimit)
+            nCursorAddress = i;
+    }
+
+    std::string strNextCursor;
+    if (addressIndex.size() > nLimit) {
+        if (!fPaged)
+            throwAddressIndexLimit(nLimit);
+        addressIndex.erase(addressIndex.begin() + nLimit, addressIndex.end());
+        strNextCursor = encodeAddressIndexCursor(nCursorAddress, addressIndex.back().first);
     }
 
     UniValue result(UniValue::VARR);
@@ -806,7 +1043,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         result.push_back(delta);
     }
 
-    return result;
+    return addressIndexPage("deltas", result, fPaged, strNextCursor);
 }
 
 UniValue getaddressbalance(const UniValue& params, bool fHelp)
@@ -827,6 +1064,7 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "{\n"
             "  \"balance\"  (string) The current balance in satoshis\n"
             "  \"received\"  (string) The total number of satoshis received (including change)\n"
+            "  \"txcount\"  (number) The number of transactions that received or spent from each address, added up\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"PUJGcM1BkZNDx94LHfsPvxstbB246UQEeg\"]}'")
@@ -839,27 +1077,24 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
-
     CAmount balance = 0;
     CAmount received = 0;
+    int64_t txcount = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue addressBalance;
+        if (!GetAddressBalance((*it).first, (*it).second, addressBalance)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+        balance += addressBalance.balance;
+        received += addressBalance.received;
+        txcount += addressBalance.txCount;
     }
 
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
     result.push_back(Pair("received", received));
+    result.push_back(Pair("txcount", txcount));
 
     return result;
 
@@ -880,8 +1115,12 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\"  (number, optional) Return at most this many index entries per call, in index order\n"
+            "  \"cursor\"  (string, optional) Where to continue, as returned by the previous call\n"
             "}\n"
-            "\nResult:\n"
+            "\nWith a limit, a transaction involving several of the addresses is listed once per page,\n"
+            "but can be listed again on a later page.\n"
+            "\nResult (without limit, or under \"txids\" next to the \"cursor\" for the next page):\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
@@ -908,18 +1147,53 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
+    if (start <= 0 || end <= 0) {
+        start = 0;
+        end = 0;
+    }
+
+    bool fPaged;
+    std::string strCursor;
+    size_t nLimit = getAddressIndexLimit(params, fPaged, strCursor);
+
+    CAddressIndexKey keyAfter;
+    size_t nFirst = strCursor.empty() ? 0 : decodeAddressIndexCursor(strCursor, addresses, keyAfter);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    size_t nCursorAddress = 0;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
+    for (size_t i = nFirst; i < addresses.size() && addressIndex.size() <= nLimit; i++) {
+        size_t nBefore = addressIndex.size();
+        if (!GetAddressIndex(addresses[i].first, addresses[i].second, addressIndex, start, end,
+                             (i == nFirst && !strCursor.empty()) ? &keyAfter : NULL, nLimit + 1 - nBefore)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (nBefore < nLimit && addressIndex.size() >= nLimit)
+            nCursorAddress = i;
+    }
+
+    std::string strNextCursor;
+    if (addressIndex.size() > nLimit) {
+        if (!fPaged)
+            throwAddressIndexLimit(nLimit);
+        addressIndex.erase(addressIndex.begin() + nLimit, addressIndex.end());
+        strNextCursor = encodeAddressIndexCursor(nCursorAddress, addressIndex.back().first);
+    }
+
+    if (fPaged) {
+        // Pages go through the addresses one after the other, so a transaction
+        // involving several of them is listed once per page, but can be listed
+        // again on a later page. Its deltas for one address are adjacent in index
+        // order, so the last txid of the previous page is left out here.
+        UniValue result(UniValue::VARR);
+        std::set<uint256> setTxids;
+        if (!strCursor.empty())
+            setTxids.insert(keyAfter.txhash);
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
+            if (setTxids.insert(it->first.txhash).second)
+                result.push_back(it->first.txhash.GetHex());
         }
+        return addressIndexPage("txids", result, fPaged, strNextCursor);
     }
 
     std::set<std::pair<int, std::string> > txids;
@@ -287,6 +287,7 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getblockheaders",        &getblockheaders,        true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
@@ -352,6 +353,8 @@ static const CRPCCommand vRPCCommands[] =
     { "pura",               "getsuperblockbudget",    &getsuperblockbudget,    true  },
     { "pura",               "voteraw",                &voteraw,                true  },
     { "pura",               "mnsync",                 &mnsync,                 true  },
+    { "pura",               "getsigcacheinfo",        &getsigcacheinfo,        true  },
+    { "pura",               "getinstapayinfo",        &getinstapayinfo,        true  },
     { "pura",               "spork",                  &spork,                  true  },
     { "pura",               "getpoolinfo",            &getpoolinfo,            true  },
     { "pura",               "sentinelping",           &sentinelping,           true  },
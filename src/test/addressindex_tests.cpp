@@ -0,0 +1,378 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "indexbuilder.h"
+#include "key.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test/test_pura.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static CAddressBalanceValue GetBalance(const CKeyID& keyID, bool fBalanceIndex)
+{
+    fAddressBalanceIndex = fBalanceIndex;
+    CAddressBalanceValue balance;
+    BOOST_CHECK(GetAddressBalance(keyID, 1, balance));
+    fAddressBalanceIndex = true;
+    return balance;
+}
+
+// The stored totals must always match what adding up the deltas gives
+static void CheckBalance(const CKeyID& keyID, CAmount nBalance, CAmount nReceived, int64_t nTxCount)
+{
+    CAddressBalanceValue balance = GetBalance(keyID, true);
+    BOOST_CHECK_EQUAL(balance.balance, nBalance);
+    BOOST_CHECK_EQUAL(balance.received, nReceived);
+    BOOST_CHECK_EQUAL(balance.txCount, nTxCount);
+
+    CAddressBalanceValue scanned = GetBalance(keyID, false);
+    BOOST_CHECK_EQUAL(scanned.balance, nBalance);
+    BOOST_CHECK_EQUAL(scanned.received, nReceived);
+    BOOST_CHECK_EQUAL(scanned.txCount, nTxCount);
+}
+
+static CMutableTransaction Spend(const COutPoint& prevout, const CScript& scriptPrev, const CKey& key, CAmount nValue, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPrev, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    if (scriptPrev.IsPayToPublicKeyHash())
+        tx.vin[0].scriptSig << ToByteVector(key.GetPubKey());
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_balance, TestChain100Setup)
+{
+    fAddressIndex = true;
+    fAddressBalanceIndex = true;
+
+    const CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    const CScript scriptP2PK = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CScript scriptP2PKH = GetScriptForDestination(keyID);
+    CheckBalance(keyID, 0, 0, 0);
+
+    // A coinbase paying to the address
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PKH);
+    CAmount nReward = block.vtx[0].vout[0].nValue;
+    CheckBalance(keyID, nReward, nReward, 1);
+
+    // A payment to it, along with another coinbase
+    CMutableTransaction payment = Spend(COutPoint(coinbaseTxns[0].GetHash(), 0), scriptP2PK, coinbaseKey, 11 * CENT, scriptP2PKH);
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, payment), scriptP2PKH);
+    nReward += block.vtx[0].vout[0].nValue;
+    CheckBalance(keyID, nReward + 11 * CENT, nReward + 11 * CENT, 3);
+
+    // Spending the payment back to the address with a fee
+    CMutableTransaction spend = Spend(COutPoint(payment.GetHash(), 0), scriptP2PKH, coinbaseKey, 5 * CENT, scriptP2PKH);
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptP2PK);
+    CheckBalance(keyID, nReward + 5 * CENT, nReward + 16 * CENT, 4);
+
+    // Disconnecting the block takes it out of the totals again
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params().GetConsensus(), chainActive.Tip()));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    CheckBalance(keyID, nReward + 11 * CENT, nReward + 11 * CENT, 3);
+
+    fAddressBalanceIndex = false;
+    fAddressIndex = false;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_balance_reconnect, TestChain100Setup)
+{
+    fAddressIndex = true;
+    fAddressBalanceIndex = true;
+
+    const CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    const CScript scriptP2PKH = GetScriptForDestination(keyID);
+    CAmount nReward = 0;
+    for (int i = 0; i < 3; i++)
+        nReward += CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PKH).vtx[0].vout[0].nValue;
+    CheckBalance(keyID, nReward, nReward, 3);
+
+    // VerifyDB disconnects the last blocks in memory and connects them again
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip, 4, 3));
+    CheckBalance(keyID, nReward, nReward, 3);
+
+    // After an unclean shutdown the tip is connected again on top of coins
+    // that were flushed before it
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex = chainActive.Tip();
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+        CCoinsViewCache view(pcoinsTip);
+        bool fClean = true;
+        BOOST_CHECK(DisconnectBlock(block, state, pindex, view, &fClean));
+        BOOST_CHECK(fClean);
+        BOOST_CHECK(ConnectBlock(block, state, pindex, view));
+    }
+    CheckBalance(keyID, nReward, nReward, 3);
+
+    // A real disconnect and reconnect still count the block once
+    CBlockIndex* pindexTip = chainActive.Tip();
+    CAmount nTipReward = CAmount(0);
+    {
+        LOCK(cs_main);
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindexTip, Params().GetConsensus()));
+        nTipReward = block.vtx[0].vout[0].nValue;
+        BOOST_CHECK(InvalidateBlock(state, Params().GetConsensus(), pindexTip));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    CheckBalance(keyID, nReward - nTipReward, nReward - nTipReward, 2);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReconsiderBlock(state, pindexTip));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip() == pindexTip);
+    CheckBalance(keyID, nReward, nReward, 3);
+
+    fAddressBalanceIndex = false;
+    fAddressIndex = false;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_paging, TestChain100Setup)
+{
+    fAddressIndex = true;
+
+    const CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    const CScript scriptP2PKH = GetScriptForDestination(keyID);
+    for (int i = 0; i < 5; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PKH);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(GetAddressIndex(keyID, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 5U);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    BOOST_CHECK(GetAddressUnspent(keyID, 1, unspentOutputs));
+    BOOST_CHECK_EQUAL(unspentOutputs.size(), 5U);
+
+    // Two entries at a time, each page continuing after the last key of the previous one
+    std::vector<std::pair<CAddressIndexKey, CAmount> > pagedIndex;
+    BOOST_CHECK(GetAddressIndex(keyID, 1, pagedIndex, 0, 0, NULL, 2));
+    BOOST_CHECK_EQUAL(pagedIndex.size(), 2U);
+    while (pagedIndex.size() < addressIndex.size()) {
+        CAddressIndexKey keyAfter = pagedIndex.back().first;
+        size_t nBefore = pagedIndex.size();
+        BOOST_CHECK(GetAddressIndex(keyID, 1, pagedIndex, 0, 0, &keyAfter, 2));
+        BOOST_CHECK(pagedIndex.size() > nBefore);
+    }
+    BOOST_CHECK_EQUAL(pagedIndex.size(), addressIndex.size());
+    for (size_t i = 0; i < addressIndex.size(); i++)
+        BOOST_CHECK(pagedIndex[i].first.txhash == addressIndex[i].first.txhash);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > pagedUnspent;
+    BOOST_CHECK(GetAddressUnspent(keyID, 1, pagedUnspent, NULL, 3));
+    BOOST_CHECK_EQUAL(pagedUnspent.size(), 3U);
+    CAddressUnspentKey keyAfter = pagedUnspent.back().first;
+    BOOST_CHECK(GetAddressUnspent(keyID, 1, pagedUnspent, &keyAfter, 3));
+    BOOST_CHECK_EQUAL(pagedUnspent.size(), unspentOutputs.size());
+    for (size_t i = 0; i < unspentOutputs.size(); i++)
+        BOOST_CHECK(pagedUnspent[i].first.txhash == unspentOutputs[i].first.txhash);
+
+    fAddressIndex = false;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_build, TestChain100Setup)
+{
+    const CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    const CScript scriptP2PK = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CScript scriptP2PKH = GetScriptForDestination(keyID);
+
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PKH);
+    CAmount nReward = block.vtx[0].vout[0].nValue;
+    CMutableTransaction payment = Spend(COutPoint(coinbaseTxns[0].GetHash(), 0), scriptP2PK, coinbaseKey, 11 * CENT, scriptP2PKH);
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, payment), scriptP2PKH);
+    nReward += block.vtx[0].vout[0].nValue;
+    CMutableTransaction spend = Spend(COutPoint(payment.GetHash(), 0), scriptP2PKH, coinbaseKey, 5 * CENT, scriptP2PKH);
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptP2PK);
+
+    // Turned on after the fact, the index is built from the block files
+    BOOST_CHECK(!fAddressIndex);
+    mapArgs["-addressindex"] = "1";
+    boost::thread_group threadGroup;
+    std::string strError;
+    BOOST_CHECK(StartIndexBuilders(threadGroup, strError));
+    threadGroup.join_all();
+    mapArgs.erase("-addressindex");
+    BOOST_CHECK(fAddressIndex);
+    BOOST_CHECK(fAddressBalanceIndex);
+    uint256 hashCursor;
+    BOOST_CHECK(!pblocktree->ReadIndexBuildCursor("addressindex", hashCursor));
+
+    std::vector<CIndexBuildInfo> vInfo = GetIndexBuildInfo();
+    for (unsigned int i = 0; i < vInfo.size(); i++) {
+        if (vInfo[i].strName == "addressindex") {
+            BOOST_CHECK(vInfo[i].fEnabled && !vInfo[i].fBuilding);
+            BOOST_CHECK_EQUAL(vInfo[i].nBlocksBuilt, chainActive.Height() + 1);
+        }
+    }
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(GetAddressIndex(keyID, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 5U);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    BOOST_CHECK(GetAddressUnspent(keyID, 1, unspentOutputs));
+    BOOST_CHECK_EQUAL(unspentOutputs.size(), 3U);
+    CheckBalance(keyID, nReward + 5 * CENT, nReward + 16 * CENT, 4);
+
+    // From there on ConnectBlock keeps it up to date
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PKH);
+    nReward += block.vtx[0].vout[0].nValue;
+    CheckBalance(keyID, nReward + 5 * CENT, nReward + 16 * CENT, 5);
+
+    fAddressBalanceIndex = false;
+    fAddressIndex = false;
+}
+
+// Start building the address index and wait for the builder to finish
+static CIndexBuildInfo BuildAddressIndex()
+{
+    mapArgs["-addressindex"] = "1";
+    boost::thread_group threadGroup;
+    std::string strError;
+    BOOST_CHECK(StartIndexBuilders(threadGroup, strError));
+    threadGroup.join_all();
+    mapArgs.erase("-addressindex");
+
+    std::vector<CIndexBuildInfo> vInfo = GetIndexBuildInfo();
+    for (unsigned int i = 0; i < vInfo.size(); i++) {
+        if (vInfo[i].strName == "addressindex")
+            return vInfo[i];
+    }
+    return CIndexBuildInfo();
+}
+
+// Leave the address index the way a build interrupted after pindexCursor does
+static void InterruptAddressIndexBuild(const CBlockIndex* pindexCursor)
+{
+    fAddressIndex = false;
+    fAddressBalanceIndex = false;
+    BOOST_CHECK(pblocktree->WriteFlag("addressindex", false));
+    BOOST_CHECK(pblocktree->WriteFlag("addressbalanceindex", false));
+    BOOST_CHECK(pblocktree->WriteIndexBuildCursor("addressindex", pindexCursor->GetBlockHash()));
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_build_resume, TestChain100Setup)
+{
+    const CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    const CScript scriptP2PK = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CScript scriptP2PKH = GetScriptForDestination(keyID);
+
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PKH);
+    CAmount nReward = block.vtx[0].vout[0].nValue;
+    CMutableTransaction payment = Spend(COutPoint(coinbaseTxns[0].GetHash(), 0), scriptP2PK, coinbaseKey, 11 * CENT, scriptP2PKH);
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, payment), scriptP2PKH);
+    nReward += block.vtx[0].vout[0].nValue;
+    CBlockIndex* pindexPayment = chainActive.Tip();
+    CMutableTransaction spend = Spend(COutPoint(payment.GetHash(), 0), scriptP2PKH, coinbaseKey, 5 * CENT, scriptP2PKH);
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptP2PK);
+    CBlockIndex* pindexSpend = chainActive.Tip();
+
+    CIndexBuildInfo info = BuildAddressIndex();
+    BOOST_CHECK(info.fEnabled);
+    BOOST_CHECK_EQUAL(info.nBlocksBuilt, chainActive.Height() + 1);
+
+    // Restarted after an interruption, the builder goes on from its cursor.
+    // The last block was written before the interruption, but its entries
+    // are only counted once.
+    InterruptAddressIndexBuild(pindexPayment);
+    info = BuildAddressIndex();
+    BOOST_CHECK(info.fEnabled && fAddressIndex && fAddressBalanceIndex);
+    BOOST_CHECK_EQUAL(info.nBlocksBuilt, 1);
+    uint256 hashCursor;
+    BOOST_CHECK(!pblocktree->ReadIndexBuildCursor("addressindex", hashCursor));
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(GetAddressIndex(keyID, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 5U);
+    CheckBalance(keyID, nReward + 5 * CENT, nReward + 16 * CENT, 4);
+
+    // A block the builder already wrote is disconnected before it catches up
+    InterruptAddressIndexBuild(pindexSpend);
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params().GetConsensus(), pindexSpend));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip() == pindexPayment);
+    // The coinbase would claim the fee of the spend put back into the mempool
+    mempool.clear();
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptP2PK);
+    BOOST_CHECK(chainActive.Tip()->pprev == pindexPayment);
+
+    // The builder takes its entries out again before adding the new tip
+    info = BuildAddressIndex();
+    BOOST_CHECK(info.fEnabled);
+    BOOST_CHECK_EQUAL(info.nBlocksBuilt, 1);
+    addressIndex.clear();
+    BOOST_CHECK(GetAddressIndex(keyID, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 3U);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    BOOST_CHECK(GetAddressUnspent(keyID, 1, unspentOutputs));
+    BOOST_CHECK_EQUAL(unspentOutputs.size(), 3U);
+    CheckBalance(keyID, nReward + 11 * CENT, nReward + 11 * CENT, 3);
+
+    fAddressBalanceIndex = false;
+    fAddressIndex = false;
+}
+
+// Index entries written to blocks/index/ by older versions, under their
+// 'a' (address) and 'p' (spent) prefixes, move to their own databases
+BOOST_FIXTURE_TEST_CASE(addressindex_migrate, BasicTestingSetup)
+{
+    CBlockTreeDB blocktree(1 << 20, 1 << 20, 1 << 20, 1 << 20, true);
+    const uint160 addressHash(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    const uint256 txhash = GetRandHash();
+
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(blocktree.Write(std::make_pair('a', CAddressIndexKey(1, addressHash, 100 + i, 1, txhash, i, false)), (CAmount)(i + 1) * COIN));
+    CSpentIndexKey spentKey(txhash, 0);
+    BOOST_CHECK(blocktree.Write(std::make_pair('p', spentKey), CSpentIndexValue(GetRandHash(), 0, 101, COIN, 1, addressHash)));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(blocktree.ReadAddressIndex(addressHash, 1, addressIndex));
+    BOOST_CHECK(addressIndex.empty());
+
+    BOOST_CHECK(blocktree.MigrateIndexes());
+    BOOST_CHECK(blocktree.ReadAddressIndex(addressHash, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 3U);
+    BOOST_CHECK_EQUAL(addressIndex[2].second, 3 * COIN);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(blocktree.ReadSpentIndex(spentKey, spentValue));
+    BOOST_CHECK_EQUAL(spentValue.blockHeight, 101);
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('a', addressIndex[0].first)));
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('p', spentKey)));
+
+    // Nothing is left to move the next time
+    BOOST_CHECK(blocktree.MigrateIndexes());
+    addressIndex.clear();
+    BOOST_CHECK(blocktree.ReadAddressIndex(addressHash, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,10 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/sph_aes_ni.h"
+#include "crypto/sph_echo.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_shavite.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_pura.h"
@@ -65,6 +69,29 @@ void TestHMACSHA512(const std::string &hexkey, const std::string &hexin, const s
     TestVector(CHMAC_SHA512(&key[0], key.size()), ParseHex(hexin), ParseHex(hexout));
 }
 
+template<typename Context>
+void TestSph512(void (*init)(void*), void (*update)(void*, const void*, size_t), void (*close)(void*, void*),
+                const std::string &in, const std::string &hexout)
+{
+    unsigned char hash[64];
+    Context ctx;
+    init(&ctx);
+    update(&ctx, in.data(), in.size());
+    close(&ctx, hash);
+    BOOST_CHECK_EQUAL(HexStr(hash, hash + 64), hexout);
+
+    // Split input, exercising buffering across compression calls
+    init(&ctx);
+    update(&ctx, in.data(), in.size() / 3);
+    update(&ctx, in.data() + in.size() / 3, in.size() - in.size() / 3);
+    close(&ctx, hash);
+    BOOST_CHECK_EQUAL(HexStr(hash, hash + 64), hexout);
+}
+
+void TestGroestl512(const std::string &in, const std::string &hexout) { TestSph512<sph_groestl512_context>(sph_groestl512_init, sph_groestl512, sph_groestl512_close, in, hexout); }
+void TestEcho512(const std::string &in, const std::string &hexout) { TestSph512<sph_echo512_context>(sph_echo512_init, sph_echo512, sph_echo512_close, in, hexout); }
+void TestShavite512(const std::string &in, const std::string &hexout) { TestSph512<sph_shavite512_context>(sph_shavite512_init, sph_shavite512, sph_shavite512_close, in, hexout); }
+
 std::string LongTestString(void) {
     std::string ret;
     for (int i=0; i<200000; i++) {
@@ -170,6 +197,51 @@ BOOST_AUTO_TEST_CASE(sha512_testvectors) {
                "37de8c3ef5459d76a52cedc02dc499a3c9ed9dedbfb3281afd9653b8a112fafc");
 }
 
+static void TestX11AESStages() {
+    std::string in200;
+    for (int i = 0; i < 200; i++)
+        in200 += (unsigned char)i;
+
+    TestGroestl512("",
+        "6d3ad29d279110eef3adbd66de2a0345a77baede1557f5d099fce0c03d6dc2ba"
+        "8e6d4a6633dfbd66053c20faa87d1a11f39a7fbe4a6c2f009801370308fc4ad8");
+    TestGroestl512("abc",
+        "70e1c68c60df3b655339d67dc291cc3f1dde4ef343f11b23fdd44957693815a7"
+        "5a8339c682fc28322513fd1f283c18e53cff2b264e06bf83a2f0ac8c1f6fbff6");
+    TestGroestl512(in200,
+        "ff6dabc4aacd1f3955daba7ee2f36b2e24cca8aef87bdf286ea77b2d86dc4052"
+        "6ca5290c0558e95b4f620d78241a2665ab300216016b66ae87c6dc2e216348bb");
+    TestEcho512("",
+        "158f58cc79d300a9aa292515049275d051a28ab931726d0ec44bdd9faef4a702"
+        "c36db9e7922fff077402236465833c5cc76af4efc352b4b44c7fa15aa0ef234e");
+    TestEcho512("abc",
+        "3bf04ec89d67e0dafd1b8ab26b176abaead6b3cdc706ff7198c3c6045e77d4ea"
+        "f64cd90af9c5a7674919b90ff8c9b4a7554d6cfeffb334406ec233fb0b0dd6bc");
+    TestEcho512(in200,
+        "61c10247231339fe1649319067997f656a1a90a0482763a227378c96eaf07eb9"
+        "84018a897d0ed453729ca700d21753432c0cabef97ea9b32fcbd61268d0f7d11");
+    TestShavite512("",
+        "a485c1b2578459d1efc5dddd840bb0b4a650ac82fe68f58c4442ccda747da006"
+        "b2d1dc6b4a4eb7d84ff91e1f466fef429d259acd995dddcad16fa545c7a6e5ba");
+    TestShavite512("abc",
+        "0fb0b216b377e6d95db1b6d9b6c8b59f08d4e29814071c8c0f827b32e68c1536"
+        "2f24bcc15ad6b1c925a03f00092997f7628cb47f27c9ad7a22e4c00fbb2c16e3");
+    TestShavite512(in200,
+        "c312d285cd9c597d7df9525133155f05aa94f206b31e2def255879b8bb27f25c"
+        "cfaba516238c5de679545e7d0d88a5d0c0c975aae8a2e62369fcdeda4d02da42");
+}
+
+BOOST_AUTO_TEST_CASE(x11_aes_stages_testvectors) {
+    // Groestl, ECHO and SHAvite-3 pick an AES-NI implementation at run time
+    // when the CPU supports it; both implementations must match the vectors.
+    sph_aes_ni_enable(0);
+    TestX11AESStages();
+    sph_aes_ni_enable(1);
+    if (!sph_aes_ni_supported())
+        BOOST_TEST_MESSAGE("AES-NI is not supported, only the table-based code was tested");
+    TestX11AESStages();
+}
+
 BOOST_AUTO_TEST_CASE(hmac_sha256_testvectors) {
     // test cases 1, 2, 3, 4, 6 and 7 of RFC 4231
     TestHMACSHA256("0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
@@ -0,0 +1,127 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "governance-votedb.h"
+#include "random.h"
+
+#include "test/test_pura.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(governance_votedb_tests, BasicTestingSetup)
+
+static CGovernanceVote MakeVote(const uint256& nParentHash)
+{
+    return CGovernanceVote(CTxIn(COutPoint(GetRandHash(), 0)), nParentHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES);
+}
+
+BOOST_AUTO_TEST_CASE(governance_votedb_flush)
+{
+    pgovernancevotedb = new CGovernanceVoteDB(1 << 20, true);
+
+    uint256 nParentHash = GetRandHash();
+    CGovernanceObjectVoteFile fileVotes;
+    std::vector<CGovernanceVote> vecVotes;
+    for(int i = 0; i < 250; ++i) {
+        vecVotes.push_back(MakeVote(nParentHash));
+        fileVotes.AddVote(vecVotes.back());
+    }
+
+    // memory is bounded, but every vote is still known
+    BOOST_CHECK(fileVotes.GetMemoryVoteCount() <= 100);
+    BOOST_CHECK_EQUAL(fileVotes.GetVoteCount(), 250);
+    BOOST_CHECK_EQUAL(fileVotes.GetVoteHashes().size(), 250U);
+    BOOST_CHECK_EQUAL(fileVotes.GetVotes().size(), 250U);
+    for(size_t i = 0; i < vecVotes.size(); ++i) {
+        CGovernanceVote vote;
+        BOOST_CHECK(fileVotes.HasVote(vecVotes[i].GetHash()));
+        BOOST_CHECK(fileVotes.GetVote(vecVotes[i].GetHash(), vote));
+        BOOST_CHECK(vote.GetHash() == vecVotes[i].GetHash());
+    }
+
+    // the oldest votes went to disk
+    std::vector<CGovernanceVote> vecDiskVotes;
+    BOOST_CHECK(pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes));
+    BOOST_CHECK_EQUAL(vecDiskVotes.size(), (size_t)(250 - fileVotes.GetMemoryVoteCount()));
+
+    // removal also reaches the votes on disk
+    fileVotes.RemoveVotesFromMasternode(vecVotes[0].GetVinMasternode());
+    BOOST_CHECK(!fileVotes.HasVote(vecVotes[0].GetHash()));
+    BOOST_CHECK_EQUAL(fileVotes.GetVoteCount(), 249);
+    vecDiskVotes.clear();
+    BOOST_CHECK(pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes));
+    BOOST_CHECK_EQUAL(vecDiskVotes.size(), (size_t)(249 - fileVotes.GetMemoryVoteCount()));
+
+    // a copy round-tripped through serialization shares the disk votes
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << fileVotes;
+    CGovernanceObjectVoteFile fileVotesCopy;
+    ss >> fileVotesCopy;
+    BOOST_CHECK_EQUAL(fileVotesCopy.GetVotes().size(), 249U);
+
+    // votes of deleted objects are swept
+    uint256 nOtherParentHash = GetRandHash();
+    std::vector<CGovernanceVote> vecOtherVotes(1, MakeVote(nOtherParentHash));
+    BOOST_CHECK(pgovernancevotedb->WriteVotes(vecOtherVotes));
+    std::set<uint256> setParentHashes;
+    setParentHashes.insert(nParentHash);
+    BOOST_CHECK_EQUAL(pgovernancevotedb->EraseVotesExcept(setParentHashes), 1);
+
+    fileVotes.Clear();
+    BOOST_CHECK_EQUAL(fileVotes.GetVoteCount(), 0);
+    vecDiskVotes.clear();
+    BOOST_CHECK(pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes));
+    BOOST_CHECK(vecDiskVotes.empty());
+
+    delete pgovernancevotedb;
+    pgovernancevotedb = NULL;
+}
+
+BOOST_AUTO_TEST_CASE(governance_votedb_copies)
+{
+    pgovernancevotedb = new CGovernanceVoteDB(1 << 20, true);
+
+    uint256 nParentHash = GetRandHash();
+    CGovernanceObjectVoteFile fileVotes;
+    std::vector<CGovernanceVote> vecVotes;
+    for(int i = 0; i < 250; ++i) {
+        vecVotes.push_back(MakeVote(nParentHash));
+        fileVotes.AddVote(vecVotes.back());
+    }
+    std::vector<CGovernanceVote> vecDiskVotes;
+    BOOST_CHECK(pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes));
+    const size_t nDiskVotes = vecDiskVotes.size();
+    BOOST_CHECK(nDiskVotes > 0);
+
+    // a copy leaves the votes on disk alone while the original refers to them
+    {
+        CGovernanceObjectVoteFile fileVotesCopy(fileVotes);
+        fileVotesCopy.RemoveVotesFromMasternode(vecVotes[0].GetVinMasternode());
+        BOOST_CHECK(!fileVotesCopy.HasVote(vecVotes[0].GetHash()));
+        BOOST_CHECK(fileVotes.HasVote(vecVotes[0].GetHash()));
+
+        CGovernanceObjectVoteFile fileVotesAssigned;
+        fileVotesAssigned = fileVotes;
+        fileVotesAssigned.Clear();
+        fileVotesCopy.Clear();
+        BOOST_CHECK_EQUAL(fileVotesCopy.GetVoteCount(), 0);
+    }
+    vecDiskVotes.clear();
+    BOOST_CHECK(pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes));
+    BOOST_CHECK_EQUAL(vecDiskVotes.size(), nDiskVotes);
+    BOOST_CHECK_EQUAL(fileVotes.GetVotes().size(), 250U);
+
+    // once it is the last copy, the file erases its own votes only
+    std::vector<CGovernanceVote> vecOtherVotes(1, MakeVote(nParentHash));
+    BOOST_CHECK(pgovernancevotedb->WriteVotes(vecOtherVotes));
+    fileVotes.Clear();
+    vecDiskVotes.clear();
+    BOOST_CHECK(pgovernancevotedb->ReadVotes(nParentHash, vecDiskVotes));
+    BOOST_CHECK_EQUAL(vecDiskVotes.size(), 1U);
+
+    delete pgovernancevotedb;
+    pgovernancevotedb = NULL;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
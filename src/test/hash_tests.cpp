@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_pura.h"
 
@@ -47,4 +49,90 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(hashx11_many)
+{
+    // Every hash must agree with HashX11 of the same header
+    std::vector<CBlockHeader> headers(19);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 0x20000000 + i;
+        headers[i].hashPrevBlock = GetRandHash();
+        headers[i].hashMerkleRoot = GetRandHash();
+        headers[i].nTime = 1500000000 + i;
+        headers[i].nBits = 0x1e0ffff0;
+        headers[i].nNonce = GetRand(0xffffffff);
+    }
+
+    std::vector<uint256> vHashes;
+    GetBlockHeaderHashes(headers, vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        BOOST_CHECK(vHashes[i] == headers[i].GetHash());
+
+    GetBlockHeaderHashes(std::vector<CBlockHeader>(), vHashes);
+    BOOST_CHECK(vHashes.empty());
+
+    // Arbitrary lengths and strides, including empty input
+    std::vector<unsigned char> data(10 * 100);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i * 7;
+    std::vector<uint256> vOut(10);
+    for (size_t nLen = 0; nLen <= 100; nLen += 25) {
+        HashX11Many(&data[0], nLen, 100, 10, &vOut[0]);
+        for (size_t i = 0; i < 10; i++)
+            BOOST_CHECK(vOut[i] == HashX11(data.begin() + i * 100, data.begin() + i * 100 + nLen));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hashx11_header_midstate)
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 0;
+    BOOST_CHECK_EQUAL(END(header.nNonce) - BEGIN(header.nVersion), CX11HeaderHasher::HEADER_SIZE);
+
+    CX11HeaderHasher hasher((const unsigned char*)BEGIN(header.nVersion));
+    BOOST_CHECK(hasher.Hash(0) == header.GetHash());
+
+    // A run of nonces crossing the 2^32 wrap
+    const uint32_t nFirstNonce = 0xfffffff0;
+    std::vector<uint256> vHashes(29);
+    hasher.HashNonces(nFirstNonce, vHashes.size(), &vHashes[0]);
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        header.nNonce = nFirstNonce + (uint32_t)i;
+        BOOST_CHECK(vHashes[i] == header.GetHash());
+        BOOST_CHECK(hasher.Hash(header.nNonce) == header.GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x726fdb47dd0e0e31ull);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x74f839c593dc67fdull);
+    static const unsigned char t1[7] = {1,2,3,4,5,6,7};
+    hasher.Write(t1, 7);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x93f5f5799a932462ull);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x3f2acc7f57c29bdbull);
+    static const unsigned char t2[2] = {16,17};
+    hasher.Write(t2, 2);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x4bc1b3f0968dd39cull);
+    static const unsigned char t3[9] = {18,19,20,21,22,23,24,25,26};
+    hasher.Write(t3, 9);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x2f2e6163076bcfadull);
+    static const unsigned char t4[5] = {27,28,29,30,31};
+    hasher.Write(t4, 5);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x7127512f72f27cceull);
+    hasher.Write(0x2726252423222120ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x0e3ea96b5304a7d0ull);
+    hasher.Write(0x2F2E2D2C2B2A2928ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0xe612a3cb9ecba951ull);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
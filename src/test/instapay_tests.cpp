@@ -0,0 +1,135 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "instapay.h"
+#include "random.h"
+
+#include "test/test_pura.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(instapay_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(orphan_votes_by_tx)
+{
+    CTxLockVoteOrphans orphans;
+    uint256 txHash = GetRandHash();
+    uint256 txHashOther = GetRandHash();
+    COutPoint outpoint(GetRandHash(), 0);
+    COutPoint outpointOther(GetRandHash(), 1);
+
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(orphans.AddWaitingForTx(CTxLockVote(txHash, outpoint, COutPoint(GetRandHash(), 0))));
+    }
+    CTxLockVote voteOtherOutpoint(txHash, outpointOther, COutPoint(GetRandHash(), 0));
+    BOOST_CHECK(orphans.AddWaitingForTx(voteOtherOutpoint));
+    BOOST_CHECK(!orphans.AddWaitingForTx(voteOtherOutpoint));
+    BOOST_CHECK(orphans.AddWaitingForTx(CTxLockVote(txHashOther, outpoint, COutPoint(GetRandHash(), 0))));
+
+    BOOST_CHECK_EQUAL(orphans.size(), 5U);
+    BOOST_CHECK_EQUAL(orphans.CountVotesForTxAndOutPoint(txHash, outpoint), 3);
+    BOOST_CHECK_EQUAL(orphans.CountVotesForTxAndOutPoint(txHash, outpointOther), 1);
+    BOOST_CHECK_EQUAL(orphans.CountVotesForTxAndOutPoint(txHashOther, outpoint), 1);
+    BOOST_CHECK_EQUAL(orphans.GetVoteHashesForTx(txHash).size(), 4U);
+
+    orphans.Erase(voteOtherOutpoint.GetHash());
+    BOOST_CHECK(!orphans.Has(voteOtherOutpoint.GetHash()));
+    BOOST_CHECK_EQUAL(orphans.CountVotesForTxAndOutPoint(txHash, outpointOther), 0);
+
+    // a lock request unblocks its own votes only
+    std::vector<CTxLockVote> vecVotes = orphans.PopVotesForTx(txHash);
+    BOOST_CHECK_EQUAL(vecVotes.size(), 3U);
+    BOOST_FOREACH(const CTxLockVote& vote, vecVotes) {
+        BOOST_CHECK(vote.GetTxHash() == txHash);
+        BOOST_CHECK(!orphans.Has(vote.GetHash()));
+    }
+    BOOST_CHECK(!orphans.HasVotesForTx(txHash));
+    BOOST_CHECK(orphans.HasVotesForTx(txHashOther));
+    BOOST_CHECK_EQUAL(orphans.size(), 1U);
+    BOOST_CHECK(orphans.PopVotesForTx(txHash).empty());
+}
+
+BOOST_AUTO_TEST_CASE(orphan_votes_by_masternode)
+{
+    CTxLockVoteOrphans orphans;
+    uint256 txHash = GetRandHash();
+    COutPoint outpointMasternode(GetRandHash(), 0);
+
+    CTxLockVote vote(txHash, COutPoint(GetRandHash(), 0), outpointMasternode);
+    BOOST_CHECK(orphans.AddWaitingForMasternode(vote));
+    BOOST_CHECK(orphans.AddWaitingForMasternode(CTxLockVote(txHash, COutPoint(GetRandHash(), 0), outpointMasternode)));
+    BOOST_CHECK(orphans.AddWaitingForMasternode(CTxLockVote(txHash, COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0))));
+
+    // votes from unknown masternodes aren't validated, they don't count towards a lock
+    BOOST_CHECK(!orphans.HasVotesForTx(txHash));
+    BOOST_CHECK_EQUAL(orphans.CountVotesForTxAndOutPoint(txHash, vote.GetOutpoint()), 0);
+    BOOST_CHECK_EQUAL(orphans.GetWaitedForMasternodes().size(), 2U);
+
+    BOOST_CHECK_EQUAL(orphans.PopVotesForMasternode(outpointMasternode).size(), 2U);
+    BOOST_CHECK(!orphans.Has(vote.GetHash()));
+    BOOST_CHECK_EQUAL(orphans.GetWaitedForMasternodes().size(), 1U);
+
+    // the number of votes waiting for masternodes is limited
+    for (size_t i = orphans.size(); i < CTxLockVoteOrphans::MAX_VOTES_WAITING_FOR_MASTERNODE; i++) {
+        BOOST_CHECK(orphans.AddWaitingForMasternode(CTxLockVote(txHash, COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0))));
+    }
+    BOOST_CHECK(!orphans.AddWaitingForMasternode(CTxLockVote(txHash, COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0))));
+    BOOST_CHECK(orphans.AddWaitingForTx(CTxLockVote(txHash, COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0))));
+}
+
+BOOST_AUTO_TEST_CASE(orphan_votes_expire)
+{
+    CTxLockVoteOrphans orphans;
+    SetMockTime(1000);
+    CTxLockVote voteOld(GetRandHash(), COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0));
+    CTxLockVote voteOldMn(GetRandHash(), COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0));
+    SetMockTime(2000);
+    CTxLockVote voteNew(GetRandHash(), COutPoint(GetRandHash(), 0), COutPoint(GetRandHash(), 0));
+    SetMockTime(0);
+
+    orphans.AddWaitingForTx(voteOld);
+    orphans.AddWaitingForMasternode(voteOldMn);
+    orphans.AddWaitingForTx(voteNew);
+
+    std::vector<CTxLockVote> vecExpired = orphans.RemoveExpired(1500);
+    BOOST_CHECK_EQUAL(vecExpired.size(), 2U);
+    BOOST_CHECK_EQUAL(orphans.size(), 1U);
+    BOOST_CHECK(orphans.Has(voteNew.GetHash()));
+    BOOST_CHECK(!orphans.HasVotesForTx(voteOld.GetTxHash()));
+    BOOST_CHECK(orphans.GetWaitedForMasternodes().empty());
+}
+
+BOOST_AUTO_TEST_CASE(lock_latency_stats)
+{
+    CTxLockLatencyStats stats;
+    BOOST_CHECK_EQUAL(stats.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(stats.GetAverageMicros(), 0);
+    int64_t nMillis;
+    BOOST_CHECK(!stats.GetPercentileMillis(0.5, nMillis));
+
+    BOOST_CHECK_EQUAL(CTxLockLatencyStats::GetBucketLimitMillis(0), 1);
+    BOOST_CHECK_EQUAL(CTxLockLatencyStats::GetBucketLimitMillis(10), 1024);
+    BOOST_CHECK_EQUAL(CTxLockLatencyStats::GetBucketLimitMillis(CTxLockLatencyStats::BUCKETS - 1), -1);
+
+    // 90 fast locks, 9 slower ones and a really slow one
+    for (int i = 0; i < 90; i++) {
+        stats.Add(500); // 0.5ms
+    }
+    for (int i = 0; i < 9; i++) {
+        stats.Add(300 * 1000); // 300ms
+    }
+    stats.Add(3600 * 1000000LL); // an hour
+
+    BOOST_CHECK_EQUAL(stats.GetCount(), 100U);
+    BOOST_CHECK_EQUAL(stats.GetMaxMicros(), 3600 * 1000000LL);
+    BOOST_CHECK_EQUAL(stats.GetBucketCount(0), 90U);
+    BOOST_CHECK_EQUAL(stats.GetBucketCount(9), 9U); // 256ms - 512ms
+    BOOST_CHECK_EQUAL(stats.GetBucketCount(CTxLockLatencyStats::BUCKETS - 1), 1U);
+    BOOST_CHECK(stats.GetPercentileMillis(0.5, nMillis) && nMillis == 1);
+    BOOST_CHECK(stats.GetPercentileMillis(0.9, nMillis) && nMillis == 1);
+    BOOST_CHECK(stats.GetPercentileMillis(0.99, nMillis) && nMillis == 512);
+    BOOST_CHECK(stats.GetPercentileMillis(1, nMillis) && nMillis == -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
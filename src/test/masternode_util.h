@@ -0,0 +1,21 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_MASTERNODE_UTIL_H
+#define BITCOIN_TEST_MASTERNODE_UTIL_H
+
+#include "pubkey.h"
+#include "random.h"
+
+/** A compressed public key with random contents, for masternodes that are
+ *  never asked to sign anything. Not necessarily a point on the curve. */
+inline CPubKey RandomPubKey()
+{
+    unsigned char vch[33];
+    vch[0] = 0x02;
+    GetRandBytes(vch + 1, 32);
+    return CPubKey(vch, vch + sizeof(vch));
+}
+
+#endif // BITCOIN_TEST_MASTERNODE_UTIL_H
@@ -0,0 +1,306 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/merkle.h"
+#include "masternode-payments.h"
+#include "masternodeman.h"
+#include "miner.h"
+#include "pow.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "uint256.h"
+#include "validation.h"
+
+#include "test/masternode_util.h"
+#include "test/test_pura.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, BasicTestingSetup)
+
+static CMasternode MakeMasternode(const uint256& txid, uint32_t n, const CPubKey& pubKeyCollateral, const CPubKey& pubKeyMasternode)
+{
+    return CMasternode(CService("1.2.3.4", 44444), CTxIn(COutPoint(txid, n)), pubKeyCollateral, pubKeyMasternode, PROTOCOL_VERSION);
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_find)
+{
+    CMasternodeMan man;
+    CPubKey pubKeyShared = RandomPubKey();
+    CPubKey pubKeyOperator1 = RandomPubKey();
+    CPubKey pubKeyOperator2 = RandomPubKey();
+    CPubKey pubKeyUnknown = RandomPubKey();
+    uint256 txid = GetRandHash();
+
+    // two masternodes paying to the same collateral address
+    CMasternode mn1 = MakeMasternode(txid, 1, pubKeyShared, pubKeyOperator1);
+    CMasternode mn2 = MakeMasternode(txid, 0, pubKeyShared, pubKeyOperator2);
+    BOOST_CHECK(man.Add(mn1));
+    BOOST_CHECK(man.Add(mn2));
+    BOOST_CHECK(!man.Add(mn1));
+    BOOST_CHECK_EQUAL(man.size(), 2);
+
+    CMasternode* pmn = man.Find(mn1.vin);
+    BOOST_CHECK(pmn && pmn->vin == mn1.vin);
+    BOOST_CHECK(man.Has(mn2.vin));
+    BOOST_CHECK(!man.Has(CTxIn(COutPoint(txid, 2))));
+
+    // shared payee resolves to the lowest outpoint
+    CScript payee = GetScriptForDestination(pubKeyShared.GetID());
+    pmn = man.Find(payee);
+    BOOST_CHECK(pmn && pmn->vin == mn2.vin);
+    BOOST_CHECK(man.Find(GetScriptForDestination(pubKeyUnknown.GetID())) == NULL);
+
+    pmn = man.Find(pubKeyOperator1);
+    BOOST_CHECK(pmn && pmn->vin == mn1.vin);
+    BOOST_CHECK(man.Find(pubKeyUnknown) == NULL);
+    BOOST_CHECK(man.GetMasternodeInfo(pubKeyOperator2).vin == mn2.vin);
+
+    // the list survives a round trip through mncache.dat serialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << man;
+    CMasternodeMan man2;
+    ss >> man2;
+    BOOST_CHECK_EQUAL(man2.size(), 2);
+    pmn = man2.Find(payee);
+    BOOST_CHECK(pmn && pmn->vin == mn2.vin);
+    pmn = man2.Find(pubKeyOperator2);
+    BOOST_CHECK(pmn && pmn->vin == mn2.vin);
+    BOOST_CHECK(man2.Has(mn1.vin));
+
+    man2.Clear();
+    BOOST_CHECK_EQUAL(man2.size(), 0);
+    BOOST_CHECK(man2.Find(mn1.vin) == NULL);
+    BOOST_CHECK(man2.Find(payee) == NULL);
+    BOOST_CHECK(man2.Find(pubKeyOperator1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_list_snapshot)
+{
+    CMasternodeMan man;
+    CMasternode mn1 = MakeMasternode(GetRandHash(), 0, RandomPubKey(), RandomPubKey());
+    BOOST_CHECK(man.Add(mn1));
+
+    // readers share one snapshot while the list doesn't change
+    CMasternodeListSnapshotRef snapshot1 = man.GetMasternodeListSnapshot();
+    BOOST_CHECK_EQUAL(snapshot1->vecMasternodes.size(), 1);
+    BOOST_CHECK(man.GetMasternodeListSnapshot() == snapshot1);
+
+    // changes publish a new one and leave the old one untouched
+    CMasternode mn2 = MakeMasternode(GetRandHash(), 0, RandomPubKey(), RandomPubKey());
+    BOOST_CHECK(man.Add(mn2));
+    CMasternodeListSnapshotRef snapshot2 = man.GetMasternodeListSnapshot();
+    BOOST_CHECK(snapshot2 != snapshot1);
+    BOOST_CHECK_EQUAL(snapshot1->vecMasternodes.size(), 1);
+    BOOST_CHECK_EQUAL(snapshot2->vecMasternodes.size(), 2);
+
+    BOOST_CHECK(man.UpdateLastDsq(mn1.vin));
+    CMasternodeListSnapshotRef snapshot3 = man.GetMasternodeListSnapshot();
+    BOOST_CHECK(snapshot3 != snapshot2);
+    BOOST_CHECK_EQUAL(man.GetFullMasternodeVector().size(), 2);
+
+    // entry changes are in the next snapshot right away
+    man.DisallowMixing(mn1.vin);
+    CMasternodeListSnapshotRef snapshot4 = man.GetMasternodeListSnapshot();
+    BOOST_CHECK(snapshot4 != snapshot3);
+    for (const CMasternode& mn : snapshot4->vecMasternodes) {
+        BOOST_CHECK_EQUAL(mn.fAllowMixingTx, mn.vin != mn1.vin);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(masternodeman_rank_cache, TestingSetup)
+{
+    CMasternodeMan man;
+    uint256 blockHash = chainActive.Tip()->GetBlockHash();
+    int nHeight = chainActive.Height();
+
+    std::vector<CMasternode> vecMasternodes;
+    for (int i = 0; i < 20; i++) {
+        vecMasternodes.push_back(MakeMasternode(GetRandHash(), 0, RandomPubKey(), RandomPubKey()));
+        BOOST_CHECK(man.Add(vecMasternodes.back()));
+    }
+
+    // highest score first
+    std::vector<std::pair<int, CMasternode> > vecRanks = man.GetMasternodeRanks(nHeight);
+    BOOST_CHECK_EQUAL(vecRanks.size(), vecMasternodes.size());
+    for (size_t i = 0; i < vecRanks.size(); i++) {
+        BOOST_CHECK_EQUAL(vecRanks[i].first, (int)i + 1);
+        if (i > 0) {
+            BOOST_CHECK(vecRanks[i - 1].second.CalculateScore(blockHash).GetCompact(false) >= vecRanks[i].second.CalculateScore(blockHash).GetCompact(false));
+        }
+        // rank and by-rank lookups agree with the full ranking, also when served from the cache
+        for (int nPass = 0; nPass < 2; nPass++) {
+            BOOST_CHECK_EQUAL(man.GetMasternodeRank(vecRanks[i].second.vin, nHeight), (int)i + 1);
+            CMasternode* pmn = man.GetMasternodeByRank(i + 1, nHeight);
+            BOOST_CHECK(pmn && pmn->vin == vecRanks[i].second.vin);
+        }
+    }
+    BOOST_CHECK(man.GetMasternodeByRank(vecRanks.size() + 1, nHeight) == NULL);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(COutPoint(GetRandHash(), 0)), nHeight), -1);
+
+    // filtered rankings are cached separately
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(vecRanks[0].second.vin, nHeight, PROTOCOL_VERSION + 1), -1);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(vecRanks[0].second.vin, nHeight), 1);
+
+    // adding a masternode invalidates the cached rankings
+    CMasternode mnNew = MakeMasternode(GetRandHash(), 0, RandomPubKey(), RandomPubKey());
+    BOOST_CHECK(man.Add(mnNew));
+    BOOST_CHECK(man.GetMasternodeRank(mnNew.vin, nHeight) > 0);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRanks(nHeight).size(), vecMasternodes.size() + 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(masternodeman_payment_queue, TestChain100Setup)
+{
+    CMasternodeMan man;
+    int nBlockHeight = chainActive.Height() + 1;
+    uint256 blockHash = chainActive[nBlockHeight - 101]->GetBlockHash();
+
+    std::vector<CMasternode> vecMasternodes;
+    for (int i = 0; i < 30; i++) {
+        CMasternode mn = MakeMasternode(GetRandHash(), 0, RandomPubKey(), RandomPubKey());
+        mn.sigTime = 0;
+        mn.nCacheCollateralBlock = 1;
+        mn.nBlockLastPaid = i % 7 == 0 ? 0 : 50 + i;
+        vecMasternodes.push_back(mn);
+        BOOST_CHECK(man.Add(mn));
+    }
+    // too new to be paid
+    CMasternode mnNew = MakeMasternode(GetRandHash(), 0, RandomPubKey(), RandomPubKey());
+    mnNew.nCacheCollateralBlock = chainActive.Height();
+    BOOST_CHECK(man.Add(mnNew));
+
+    // the best score among the oldest tenth by last paid block, then outpoint
+    std::vector<std::pair<int, CMasternode*> > vecLastPaid;
+    for (size_t i = 0; i < vecMasternodes.size(); i++) {
+        vecLastPaid.push_back(std::make_pair(vecMasternodes[i].GetLastPaidBlock(), &vecMasternodes[i]));
+    }
+    std::sort(vecLastPaid.begin(), vecLastPaid.end(), CompareLastPaidBlock());
+    CMasternode* pmnExpected = NULL;
+    for (int i = 0; i < (int)(vecMasternodes.size() + 1) / 10; i++) {
+        if (!pmnExpected || vecLastPaid[i].second->CalculateScore(blockHash) > pmnExpected->CalculateScore(blockHash)) {
+            pmnExpected = vecLastPaid[i].second;
+        }
+    }
+
+    int nCount = 0;
+    CMasternode* pmn = man.GetNextMasternodeInQueueForPayment(nBlockHeight, true, nCount);
+    BOOST_CHECK_EQUAL(nCount, (int)vecMasternodes.size());
+    BOOST_CHECK(pmn && pmnExpected && pmn->vin == pmnExpected->vin);
+}
+
+static CBlock MakePaymentBlock(const CScript& payee)
+{
+    // 60 out of a 100 block value is the masternode payment
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.SetNull();
+    tx.vout.push_back(CTxOut(40, CScript() << OP_TRUE));
+    if (!payee.empty()) {
+        tx.vout.push_back(CTxOut(60, payee));
+    }
+    CBlock block;
+    block.vtx.push_back(CTransaction(tx));
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(masternode_payment_index)
+{
+    CMasternodePaymentIndex index;
+    CScript payee1 = GetScriptForDestination(RandomPubKey().GetID());
+    CScript payee2 = GetScriptForDestination(RandomPubKey().GetID());
+
+    std::vector<CBlockIndex> vecIndex(10);
+    for (int i = 0; i < 10; i++) {
+        vecIndex[i].nHeight = 100 + i;
+        vecIndex[i].nTime = 1000 + i;
+        CScript payee;
+        if (i % 3 == 0) payee = payee1;
+        if (i == 4) payee = payee2;
+        index.BlockConnected(MakePaymentBlock(payee), &vecIndex[i]);
+    }
+
+    // payee1 was paid at 100, 103, 106 and 109, most recent first
+    std::vector<std::pair<int, int64_t> > vecPayments = index.GetPayments(payee1, 0, 109);
+    BOOST_REQUIRE_EQUAL(vecPayments.size(), 4);
+    BOOST_CHECK_EQUAL(vecPayments[0].first, 109);
+    BOOST_CHECK_EQUAL(vecPayments[0].second, 1009);
+    BOOST_CHECK_EQUAL(vecPayments[3].first, 100);
+
+    // the lower bound is exclusive, the upper bound inclusive
+    vecPayments = index.GetPayments(payee1, 103, 108);
+    BOOST_CHECK_EQUAL(vecPayments.size(), 1);
+    BOOST_CHECK_EQUAL(vecPayments[0].first, 106);
+
+    // outputs that are not the masternode payment are ignored
+    BOOST_CHECK(index.GetPayments(CScript() << OP_TRUE, 0, 109).empty());
+    BOOST_CHECK_EQUAL(index.GetPayments(payee2, 0, 109).size(), 1);
+
+    // disconnecting forgets the payments
+    index.BlockDisconnected(CBlock(), &vecIndex[9]);
+    vecPayments = index.GetPayments(payee1, 0, 109);
+    BOOST_CHECK_EQUAL(vecPayments.size(), 3);
+    BOOST_CHECK_EQUAL(vecPayments[0].first, 106);
+
+    index.Clear();
+    BOOST_CHECK(index.GetPayments(payee1, 0, 109).empty());
+}
+
+// Mine a block on the tip whose coinbase pays 60% of its value to payee
+static CBlock MinePaymentBlock(const CScript& payee)
+{
+    const CChainParams& chainparams = Params();
+    CBlockTemplate* pblocktemplate = CreateNewBlock(chainparams, CScript() << OP_TRUE);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+
+    block.vtx.resize(1);
+    unsigned int nExtraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+    CMutableTransaction coinbase(block.vtx[0]);
+    CAmount nValue = coinbase.vout[0].nValue;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = nValue - nValue / 5 * 3;
+    coinbase.vout.push_back(CTxOut(nValue / 5 * 3, payee));
+    block.vtx[0] = CTransaction(coinbase);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+
+    BOOST_CHECK(ProcessNewBlock(chainparams, &block, true, NULL, NULL));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    return block;
+}
+
+BOOST_FIXTURE_TEST_CASE(masternode_payment_index_backfill, TestChain100Setup)
+{
+    CMasternodePaymentIndex index;
+    CScript payee = GetScriptForDestination(RandomPubKey().GetID());
+
+    MinePaymentBlock(payee);
+    int nHeightFirst = chainActive.Height();
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), CScript() << OP_TRUE);
+
+    // blocks connected before the index was populated are read from disk
+    index.Backfill(chainActive.Tip(), 10);
+    std::vector<std::pair<int, int64_t> > vecPayments = index.GetPayments(payee, 0, chainActive.Height());
+    BOOST_REQUIRE_EQUAL(vecPayments.size(), 1);
+    BOOST_CHECK_EQUAL(vecPayments[0].first, nHeightFirst);
+    BOOST_CHECK_EQUAL(vecPayments[0].second, chainActive[nHeightFirst]->GetBlockTime());
+
+    // newer blocks come from BlockConnected, only older ones are read again
+    CBlock block = MinePaymentBlock(payee);
+    index.BlockConnected(block, chainActive.Tip());
+    index.Backfill(chainActive.Tip(), 10);
+    BOOST_CHECK_EQUAL(index.GetPayments(payee, 0, chainActive.Height()).size(), 2);
+    block = MinePaymentBlock(payee);
+    index.BlockConnected(block, chainActive.Tip());
+    index.Backfill(chainActive.Tip(), 20);
+    vecPayments = index.GetPayments(payee, 0, chainActive.Height());
+    BOOST_REQUIRE_EQUAL(vecPayments.size(), 3);
+    BOOST_CHECK_EQUAL(vecPayments[0].first, chainActive.Height());
+    BOOST_CHECK_EQUAL(vecPayments[2].first, nHeightFirst);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,47 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messagesigner.h"
+#include "random.h"
+
+#include "test/test_pura.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(messagesigner_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(verifyhash_cache)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(CHashSigner::SignHash(hash, key, vchSig));
+
+    std::string strError;
+    CHashSignatureCacheStats statsBefore = CHashSigner::GetCacheStats();
+
+    // the first check recovers the key, the second one is a cache hit
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key.GetPubKey(), vchSig, strError));
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key.GetPubKey(), vchSig, strError));
+    CHashSignatureCacheStats stats = CHashSigner::GetCacheStats();
+    BOOST_CHECK_EQUAL(stats.nMisses, statsBefore.nMisses + 1);
+    BOOST_CHECK_EQUAL(stats.nHits, statsBefore.nHits + 1);
+    BOOST_CHECK_EQUAL(stats.nEntries, statsBefore.nEntries + 1);
+
+    // the cached result doesn't apply to another key or hash
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, keyOther.GetPubKey(), vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(GetRandHash(), key.GetPubKey(), vchSig, strError));
+
+    // invalid signatures are not cached
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, keyOther.GetPubKey(), vchSig, strError));
+    stats = CHashSigner::GetCacheStats();
+    BOOST_CHECK_EQUAL(stats.nMisses, statsBefore.nMisses + 4);
+    BOOST_CHECK_EQUAL(stats.nHits, statsBefore.nHits + 1);
+    BOOST_CHECK_EQUAL(stats.nEntries, statsBefore.nEntries + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,152 @@
+// Copyright (c) 2017-2017 The Pura Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messagesigner.h"
+#include "messagesigqueue.h"
+
+#include "test/test_pura.h"
+
+#include <atomic>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(messagesigqueue_tests, BasicTestingSetup)
+
+static std::vector<CMessageSigCheck> MakeChecks(const CKey& key, int nCount, int nInvalid)
+{
+    std::vector<CMessageSigCheck> vChecks;
+    for(int i = 0; i < nCount; ++i) {
+        std::string strMessage = strprintf("message %d", i);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(CMessageSigner::SignMessage(strMessage, vchSig, key));
+        if(i == nInvalid) {
+            strMessage += " tampered";
+        }
+        vChecks.push_back(CMessageSigCheck(key.GetPubKey(), vchSig, strMessage));
+    }
+    return vChecks;
+}
+
+static void StoreResults(std::vector<bool>& vResults, std::atomic<int>& nDone, const std::vector<CMessageSigCheck>& vChecks)
+{
+    for(size_t i = 0; i < vChecks.size(); ++i) {
+        vResults[i] = vChecks[i].fValid;
+    }
+    ++nDone;
+}
+
+BOOST_AUTO_TEST_CASE(messagesigqueue_inline)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    // without workers the caller verifies the batch
+    CMessageSigQueue queue;
+    std::vector<bool> vResults(3);
+    std::atomic<int> nDone(0);
+    queue.Add(MakeChecks(key, 3, 1), std::bind(&StoreResults, std::ref(vResults), std::ref(nDone), std::placeholders::_1));
+    BOOST_CHECK_EQUAL(nDone, 1);
+    BOOST_CHECK(vResults[0] && !vResults[1] && vResults[2]);
+}
+
+BOOST_AUTO_TEST_CASE(messagesigqueue_workers)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CMessageSigQueue queue;
+    boost::thread_group threadGroup;
+    for(int i = 0; i < 3; ++i) {
+        threadGroup.create_thread(boost::bind(&CMessageSigQueue::Thread, &queue));
+    }
+    // make sure the workers are registered before queueing
+    queue.WaitForWorkers(3);
+
+    const int nBatches = 20;
+    std::vector<std::vector<bool> > vResults(nBatches, std::vector<bool>(2));
+    std::atomic<int> nDone(0);
+    for(int i = 0; i < nBatches; ++i) {
+        queue.Add(MakeChecks(key, 2, i % 2), std::bind(&StoreResults, std::ref(vResults[i]), std::ref(nDone), std::placeholders::_1));
+    }
+    queue.Flush();
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    BOOST_CHECK_EQUAL(nDone, nBatches);
+    BOOST_CHECK_EQUAL(queue.size(), 0U);
+    for(int i = 0; i < nBatches; ++i) {
+        BOOST_CHECK_EQUAL(vResults[i][0], i % 2 != 0);
+        BOOST_CHECK_EQUAL(vResults[i][1], i % 2 != 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(messagesigqueue_full)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CMessageSigQueue queue(1);
+    boost::thread_group threadGroup;
+    threadGroup.create_thread(boost::bind(&CMessageSigQueue::Thread, &queue));
+    queue.WaitForWorkers(1);
+
+    // keep the only worker busy with the first batch until told otherwise
+    std::atomic<bool> fRelease(false);
+    std::atomic<int> nDone(0);
+    auto block = [&](const std::vector<CMessageSigCheck>&) { while(!fRelease) MilliSleep(1); ++nDone; };
+    BOOST_CHECK(queue.Add(MakeChecks(key, 1, -1), block));
+    while(queue.size() > 0) MilliSleep(1);
+
+    // one batch fits in the queue, the next one is refused instead of being verified by the caller
+    std::vector<bool> vResults(1);
+    BOOST_CHECK(queue.Add(MakeChecks(key, 1, -1), std::bind(&StoreResults, std::ref(vResults), std::ref(nDone), std::placeholders::_1)));
+    BOOST_CHECK(!queue.Add(MakeChecks(key, 1, -1), std::bind(&StoreResults, std::ref(vResults), std::ref(nDone), std::placeholders::_1)));
+    BOOST_CHECK_EQUAL(nDone, 0);
+
+    fRelease = true;
+    queue.Flush();
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    BOOST_CHECK_EQUAL(nDone, 2);
+    BOOST_CHECK(vResults[0]);
+}
+
+BOOST_AUTO_TEST_CASE(messagesigqueue_checked_signature)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+
+    std::vector<CMessageSigCheck> vChecks = MakeChecks(key, 1, -1);
+    CMessageSigCheck& check = vChecks[0];
+    std::string strError;
+
+    // the result of the queue is used for the same key, signature and message only
+    check.fValid = false;
+    CCheckedSignature checkedSig;
+    checkedSig.Set(check);
+    BOOST_CHECK(!checkedSig.Verify(key.GetPubKey(), check.vchSig, check.strMessage, strError));
+    BOOST_CHECK(!checkedSig.Verify(keyOther.GetPubKey(), check.vchSig, check.strMessage, strError));
+
+    check.pubkey = keyOther.GetPubKey();
+    checkedSig.Set(check);
+    BOOST_CHECK(checkedSig.Verify(key.GetPubKey(), check.vchSig, check.strMessage, strError));
+
+    // a message changed after its signature was checked is verified again
+    check.pubkey = key.GetPubKey();
+    check.fValid = true;
+    checkedSig.Set(check);
+    BOOST_CHECK(checkedSig.Verify(key.GetPubKey(), check.vchSig, check.strMessage, strError));
+    BOOST_CHECK(!checkedSig.Verify(key.GetPubKey(), check.vchSig, check.strMessage + " tampered", strError));
+    std::vector<unsigned char> vchSigOther;
+    BOOST_CHECK(CMessageSigner::SignMessage("other message", vchSigOther, key));
+    BOOST_CHECK(!checkedSig.Verify(key.GetPubKey(), vchSigOther, check.strMessage, strError));
+
+    // nothing checked yet
+    BOOST_CHECK(CCheckedSignature().Verify(key.GetPubKey(), check.vchSig, check.strMessage, strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,6 +21,8 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <numeric>
+
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
 
 static
@@ -388,4 +390,175 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+// Spend output n of txPrev, paying to key's scriptPubKey, into one output per amount
+static CMutableTransaction SpendOutput(const CTransaction& txPrev, uint32_t n, const CKey& key, const CScript& scriptPubKey, const std::vector<CAmount>& vValues)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), n);
+    tx.vout.resize(vValues.size());
+    for (size_t i = 0; i < vValues.size(); i++) {
+        tx.vout[i].nValue = vValues[i];
+        tx.vout[i].scriptPubKey = scriptPubKey;
+    }
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+static CMutableTransaction SpendCoinbase(const CTransaction& coinbase, const CKey& key, const CScript& scriptPubKey, CAmount nValue)
+{
+    return SpendOutput(coinbase, 0, key, scriptPubKey, std::vector<CAmount>(1, nValue));
+}
+
+static std::set<uint256> GetTemplateTxids(const CBlockTemplate& blocktemplate)
+{
+    std::set<uint256> setTxids;
+    for (size_t i = 1; i < blocktemplate.block.vtx.size(); i++)
+        setTxids.insert(blocktemplate.block.vtx[i].GetHash());
+    return setTxids;
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateBuilder_incremental, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CScript scriptDummy = CScript() << OP_TRUE;
+    CBlockTemplateBuilder builder;
+    CValidationState state;
+
+    LOCK(cs_main);
+
+    // First template is always built from scratch, and reused while nothing changes
+    CBlockTemplate* pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    CAmount nReward = pblocktemplate->block.vtx[0].GetValueOut();
+    BOOST_CHECK(builder.GetBlockTemplate(Params(), scriptDummy) == pblocktemplate);
+    BOOST_CHECK_EQUAL(builder.GetFullRebuilds(), 1);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 0);
+
+    // A new mempool transaction is added to the existing template
+    CMutableTransaction tx1 = SpendCoinbase(coinbaseTxns[0], coinbaseKey, scriptPubKey, coinbaseTxns[0].vout[0].nValue - CENT);
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, tx1, false, NULL, true, false));
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetFullRebuilds(), 1);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == tx1.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -CENT);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].GetValueOut(), nReward + CENT);
+
+    // ... and dropped from it again once it leaves the mempool
+    std::list<CTransaction> removed;
+    mempool.remove(tx1, removed, true);
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 2);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].GetValueOut(), nReward);
+
+    // Past the maximum staleness the template is built from scratch again
+    SetMockTime(GetTime() + DEFAULT_BLOCK_TEMPLATE_MAX_STALENESS);
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, tx1, false, NULL, true, false));
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetFullRebuilds(), 2);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 2);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+
+    // So is it for a new tip
+    mempool.clear();
+    std::vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetFullRebuilds(), 3);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    SetMockTime(0);
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateBuilder_replace, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CScript scriptDummy = CScript() << OP_TRUE;
+    CBlockTemplateBuilder builder;
+    CValidationState state;
+
+    // Confirmed outputs for independent transactions
+    const CAmount nValue = 10 * CENT;
+    CMutableTransaction fanout = SpendOutput(coinbaseTxns[0], 0, coinbaseKey, scriptPubKey, std::vector<CAmount>(8, nValue));
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, fanout), scriptPubKey);
+
+    // Room for three of them, chosen by fee only
+    mapArgs["-blockmaxsize"] = "1600";
+    mapArgs["-blockprioritysize"] = "0";
+
+    LOCK(cs_main);
+
+    // Five transactions paying 1 to 5 units of fee
+    const CAmount nFeeUnit = CENT / 10;
+    std::vector<CMutableTransaction> vtx;
+    for (int i = 0; i < 5; i++) {
+        vtx.push_back(SpendOutput(fanout, i, coinbaseKey, scriptPubKey, std::vector<CAmount>(1, nValue - (i + 1) * nFeeUnit)));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, vtx.back(), false, NULL, true, false));
+    }
+    CBlockTemplate* pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    std::set<uint256> setTxids = GetTemplateTxids(*pblocktemplate);
+    BOOST_CHECK_EQUAL(setTxids.size(), 3);
+    BOOST_CHECK(setTxids.count(vtx[4].GetHash()) && setTxids.count(vtx[3].GetHash()) && setTxids.count(vtx[2].GetHash()));
+
+    // Evict the best one and replace it by a spend of the same output paying
+    // less than anything else.  The freed space goes to the best transaction
+    // that did not fit before, as in a template built from scratch.
+    std::list<CTransaction> removed;
+    mempool.remove(vtx[4], removed, true);
+    CMutableTransaction txReplacement = SpendOutput(fanout, 4, coinbaseKey, scriptPubKey, std::vector<CAmount>(1, nValue - nFeeUnit / 2));
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, txReplacement, false, NULL, true, false));
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 1);
+    setTxids = GetTemplateTxids(*pblocktemplate);
+    BOOST_CHECK(setTxids.count(vtx[1].GetHash()));
+    BOOST_CHECK(!setTxids.count(txReplacement.GetHash()));
+    std::unique_ptr<CBlockTemplate> pblocktemplateFull(CreateNewBlock(Params(), scriptDummy));
+    BOOST_CHECK(setTxids == GetTemplateTxids(*pblocktemplateFull));
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], pblocktemplateFull->vTxFees[0]);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].GetValueOut(), pblocktemplateFull->block.vtx[0].GetValueOut());
+
+    // A child of an in-template transaction takes the room of a second
+    // eviction
+    CMutableTransaction txChild = SpendOutput(vtx[3], 0, coinbaseKey, scriptPubKey, std::vector<CAmount>(1, nValue - 10 * nFeeUnit));
+    mempool.remove(vtx[2], removed, true);
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, txChild, false, NULL, true, false));
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 2);
+    setTxids = GetTemplateTxids(*pblocktemplate);
+    BOOST_CHECK(setTxids.count(vtx[3].GetHash()) && setTxids.count(txChild.GetHash()));
+    pblocktemplateFull.reset(CreateNewBlock(Params(), scriptDummy));
+    BOOST_CHECK(setTxids == GetTemplateTxids(*pblocktemplateFull));
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], pblocktemplateFull->vTxFees[0]);
+
+    // Evicting the parent drops the child from the template as well, and the
+    // fees and sigops are those of what is left
+    mempool.remove(vtx[3], removed, true);
+    pblocktemplate = builder.GetBlockTemplate(Params(), scriptDummy);
+    BOOST_CHECK_EQUAL(builder.GetIncrementalUpdates(), 3);
+    setTxids = GetTemplateTxids(*pblocktemplate);
+    BOOST_CHECK(!setTxids.count(vtx[3].GetHash()));
+    BOOST_CHECK(!setTxids.count(txChild.GetHash()));
+    pblocktemplateFull.reset(CreateNewBlock(Params(), scriptDummy));
+    BOOST_CHECK(setTxids == GetTemplateTxids(*pblocktemplateFull));
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees.size(), pblocktemplate->block.vtx.size());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxSigOps.size(), pblocktemplate->block.vtx.size());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], pblocktemplateFull->vTxFees[0]);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].GetValueOut(), pblocktemplateFull->block.vtx[0].GetValueOut());
+    BOOST_CHECK_EQUAL(std::accumulate(pblocktemplate->vTxSigOps.begin(), pblocktemplate->vTxSigOps.end(), (int64_t)0),
+                      std::accumulate(pblocktemplateFull->vTxSigOps.begin(), pblocktemplateFull->vTxSigOps.end(), (int64_t)0));
+
+    mapArgs.erase("-blockmaxsize");
+    mapArgs.erase("-blockprioritysize");
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
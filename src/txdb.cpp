@@ -11,6 +11,7 @@
 #include "validation.h"
 #include "pow.h"
 #include "uint256.h"
+#include "utiltime.h"
 
 #include <stdint.h>
 
@@ -23,6 +24,8 @@ static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_ADDRESSINDEX = 'a';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCEINDEX = 'w';
+static const char DB_ADDRESSBALANCEBEST = 'W';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
@@ -31,6 +34,7 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_BUILD = 'I';
 
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
@@ -75,7 +79,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, size_t nAddressIndexCacheSize, size_t nSpentIndexCacheSize, size_t nTimestampIndexCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe),
+    addressdb(GetDataDir() / "blocks" / "addressindex", nAddressIndexCacheSize, fMemory, fWipe, true),
+    spentdb(GetDataDir() / "blocks" / "spentindex", nSpentIndexCacheSize, fMemory, fWipe, true),
+    timestampdb(GetDataDir() / "blocks" / "timestampindex", nTimestampIndexCacheSize, fMemory, fWipe, true) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -168,11 +175,11 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
 }
 
 bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(make_pair(DB_SPENTINDEX, key), value);
+    return spentdb.Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
 bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(&GetObfuscateKey());
+    CDBBatch batch(&spentdb.GetObfuscateKey());
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -180,11 +187,11 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
+    return spentdb.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(&GetObfuscateKey());
+    CDBBatch batch(&addressdb.GetObfuscateKey());
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -192,20 +199,31 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
+    return addressdb.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                                           const CAddressUnspentKey *pkeyAfter, size_t nLimit) {
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    boost::scoped_ptr<CDBIterator> pcursor(addressdb.NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    if (pkeyAfter) {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, *pkeyAfter));
+        std::pair<char,CAddressUnspentKey> key;
+        if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX &&
+            key.second.txhash == pkeyAfter->txhash && key.second.index == pkeyAfter->index)
+            pcursor->Next();
+    } else {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (nLimit == 0 || nRead < nLimit)) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressUnspentKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash && key.second.type == (unsigned int)type) {
+            nRead++;
             CAddressUnspentValue nValue;
             if (pcursor->GetValue(nValue)) {
                 unspentOutputs.push_back(make_pair(key.second, nValue));
@@ -222,38 +240,48 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
 }
 
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(&GetObfuscateKey());
+    CDBBatch batch(&addressdb.GetObfuscateKey());
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
+    return addressdb.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(&GetObfuscateKey());
+    CDBBatch batch(&addressdb.GetObfuscateKey());
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
+    return addressdb.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+                                    int start, int end,
+                                    const CAddressIndexKey *pkeyAfter, size_t nLimit) {
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    boost::scoped_ptr<CDBIterator> pcursor(addressdb.NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (pkeyAfter) {
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pkeyAfter));
+        std::pair<char,CAddressIndexKey> key;
+        if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX &&
+            key.second.blockHeight == pkeyAfter->blockHeight && key.second.txindex == pkeyAfter->txindex &&
+            key.second.txhash == pkeyAfter->txhash && key.second.index == pkeyAfter->index && key.second.spending == pkeyAfter->spending)
+            pcursor->Next();
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (nLimit == 0 || nRead < nLimit)) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash && key.second.type == (unsigned int)type) {
             if (end > 0 && key.second.blockHeight > end) {
                 break;
             }
+            nRead++;
             CAmount nValue;
             if (pcursor->GetValue(nValue)) {
                 addressIndex.push_back(make_pair(key.second, nValue));
@@ -269,15 +297,41 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     return true;
 }
 
+bool CBlockTreeDB::ReadAddressBalanceIndex(uint160 addressHash, int type, CAddressBalanceValue &balance) {
+    if (!addressdb.Read(make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(type, addressHash)), balance))
+        balance.SetNull();
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressBalanceBestBlock(uint256 &hashBlock) {
+    if (!addressdb.Read(DB_ADDRESSBALANCEBEST, hashBlock))
+        hashBlock.SetNull();
+    return true;
+}
+
+bool CBlockTreeDB::UpdateAddressBalanceIndex(const std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> >&vect, const uint256 *phashBestBlock) {
+    CDBBatch batch(&addressdb.GetObfuscateKey());
+    if (phashBestBlock)
+        batch.Write(DB_ADDRESSBALANCEBEST, *phashBestBlock);
+    for (std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSBALANCEINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSBALANCEINDEX, it->first), it->second);
+        }
+    }
+    return addressdb.WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(&GetObfuscateKey());
+    CDBBatch batch(&timestampdb.GetObfuscateKey());
     batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
+    return timestampdb.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    boost::scoped_ptr<CDBIterator> pcursor(timestampdb.NewIterator());
 
     pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
 
@@ -307,10 +361,145 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::ReadIndexBuildCursor(const std::string &name, uint256 &hashBlock) {
+    return Read(std::make_pair(DB_INDEX_BUILD, name), hashBlock);
+}
+
+bool CBlockTreeDB::WriteIndexBuildCursor(const std::string &name, const uint256 &hashBlock) {
+    return Write(std::make_pair(DB_INDEX_BUILD, name), hashBlock);
+}
+
+bool CBlockTreeDB::EraseIndexBuildCursor(const std::string &name) {
+    return Erase(std::make_pair(DB_INDEX_BUILD, name), true);
+}
+
+bool CBlockTreeDB::RebuildAddressBalanceIndex(const uint256 &hashBestBlock) {
+    static const size_t BALANCE_BATCH_SIZE = 10000;
+
+    // Drop the records of an earlier, interrupted rebuild first
+    if (!addressdb.Erase(DB_ADDRESSBALANCEBEST, true))
+        return error("%s: failed to erase the address balance best block", __func__);
+    boost::scoped_ptr<CDBIterator> pcursor(addressdb.NewIterator());
+    pcursor->Seek(DB_ADDRESSBALANCEINDEX);
+    std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> > vBalances;
+    while (true) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexIteratorKey> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSBALANCEINDEX;
+        if (fValid)
+            vBalances.push_back(make_pair(key.second, CAddressBalanceValue()));
+        if (!fValid || vBalances.size() >= BALANCE_BATCH_SIZE) {
+            if (!UpdateAddressBalanceIndex(vBalances))
+                return error("%s: failed to erase address balance records", __func__);
+            vBalances.clear();
+        }
+        if (!fValid)
+            break;
+        pcursor->Next();
+    }
+
+    // The deltas of an address are sorted by height and position in the
+    // block, so those of one transaction are adjacent
+    CAddressIndexIteratorKey keyAddress;
+    CAddressBalanceValue balance;
+    uint256 hashLastTx;
+    size_t nAddresses = 0;
+    pcursor->Seek(DB_ADDRESSINDEX);
+    while (true) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX;
+        if (!balance.IsNull() && (!fValid || key.second.type != keyAddress.type || key.second.hashBytes != keyAddress.hashBytes)) {
+            vBalances.push_back(make_pair(keyAddress, balance));
+            balance.SetNull();
+            hashLastTx.SetNull();
+            nAddresses++;
+        }
+        if (!fValid || vBalances.size() >= BALANCE_BATCH_SIZE) {
+            if (!UpdateAddressBalanceIndex(vBalances, fValid ? NULL : &hashBestBlock))
+                return error("%s: failed to write address balance records", __func__);
+            vBalances.clear();
+        }
+        if (!fValid)
+            break;
+
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("%s: failed to read address index value", __func__);
+        keyAddress = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+        if (nValue > 0)
+            balance.received += nValue;
+        balance.balance += nValue;
+        if (key.second.txhash != hashLastTx) {
+            balance.txCount++;
+            hashLastTx = key.second.txhash;
+        }
+        pcursor->Next();
+    }
+
+    LogPrintf("Wrote balance records for %u addresses\n", nAddresses);
+    return true;
+}
+
+/** Move all entries of one index from the block database to another, a batch at a time */
+template <typename K, typename V>
+static bool MoveIndexEntries(CDBWrapper& from, CDBWrapper& to, char chIndex, const char* pszName)
+{
+    static const size_t MIGRATE_BATCH_SIZE = 10000;
+
+    boost::scoped_ptr<CDBIterator> pcursor(from.NewIterator());
+    pcursor->Seek(chIndex);
+
+    size_t nMoved = 0;
+    bool fDone = false;
+    while (!fDone) {
+        boost::this_thread::interruption_point();
+        CDBBatch batchTo(&to.GetObfuscateKey());
+        CDBBatch batchFrom(&from.GetObfuscateKey());
+        size_t nBatch = 0;
+        for (; nBatch < MIGRATE_BATCH_SIZE; nBatch++) {
+            std::pair<char, K> key;
+            if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != chIndex) {
+                fDone = true;
+                break;
+            }
+            V value;
+            if (!pcursor->GetValue(value))
+                return error("%s: failed to read %s entry", __func__, pszName);
+            batchTo.Write(key, value);
+            batchFrom.Erase(key);
+            pcursor->Next();
+        }
+        if (nBatch == 0)
+            break;
+        // Entries are written to their new place before being erased, so an
+        // interrupted migration picks up where it stopped
+        if (!to.WriteBatch(batchTo, true) || !from.WriteBatch(batchFrom, true))
+            return error("%s: failed to move %s entries", __func__, pszName);
+        nMoved += nBatch;
+    }
+
+    if (nMoved > 0)
+        LogPrintf("Moved %u %s entries out of the block index database\n", nMoved, pszName);
+    return true;
+}
+
+bool CBlockTreeDB::MigrateIndexes() {
+    return MoveIndexEntries<CAddressIndexKey, CAmount>(*this, addressdb, DB_ADDRESSINDEX, "address index") &&
+           MoveIndexEntries<CAddressUnspentKey, CAddressUnspentValue>(*this, addressdb, DB_ADDRESSUNSPENTINDEX, "address unspent index") &&
+           MoveIndexEntries<CAddressIndexIteratorKey, CAddressBalanceValue>(*this, addressdb, DB_ADDRESSBALANCEINDEX, "address balance index") &&
+           MoveIndexEntries<CSpentIndexKey, CSpentIndexValue>(*this, spentdb, DB_SPENTINDEX, "spent index") &&
+           MoveIndexEntries<CTimestampIndexKey, int>(*this, timestampdb, DB_TIMESTAMPINDEX, "timestamp index");
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
+    size_t nEntries = 0;
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nTimePoW = 0;
+
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
 
     // Load mapBlockIndex
@@ -334,9 +523,12 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
+                nEntries++;
 
+                int64_t nTime1 = GetTimeMicros();
                 if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
                     return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
+                nTimePoW += GetTimeMicros() - nTime1;
 
                 pcursor->Next();
             } else {
@@ -347,5 +539,9 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         }
     }
 
+    int64_t nTimeTotal = GetTimeMicros() - nTimeStart;
+    LogPrintf("%s: loaded %u block index entries in %.2fms (read %.2fms, pow %.2fms)\n", __func__,
+        nEntries, nTimeTotal * 0.001, (nTimeTotal - nTimePoW) * 0.001, nTimePoW * 0.001);
+
     return true;
 }
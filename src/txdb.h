@@ -16,11 +16,13 @@
 
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
 struct CDiskTxPos;
 struct CAddressUnspentKey;
 struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
+struct CAddressBalanceValue;
 struct CAddressIndexIteratorHeightKey;
 struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
@@ -50,14 +52,23 @@ public:
     bool GetStats(CCoinsStats &stats) const;
 };
 
-/** Access to the block database (blocks/index/) */
+/**
+ * Access to the block database (blocks/index/). The optional address, spent
+ * and timestamp indexes are kept in databases of their own
+ * (blocks/addressindex/, blocks/spentindex/, blocks/timestampindex/), each
+ * with a cache size of its own.
+ */
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, size_t nAddressIndexCacheSize, size_t nSpentIndexCacheSize, size_t nTimestampIndexCacheSize, bool fMemory = false, bool fWipe = false);
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    CDBWrapper addressdb;
+    CDBWrapper spentdb;
+    CDBWrapper timestampdb;
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
@@ -69,17 +80,33 @@ public:
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
+    /** Read the unspent outputs of an address in key order, after *pkeyAfter if given and at most nLimit of them if not 0 */
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect,
+                                 const CAddressUnspentKey *pkeyAfter = NULL, size_t nLimit = 0);
     bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    /** Read the deltas of an address in key order, after *pkeyAfter if given and at most nLimit of them if not 0 */
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                          int start = 0, int end = 0);
+                          int start = 0, int end = 0,
+                          const CAddressIndexKey *pkeyAfter = NULL, size_t nLimit = 0);
+    bool ReadAddressBalanceIndex(uint160 addressHash, int type, CAddressBalanceValue &balance);
+    /** The last block the balance records include, null if they were written before it was kept */
+    bool ReadAddressBalanceBestBlock(uint256 &hashBlock);
+    bool UpdateAddressBalanceIndex(const std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> > &vect, const uint256 *phashBestBlock = NULL);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    /** The last block an optional index being built in the background has the entries of */
+    bool ReadIndexBuildCursor(const std::string &name, uint256 &hashBlock);
+    bool WriteIndexBuildCursor(const std::string &name, const uint256 &hashBlock);
+    bool EraseIndexBuildCursor(const std::string &name);
+    /** Recompute the per-address balance records from the deltas in the address index, which has the entries up to hashBestBlock */
+    bool RebuildAddressBalanceIndex(const uint256 &hashBestBlock);
+    /** Move index entries left in blocks/index/ by older versions to their own databases */
+    bool MigrateIndexes();
     bool LoadBlockIndexGuts();
 };
 
@@ -69,10 +69,11 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
-bool fTxIndex = true;
-bool fAddressIndex = false;
-bool fTimestampIndex = false;
-bool fSpentIndex = false;
+std::atomic<bool> fTxIndex(true);
+std::atomic<bool> fAddressIndex(false);
+std::atomic<bool> fAddressBalanceIndex(false);
+std::atomic<bool> fTimestampIndex(false);
+std::atomic<bool> fSpentIndex(false);
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -162,6 +163,9 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Set while VerifyDB reconnects blocks that are already in the indexes. */
+    bool fVerifyingDB = false;
 } // anon namespace
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
@@ -850,20 +854,6 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                 // Save these to avoid repeated lookups
                 setIterConflicting.insert(mi);
 
-                // If this entry is "dirty", then we don't have descendant
-                // state for this transaction, which means we probably have
-                // lots of in-mempool descendants.
-                // Don't allow replacements of dirty transactions, to ensure
-                // that we don't spend too much time walking descendants.
-                // This should be rare.
-                if (mi->IsDirty()) {
-                    return state.DoS(0,
-                            error("AcceptToMemoryPool: rejecting replacement %s; cannot replace tx %s with untracked descendants",
-                                hash.ToString(),
-                                mi->GetTx().GetHash().ToString()),
-                            REJECT_NONSTANDARD, "too many potential replacements");
-                }
-
                 // Don't allow the replacement to reduce the feerate of the
                 // mempool.
                 //
@@ -1065,24 +1055,114 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 }
 
 bool GetAddressIndex(uint160 addressHash, int type,
-                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end,
+                     const CAddressIndexKey *pkeyAfter, size_t nLimit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, pkeyAfter, nLimit))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (fAddressBalanceIndex) {
+        if (!pblocktree->ReadAddressBalanceIndex(addressHash, type, balance))
+            return error("unable to get balance for address");
+        return true;
+    }
+
+    // Address index built before the balance records existed: add up the deltas
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex))
+        return error("unable to get txids for address");
+
+    balance.SetNull();
+    std::set<uint256> setTxids;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = addressIndex.begin(); it != addressIndex.end(); it++) {
+        if (it->second > 0)
+            balance.received += it->second;
+        balance.balance += it->second;
+        setTxids.insert(it->first.txhash);
+    }
+    balance.txCount = setTxids.size();
+
+    return true;
+}
+
+/**
+ * Apply the address index deltas of a block to the per-address balance
+ * records. The deltas of one transaction are always adjacent, which is what
+ * the transaction count relies on.
+ *
+ * Unlike the deltas, the totals are not keyed by block, so a block must not
+ * be added twice. That would happen when blocks are replayed after an unclean
+ * shutdown, as the address index is written before the coins are flushed.
+ * The records remember the last block they include for that.
+ */
+bool UpdateAddressBalances(const std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, const CBlockIndex* pindex, bool fConnect)
+{
+    uint256 hashBest;
+    if (!pblocktree->ReadAddressBalanceBestBlock(hashBest))
+        return false;
+    if (!hashBest.IsNull()) {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBest);
+        const CBlockIndex* pindexBest = mi == mapBlockIndex.end() ? NULL : mi->second;
+        if (fConnect && pindexBest && pindexBest->GetAncestor(pindex->nHeight) == pindex)
+            return true;
+        if (!fConnect && pindexBest != pindex)
+            return true;
+    }
+
+    std::map<std::pair<unsigned int, uint160>, std::pair<CAddressBalanceValue, uint256> > mapDeltas;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = addressIndex.begin(); it != addressIndex.end(); it++) {
+        std::pair<CAddressBalanceValue, uint256>& delta = mapDeltas[std::make_pair(it->first.type, it->first.hashBytes)];
+        if (it->second > 0)
+            delta.first.received += it->second;
+        delta.first.balance += it->second;
+        if (delta.second != it->first.txhash) {
+            delta.first.txCount++;
+            delta.second = it->first.txhash;
+        }
+    }
+
+    std::vector<std::pair<CAddressIndexIteratorKey, CAddressBalanceValue> > vBalances;
+    for (std::map<std::pair<unsigned int, uint160>, std::pair<CAddressBalanceValue, uint256> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++) {
+        CAddressBalanceValue balance;
+        if (!pblocktree->ReadAddressBalanceIndex(it->first.second, it->first.first, balance))
+            return false;
+        const CAddressBalanceValue& delta = it->second.first;
+        if (fConnect) {
+            balance.balance += delta.balance;
+            balance.received += delta.received;
+            balance.txCount += delta.txCount;
+        } else {
+            balance.balance -= delta.balance;
+            balance.received -= delta.received;
+            balance.txCount -= delta.txCount;
+        }
+        vBalances.push_back(std::make_pair(CAddressIndexIteratorKey(it->first.first, it->first.second), balance));
+    }
+
+    const uint256 hashBestNew = fConnect ? pindex->GetBlockHash() : pindex->pprev->GetBlockHash();
+    return pblocktree->UpdateAddressBalanceIndex(vBalances, &hashBestNew);
+}
+
 bool GetAddressUnspent(uint160 addressHash, int type,
-                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       const CAddressUnspentKey *pkeyAfter, size_t nLimit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs, pkeyAfter, nLimit))
         return error("unable to get txids for address");
 
     return true;
@@ -1615,6 +1695,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1642,6 +1724,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1834,6 +1918,9 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         if (!pblocktree->EraseAddressIndex(addressIndex)) {
             return AbortNode(state, "Failed to delete address index");
         }
+        if (fAddressBalanceIndex && !UpdateAddressBalances(addressIndex, pindex, false)) {
+            return AbortNode(state, "Failed to update address balance index");
+        }
         if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
             return AbortNode(state, "Failed to write address unspent index");
         }
@@ -2237,6 +2324,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return AbortNode(state, "Failed to write address index");
         }
 
+        // VerifyDB reconnects blocks the records already include
+        if (fAddressBalanceIndex && !fVerifyingDB && !UpdateAddressBalances(addressIndex, pindex, true)) {
+            return AbortNode(state, "Failed to write address balance index");
+        }
+
         if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
             return AbortNode(state, "Failed to write address unspent index");
         }
@@ -2479,6 +2571,8 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    if (!fLiteMode)
+        mnpaymentindex.BlockDisconnected(block, pindexDelete);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
@@ -2537,6 +2631,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    if (!fLiteMode)
+        mnpaymentindex.BlockConnected(*pblock, pindexNew);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
@@ -2898,10 +2994,9 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -3067,9 +3162,14 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
 }
 
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+{
+    return CheckBlockHeader(block, fCheckPOW ? block.GetHash() : uint256(), state, fCheckPOW);
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, bool fCheckPOW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+    if (fCheckPOW && !CheckProofOfWork(hash, block.nBits, Params().GetConsensus()))
         return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
                          REJECT_INVALID, "high-hash");
 
@@ -3082,6 +3182,14 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
 }
 
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    if (block.fChecked)
+        return true;
+
+    return CheckBlock(block, fCheckPOW ? block.GetHash() : uint256(), state, fCheckPOW, fCheckMerkleRoot);
+}
+
+bool CheckBlock(const CBlock& block, const uint256& hash, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
 
@@ -3090,7 +3198,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, fCheckPOW))
+    if (!CheckBlockHeader(block, hash, state, fCheckPOW))
         return false;
 
     // Check the merkle root.
@@ -3275,11 +3383,10 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
 
@@ -3296,7 +3403,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state))
+        if (!CheckBlockHeader(block, hash, state))
             return false;
 
         // Get prev block index
@@ -3316,7 +3423,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return false;
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3329,10 +3436,18 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
+    std::vector<uint256> vHashes;
+    GetBlockHeaderHashes(headers, vHashes);
+    return ProcessNewBlockHeaders(headers, vHashes, state, chainparams, ppindex);
+}
+
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, const std::vector<uint256>& vHashes, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    assert(headers.size() == vHashes.size());
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
-            if (!AcceptBlockHeader(header, state, chainparams, ppindex)) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (!AcceptBlockHeader(headers[i], vHashes[i], state, chainparams, ppindex)) {
                 return false;
             }
         }
@@ -3342,7 +3457,7 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
 }
 
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+static bool AcceptBlock(const CBlock& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
 {
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -3350,7 +3465,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, hash, state, chainparams, &pindex))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3380,7 +3495,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if ((!CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    if ((!CheckBlock(block, hash, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -3435,7 +3550,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool
         CBlockIndex *pindex = NULL;
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
-        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fForceProcessing, dbp, fNewBlock);
+        bool ret = AcceptBlock(*pblock, pblock->GetHash(), state, chainparams, &pindex, fForceProcessing, dbp, fNewBlock);
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
             GetMainSignals().BlockChecked(*pblock, state);
@@ -3651,6 +3766,14 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/** Read an index flag from the block tree, keeping fIndex as it is if the flag is not there */
+static void ReadIndexFlag(const std::string& strName, std::atomic<bool>& fIndex)
+{
+    bool fValue = fIndex;
+    pblocktree->ReadFlag(strName, fValue);
+    fIndex = fValue;
+}
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
@@ -3660,6 +3783,7 @@ bool static LoadBlockIndexDB()
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nTimeStart = GetTimeMicros();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -3695,6 +3819,7 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: linked %u block index entries in %.2fms\n", __func__, vSortedByHeight.size(), (GetTimeMicros() - nTimeStart) * 0.001);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -3742,19 +3867,25 @@ bool static LoadBlockIndexDB()
     fReindex |= fReindexing;
 
     // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
+    ReadIndexFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
     // Check whether we have an address index
-    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    ReadIndexFlag("addressindex", fAddressIndex);
     LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
 
+    // Address indexes created before the balance records were added have to
+    // be reindexed to get them
+    fAddressBalanceIndex = false;
+    ReadIndexFlag("addressbalanceindex", fAddressBalanceIndex);
+    fAddressBalanceIndex = fAddressBalanceIndex && fAddressIndex;
+
     // Check whether we have a timestamp index
-    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    ReadIndexFlag("timestampindex", fTimestampIndex);
     LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
 
     // Check whether we have a spent index
-    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    ReadIndexFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
     // Load pointer to end of best chain
@@ -3844,6 +3975,11 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     // check level 4: try reconnecting blocks
     if (nCheckLevel >= 4) {
         CBlockIndex *pindex = pindexState;
+        // The indexes already have the entries of these blocks
+        struct CVerifyingDB {
+            CVerifyingDB() { fVerifyingDB = true; }
+            ~CVerifyingDB() { fVerifyingDB = false; }
+        } verifying;
         while (pindex != chainActive.Tip()) {
             boost::this_thread::interruption_point();
             uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
@@ -3913,6 +4049,8 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -addressindex in the new database
     fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
     pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fAddressBalanceIndex = fAddressIndex.load();
+    pblocktree->WriteFlag("addressbalanceindex", fAddressBalanceIndex);
 
     // Use the provided setting for -timestampindex in the new database
     fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
@@ -3935,7 +4073,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
                 return error("%s: FindBlockPos failed", __func__);
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("%s: writing genesis block to disk failed", __func__);
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("%s: genesis block not accepted", __func__);
             if (!ActivateBestChain(state, chainparams, &block))
@@ -3950,113 +4088,329 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+/** Most blocks read from a block file before they are handed to the check threads */
+static const size_t IMPORT_BATCH_BLOCKS = 1024;
+/** Most bytes of raw block data read from a block file in one batch */
+static const size_t IMPORT_BATCH_BYTES = 4 * MAX_BLOCK_SIZE;
+/** Blocks checked by one CBlockImportCheck */
+static const size_t IMPORT_CHECK_BLOCKS = 8;
+
+/** A block found in a block file, on its way from the reader to ImportBlockBatch */
+struct CImportedBlock
+{
+    //! where the block starts in the file
+    uint64_t nPos;
+    //! where to scan for the next block should this one turn out to be bad
+    uint64_t nRewind;
+    unsigned int nSize;
+    //! whether all nSize bytes could be read from the file
+    bool fRead;
+    //! raw block data, dropped once deserialized
+    CDataStream ssData;
+    CBlock block;
+    uint256 hash;
+    //! bytes of ssData making up the block, 0 if it did not deserialize
+    unsigned int nRead;
+    std::string strError;
+
+    CImportedBlock() : nPos(0), nRewind(0), nSize(0), fRead(false), ssData(SER_DISK, CLIENT_VERSION), nRead(0) {}
+};
+
+/**
+ * Deserialize a run of imported blocks, X11 their headers and run the
+ * context-independent CheckBlock on them. A failure is not reported here:
+ * AcceptBlock runs CheckBlock again for any block that did not pass, in file
+ * order.
+ */
+class CBlockImportCheck
+{
+private:
+    CImportedBlock* pblocks;
+    size_t nCount;
+
+public:
+    CBlockImportCheck() : pblocks(NULL), nCount(0) {}
+    CBlockImportCheck(CImportedBlock* pblocksIn, size_t nCountIn) : pblocks(pblocksIn), nCount(nCountIn) {}
+
+    bool operator()()
+    {
+        std::vector<CBlockHeader> vHeaders;
+        vHeaders.reserve(nCount);
+        for (size_t i = 0; i < nCount; i++) {
+            CImportedBlock& imported = pblocks[i];
+            if (imported.fRead) {
+                try {
+                    imported.ssData >> imported.block;
+                    imported.nRead = imported.nSize - imported.ssData.size();
+                } catch (const std::exception& e) {
+                    imported.strError = e.what();
+                }
+            }
+            imported.ssData.clear();
+            vHeaders.push_back(imported.block.GetBlockHeader());
+        }
+
+        std::vector<uint256> vHashes;
+        GetBlockHeaderHashes(vHeaders, vHashes);
+        for (size_t i = 0; i < nCount; i++) {
+            CImportedBlock& imported = pblocks[i];
+            if (imported.nRead == 0)
+                continue;
+            imported.hash = vHashes[i];
+            CValidationState state;
+            CheckBlock(imported.block, imported.hash, state);
+        }
+        return true;
+    }
+
+    void swap(CBlockImportCheck& check)
+    {
+        std::swap(pblocks, check.pblocks);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+/**
+ * Scan a block file from nRewind for the next batch of blocks, copying out
+ * their raw data. Returns true once the end of the file is reached.
+ */
+static bool ReadBlockFileBatch(const CChainParams& chainparams, CBufferedFile& blkdat, uint64_t& nRewind, std::vector<CImportedBlock>& vBlocks)
+{
+    size_t nBytes = 0;
+    while (vBlocks.size() < IMPORT_BATCH_BLOCKS && nBytes < IMPORT_BATCH_BYTES) {
+        if (blkdat.eof())
+            return true;
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            return true;
+        }
+
+        vBlocks.push_back(CImportedBlock());
+        CImportedBlock& imported = vBlocks.back();
+        imported.nPos = blkdat.GetPos();
+        imported.nRewind = nRewind;
+        imported.nSize = nSize;
+        try {
+            // read block
+            imported.ssData.resize(nSize);
+            blkdat.read(&imported.ssData[0], nSize);
+            imported.fRead = true;
+            nRewind = blkdat.GetPos();
+            nBytes += nSize;
+        } catch (const std::exception& e) {
+            // keep scanning right after the header, as for a block that does not deserialize
+            imported.strError = e.what();
+        }
+    }
+    return false;
+}
+
+/**
+ * Add a batch of checked blocks to the block index, in the order they were
+ * found in the file. Returns false if the file has to be scanned again from
+ * nRewind, or fStop is set, before the end of the batch.
+ */
+static bool ImportBlockBatch(const CChainParams& chainparams, std::vector<CImportedBlock>& vBlocks, CDiskBlockPos* dbp,
+                             std::multimap<uint256, CDiskBlockPos>& mapBlocksUnknownParent, int& nLoaded, uint64_t& nRewind, bool& fStop)
+{
+    BOOST_FOREACH(CImportedBlock& imported, vBlocks) {
+        boost::this_thread::interruption_point();
+
+        if (!imported.strError.empty()) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, imported.strError);
+            // the reader carries on right after the header of a block it
+            // could not read, but had already gone past one that does not
+            // deserialize
+            if (!imported.fRead)
+                continue;
+            nRewind = imported.nRewind;
+            return false;
+        }
+        if (imported.nRead < imported.nSize) {
+            // pick up scanning where the block ended
+            nRewind = imported.nPos + imported.nRead;
+        }
+
+        if (dbp)
+            dbp->nPos = imported.nPos;
+        const CBlock& block = imported.block;
+        const uint256& hash = imported.hash;
+        try {
+            // detect out of order blocks, and store them for later
+            if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                        block.hashPrevBlock.ToString());
+                if (dbp)
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                if (imported.nRead < imported.nSize)
+                    return false;
+                continue;
+            }
+
+            // process in case the block isn't known yet
+            if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                LOCK(cs_main);
+                CValidationState state;
+                if (AcceptBlock(block, hash, state, chainparams, NULL, true, dbp, NULL))
+                    nLoaded++;
+                if (state.IsError()) {
+                    fStop = true;
+                    return false;
+                }
+            } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+            }
+
+            // Activate the genesis block so normal node progress can continue
+            if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+                CValidationState state;
+                if (!ActivateBestChain(state, chainparams)) {
+                    fStop = true;
+                    return false;
+                }
+            }
+
+            NotifyHeaderTip();
+
+            // Recursively process earlier encountered successors of this block
+            deque<uint256> queue;
+            queue.push_back(hash);
+            while (!queue.empty()) {
+                uint256 head = queue.front();
+                queue.pop_front();
+                std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                while (range.first != range.second) {
+                    std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                    CBlock blockChild;
+                    if (ReadBlockFromDisk(blockChild, it->second, chainparams.GetConsensus()))
+                    {
+                        uint256 hashChild = blockChild.GetHash();
+                        LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, hashChild.ToString(),
+                                head.ToString());
+                        LOCK(cs_main);
+                        CValidationState dummy;
+                        if (AcceptBlock(blockChild, hashChild, dummy, chainparams, NULL, true, &it->second, NULL))
+                        {
+                            nLoaded++;
+                            queue.push_back(hashChild);
+                        }
+                    }
+                    range.first++;
+                    mapBlocksUnknownParent.erase(it);
+                    NotifyHeaderTip();
+                }
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+
+        if (imported.nRead < imported.nSize)
+            return false;
+    }
+    return true;
+}
+
+/** Interrupts and joins the block import check threads when the import ends */
+class CBlockImportThreads
+{
+private:
+    boost::thread_group threadGroup;
+
+public:
+    CBlockImportThreads(CCheckQueue<CBlockImportCheck>& queue, int nThreads)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CBlockImportCheck>::Thread, &queue));
+    }
+
+    ~CBlockImportThreads()
+    {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+};
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
+    // Blocks move through three stages: this thread reads a batch of raw
+    // blocks from the file, the check threads (-par) deserialize, hash and
+    // check it while the batch before it is added to the block index here,
+    // in file order.
+    std::vector<CImportedBlock> vRead, vChecking, vChecked;
+    CCheckQueue<CBlockImportCheck> queue(16);
+    CBlockImportThreads threads(queue, std::max(nScriptCheckThreads - 1, 0));
+
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        bool fEnd = false;
+        bool fStop = false;
+        while (true) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
+            // read the next batch while the one before it is being checked
+            if (!fEnd)
+                fEnd = ReadBlockFileBatch(chainparams, blkdat, nRewind, vRead);
+            if (nScriptCheckThreads)
+                queue.Wait();
+
+            vChecked.swap(vChecking);
+            vChecking.swap(vRead);
+            if (!vChecking.empty()) {
+                std::vector<CBlockImportCheck> vChecks;
+                for (size_t i = 0; i < vChecking.size(); i += IMPORT_CHECK_BLOCKS)
+                    vChecks.push_back(CBlockImportCheck(&vChecking[i], std::min(vChecking.size() - i, IMPORT_CHECK_BLOCKS)));
+                if (nScriptCheckThreads) {
+                    queue.Add(vChecks);
+                } else {
+                    BOOST_FOREACH(CBlockImportCheck& check, vChecks)
+                        check();
                 }
+            }
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            // add the checked batch to the block index while the next one is being checked
+            if (!ImportBlockBatch(chainparams, vChecked, dbp, mapBlocksUnknownParent, nLoaded, nRewind, fStop)) {
+                if (nScriptCheckThreads)
+                    queue.Wait();
+                vChecking.clear();
+                if (fStop)
+                    break;
+                // scan again from within the batch, dropping what was read past it
+                if (!blkdat.SetPos(nRewind))
+                    blkdat.Seek(nRewind);
+                fEnd = false;
             }
+            vChecked.clear();
+
+            if (fEnd && vChecking.empty())
+                break;
         }
+        if (nScriptCheckThreads)
+            queue.Wait();
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
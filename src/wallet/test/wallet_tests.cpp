@@ -3,6 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "wallet/wallet.h"
+#include "wallet/walletdb.h"
+
+#include "privatepay.h"
+#include "script/sign.h"
+#include "random.h"
+#include "script/standard.h"
+#include "validation.h"
 
 #include <set>
 #include <stdint.h>
@@ -23,6 +30,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_FIXTURE_TEST_SUITE(wallet_tests, TestingSetup)
@@ -361,4 +370,187 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 101);
 }
 
+static CMutableTransaction PrivatePayTx(const vector<COutPoint>& vPrevouts, const vector<CAmount>& vAmounts, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    BOOST_FOREACH(const COutPoint& prevout, vPrevouts)
+        tx.vin.push_back(CTxIn(prevout));
+    BOOST_FOREACH(const CAmount& nAmount, vAmounts)
+        tx.vout.push_back(CTxOut(nAmount, scriptPubKey));
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(privatepay_rounds)
+{
+    CPrivatePay::InitStandardDenominations();
+    const CAmount nDenom = CPrivatePay::GetSmallestDenomination();
+
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->AddKey(key));
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+
+    // funding -> denominate with change -> two mixing rounds
+    CMutableTransaction funding = PrivatePayTx(vector<COutPoint>(1, COutPoint(GetRandHash(), 0)), vector<CAmount>(1, 10 * COIN), scriptPubKey);
+    vector<CAmount> vDenominate(2, nDenom);
+    vDenominate.push_back(5 * COIN);
+    CMutableTransaction denominate = PrivatePayTx(vector<COutPoint>(1, COutPoint(funding.GetHash(), 0)), vDenominate, scriptPubKey);
+    vector<COutPoint> vMixInputs;
+    vMixInputs.push_back(COutPoint(denominate.GetHash(), 0));
+    vMixInputs.push_back(COutPoint(denominate.GetHash(), 1));
+    CMutableTransaction mix1 = PrivatePayTx(vMixInputs, vector<CAmount>(2, nDenom), scriptPubKey);
+    vMixInputs[0] = COutPoint(mix1.GetHash(), 0);
+    vMixInputs[1] = COutPoint(mix1.GetHash(), 1);
+    CMutableTransaction mix2 = PrivatePayTx(vMixInputs, vector<CAmount>(2, nDenom), scriptPubKey);
+
+    // The last round arrives first and looks like the start of a chain
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, mix2), false, &walletdb));
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(mix2.GetHash(), 0), 0), 0);
+
+    // Adding its ancestors updates it
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, funding), false, &walletdb));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, denominate), false, &walletdb));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, mix1), false, &walletdb));
+
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(funding.GetHash(), 0), 0), -2);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(denominate.GetHash(), 0), 0), 0);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(denominate.GetHash(), 2), 0), -2);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(mix1.GetHash(), 1), 0), 1);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(mix2.GetHash(), 0), 0), 2);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(mix2.GetHash(), 2), 0), -4);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputPrivatePayRounds(CTxIn(GetRandHash(), 0), 0), -1);
+
+    // A reloaded wallet computes the same rounds again
+    CWallet walletReloaded(pwalletMain->strWalletFile);
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(walletReloaded.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK(walletReloaded.cs_wallet);
+    BOOST_CHECK_EQUAL(walletReloaded.GetRealInputPrivatePayRounds(CTxIn(mix2.GetHash(), 0), 0), 2);
+
+    // A zapped transaction loaded on its own starts a chain again
+    vector<CWalletTx> vWtx;
+    BOOST_CHECK_EQUAL(walletReloaded.ZapWalletTx(vWtx), DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(vWtx.size(), 4);
+    CWallet walletZapped(pwalletMain->strWalletFile);
+    BOOST_CHECK_EQUAL(walletZapped.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK(walletZapped.cs_wallet);
+    BOOST_CHECK(walletZapped.mapWallet.empty());
+    BOOST_CHECK(walletZapped.AddToWallet(CWalletTx(&walletZapped, mix2), true, NULL));
+    BOOST_CHECK_EQUAL(walletZapped.GetRealInputPrivatePayRounds(CTxIn(mix2.GetHash(), 0), 0), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(wallet_balances, TestChain100Setup)
+{
+    fCheckWalletBalances = true;
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKey(coinbaseKey));
+        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+    }
+
+    // None of the 100 coinbases is mature for the wallet yet
+    CAmount nImmature = 0;
+    BOOST_FOREACH(const CTransaction& tx, coinbaseTxns)
+        nImmature += tx.vout[0].nValue;
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 0);
+    BOOST_CHECK_EQUAL(pwalletMain->GetImmatureBalance(), nImmature);
+
+    // One more block matures the first one, without touching the transaction
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    nImmature += block.vtx[0].vout[0].nValue - coinbaseTxns[0].vout[0].nValue;
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), coinbaseTxns[0].vout[0].nValue);
+    BOOST_CHECK_EQUAL(pwalletMain->GetImmatureBalance(), nImmature);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), 0);
+
+    // Spending it leaves only the change, once the spend is mined
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 11 * CENT + coinbaseTxns[1].vout[0].nValue);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), 0);
+
+    // The same totals come out of a full recomputation
+    CWalletBalances balances = pwalletMain->GetBalances();
+    pwalletMain->MarkDirty();
+    BOOST_CHECK(pwalletMain->GetBalances() == balances);
+
+    fCheckWalletBalances = false;
+}
+
+BOOST_FIXTURE_TEST_CASE(available_coins, TestChain100Setup)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<COutput> vCoins;
+
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKey(coinbaseKey));
+        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+    }
+
+    // Immature coinbases are not available
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK(vCoins.empty());
+
+    // Maturing the first coinbase does not touch its transaction
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    BOOST_CHECK(vCoins[0].tx->GetHash() == coinbaseTxns[0].GetHash());
+
+    // Spending it replaces it with the change
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+    std::set<COutPoint> setCoins;
+    BOOST_FOREACH(const COutput& out, vCoins)
+        setCoins.insert(COutPoint(out.tx->GetHash(), out.i));
+    BOOST_CHECK(setCoins.count(COutPoint(spend.GetHash(), 0)));
+    BOOST_CHECK(setCoins.count(COutPoint(coinbaseTxns[1].GetHash(), 0)));
+
+    // Locked coins are skipped, and the index agrees with a full rebuild
+    COutPoint outpointChange(spend.GetHash(), 0);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->LockCoin(outpointChange);
+    }
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    pwalletMain->MarkDirty();
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    BOOST_CHECK(vCoins[0].tx->GetHash() == coinbaseTxns[1].GetHash());
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->UnlockCoin(outpointChange);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
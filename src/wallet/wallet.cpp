@@ -48,6 +48,7 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
+bool fCheckWalletBalances = false;
 
 /** 
  * Fees smaller than this (in duffs) are considered zero fee (for transaction creation)
@@ -703,6 +704,21 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
 
+    if (!fAvailableOutputsDirtyAll) {
+        AvailableOutputs::iterator it = mapAvailableOutputs.find(outpoint.hash);
+        if (it != mapAvailableOutputs.end()) {
+            std::vector<CAvailableOutput>& vOutputs = it->second.second;
+            for (size_t i = 0; i < vOutputs.size(); i++) {
+                if (vOutputs[i].n == outpoint.n) {
+                    vOutputs.erase(vOutputs.begin() + i);
+                    break;
+                }
+            }
+            if (vOutputs.empty())
+                mapAvailableOutputs.erase(it);
+        }
+    }
+
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData(range);
@@ -871,6 +887,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fBalancesDirtyAll = true;
+        fAvailableOutputsDirtyAll = true;
     }
 
     fAnonymizableTallyCached = false;
@@ -888,6 +906,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         AddToSpends(hash);
+        MarkAvailableOutputsDirty(hash);
         BOOST_FOREACH(const CTxIn& txin, wtx.vin) {
             if (mapWallet.count(txin.prevout.hash)) {
                 CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -956,6 +975,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                              wtxIn.hashBlock.ToString());
             }
             AddToSpends(hash);
+            UpdatePrivatePayRounds(hash);
         }
 
         bool fUpdated = false;
@@ -1236,63 +1256,47 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 // Recursively determine the rounds of a given input (How deep is the PrivatePay chain for a given input)
 int CWallet::GetRealInputPrivatePayRounds(CTxIn txin, int nRounds) const
 {
-    static std::map<uint256, CMutableTransaction> mDenomWtxes;
+    // GetTxPrivatePayRounds fills mapPrivatePayRounds
+    LOCK(cs_wallet);
 
     if(nRounds >= 16) return 15; // 16 rounds max
 
-    uint256 hash = txin.prevout.hash;
-    unsigned int nout = txin.prevout.n;
+    const CWalletTx* wtx = GetWalletTx(txin.prevout.hash);
+    if(wtx == NULL)
+        return nRounds - 1;
 
-    const CWalletTx* wtx = GetWalletTx(hash);
-    if(wtx != NULL)
-    {
-        std::map<uint256, CMutableTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        if (mdwi == mDenomWtxes.end()) {
-            // not known yet, let's add it
-            LogPrint("privatepay", "GetRealInputPrivatePayRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CMutableTransaction(*wtx);
-        } else if(mDenomWtxes[hash].vout[nout].nRounds != -10) {
-            // found and it's not an initial value, just return it
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
-
-        // bounds check
-        if (nout >= wtx->vout.size()) {
-            // should never actually hit this
-            LogPrint("privatepay", "GetRealInputPrivatePayRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
-            return -4;
-        }
+    // bounds check
+    if (txin.prevout.n >= wtx->vout.size()) {
+        // should never actually hit this
+        LogPrint("privatepay", "GetRealInputPrivatePayRounds -- %s %3d out of bounds\n", txin.prevout.hash.ToString(), txin.prevout.n);
+        return -4;
+    }
 
-        if (IsCollateralAmount(wtx->vout[nout].nValue)) {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("privatepay", "GetRealInputPrivatePayRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    return GetTxPrivatePayRounds(*wtx, nRounds)[txin.prevout.n];
+}
 
-        //make sure the final output is non-denominate
-        if (!IsDenominatedAmount(wtx->vout[nout].nValue)) { //NOT DENOM
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("privatepay", "GetRealInputPrivatePayRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+const std::vector<int>& CWallet::GetTxPrivatePayRounds(const CWalletTx& wtx, int nRounds) const
+{
+    AssertLockHeld(cs_wallet);
 
-        bool fAllDenoms = true;
-        BOOST_FOREACH(CTxOut out, wtx->vout) {
-            fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
-        }
+    const uint256& hash = wtx.GetHash();
+    std::map<uint256, std::vector<int> >::const_iterator it = mapPrivatePayRounds.find(hash);
+    if (it != mapPrivatePayRounds.end() && it->second.size() == wtx.vout.size())
+        return it->second;
 
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if (!fAllDenoms) {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("privatepay", "GetRealInputPrivatePayRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    bool fAllDenoms = true;
+    BOOST_FOREACH(const CTxOut& out, wtx.vout) {
+        fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
+    }
 
+    // Denominated outputs are all equally deep: 0 if there is another non-denominated
+    // output in the same tx, otherwise one more than the shortest chain among our inputs
+    int nDenomRounds = 0;
+    if (fAllDenoms) {
         int nShortest = -10; // an initial value, should be no way to get this by calculations
         bool fDenomFound = false;
         // only denoms here so let's look up
-        BOOST_FOREACH(CTxIn txinNext, wtx->vin) {
+        BOOST_FOREACH(const CTxIn& txinNext, wtx.vin) {
             if (IsMine(txinNext)) {
                 int n = GetRealInputPrivatePayRounds(txinNext, nRounds + 1);
                 // denom found, find the shortest chain or initially assign nShortest with the first found value
@@ -1302,14 +1306,51 @@ int CWallet::GetRealInputPrivatePayRounds(CTxIn txin, int nRounds) const
                 }
             }
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
+        nDenomRounds = fDenomFound
                 ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
                 : 0;            // too bad, we are the fist one in that chain
-        LogPrint("privatepay", "GetRealInputPrivatePayRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
     }
 
-    return nRounds - 1;
+    std::vector<int> vRounds(wtx.vout.size());
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsCollateralAmount(wtx.vout[i].nValue))
+            vRounds[i] = -3;
+        else if (!IsDenominatedAmount(wtx.vout[i].nValue)) //NOT DENOM
+            vRounds[i] = -2;
+        else
+            vRounds[i] = nDenomRounds;
+    }
+    LogPrint("privatepay", "GetTxPrivatePayRounds -- UPDATED %s %3d\n", hash.ToString(), nDenomRounds);
+
+    std::vector<int>& vRoundsRet = mapPrivatePayRounds[hash];
+    vRoundsRet.swap(vRounds);
+    return vRoundsRet;
+}
+
+void CWallet::UpdatePrivatePayRounds(const uint256& hashTx)
+{
+    AssertLockHeld(cs_wallet);
+
+    // Wallet transactions spending the new one may have been added before it,
+    // e.g. while rescanning, and counted it as a chain start
+    std::vector<uint256> vHashes(1, hashTx);
+    std::set<uint256> setSeen(vHashes.begin(), vHashes.end());
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(vHashes[i], 0));
+        for (; iter != mapTxSpends.end() && iter->first.hash == vHashes[i]; ++iter) {
+            if (setSeen.insert(iter->second).second)
+                vHashes.push_back(iter->second);
+        }
+    }
+
+    BOOST_FOREACH(const uint256& hash, vHashes) {
+        mapPrivatePayRounds.erase(hash);
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            continue;
+        // anonymized credit depends on the rounds
+        mi->second.MarkDirty();
+    }
 }
 
 // respect current settings
@@ -1669,6 +1710,27 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
 }
 
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fAnonymizedCreditCached = false;
+    fDenomUnconfCreditCached = false;
+    fDenomConfCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+
+    if (pwallet) {
+        pwallet->MarkBalancesDirty(GetHash());
+        pwallet->MarkAvailableOutputsDirty(GetHash());
+    }
+}
+
 bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
 {
     return pwalletdb->WriteTx(GetHash(), *this);
@@ -2033,6 +2095,27 @@ bool CWalletTx::InMempool() const
     return false;
 }
 
+CWalletBalances CWalletTx::GetBalances() const
+{
+    CWalletBalances balances;
+    if (IsTrusted()) {
+        balances.nTrusted = GetAvailableCredit();
+        balances.nWatchOnlyTrusted = GetAvailableWatchOnlyCredit();
+        if (!fLiteMode)
+            balances.nAnonymized = GetAnonymizedCredit();
+    } else if (GetDepthInMainChain() == 0 && InMempool()) {
+        balances.nUnconfirmed = GetAvailableCredit();
+        balances.nWatchOnlyUnconfirmed = GetAvailableWatchOnlyCredit();
+    }
+    balances.nImmature = GetImmatureCredit();
+    balances.nWatchOnlyImmature = GetImmatureWatchOnlyCredit();
+    if (!fLiteMode) {
+        balances.nDenominatedTrusted = GetDenominatedCredit(false);
+        balances.nDenominatedUnconfirmed = GetDenominatedCredit(true);
+    }
+    return balances;
+}
+
 bool CWalletTx::IsTrusted() const
 {
     // Quick answer in most cases
@@ -2131,20 +2214,75 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+void CWallet::MarkBalancesDirty(const uint256& hashTx) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK(cs_wallet);
+    if (!fBalancesDirtyAll)
+        setBalancesDirty.insert(hashTx);
+}
+
+void CWallet::UpdateTxBalances(const uint256& hashTx) const
+{
+    std::map<uint256, CWalletBalances>::iterator it = mapTxBalances.find(hashTx);
+    if (it != mapTxBalances.end()) {
+        balancesTotal -= it->second;
+        mapTxBalances.erase(it);
+    }
+    setBalancesVolatile.erase(hashTx);
+
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
+    if (mi == mapWallet.end())
+        return;
+    const CWalletTx& wtx = mi->second;
+
+    CWalletBalances balances = wtx.GetBalances();
+    if (!balances.IsNull()) {
+        balancesTotal += balances;
+        mapTxBalances.insert(std::make_pair(hashTx, balances));
+    }
+
+    if (wtx.GetDepthInMainChain(false) <= 0 || (wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0))
+        setBalancesVolatile.insert(hashTx);
+}
+
+CWalletBalances CWallet::GetBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+
+    // anonymized credit depends on the configured rounds
+    if (nBalancesPrivatePayRounds != privatePayClient.nPrivatePayRounds) {
+        nBalancesPrivatePayRounds = privatePayClient.nPrivatePayRounds;
+        fBalancesDirtyAll = true;
+    }
+
+    if (fBalancesDirtyAll) {
+        balancesTotal.SetNull();
+        mapTxBalances.clear();
+        setBalancesDirty.clear();
+        setBalancesVolatile.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+            UpdateTxBalances(it->first);
+        fBalancesDirtyAll = false;
+    } else {
+        setBalancesDirty.insert(setBalancesVolatile.begin(), setBalancesVolatile.end());
+        BOOST_FOREACH(const uint256& hash, setBalancesDirty)
+            UpdateTxBalances(hash);
+        setBalancesDirty.clear();
     }
 
-    return nTotal;
+    if (fCheckWalletBalances) {
+        CWalletBalances balancesScan;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            balancesScan += it->second.GetBalances();
+        assert(balancesScan == balancesTotal);
+    }
+
+    return balancesTotal;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nTrusted;
 }
 
 CAmount CWallet::GetAnonymizableBalance(bool fSkipDenominated, bool fSkipUnconfirmed) const
@@ -2173,19 +2311,7 @@ CAmount CWallet::GetAnonymizedBalance() const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAnonymizedCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -2282,92 +2408,82 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            nTotal += pcoin->GetDenominatedCredit(unconfirmed);
-        }
-    }
-
-    return nTotal;
+    CWalletBalances balances = GetBalances();
+    return unconfirmed ? balances.nDenominatedUnconfirmed : balances.nDenominatedTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchOnlyImmature;
+}
+
+void CWallet::MarkAvailableOutputsDirty(const uint256& hashTx) const
+{
+    LOCK(cs_wallet);
+    if (!fAvailableOutputsDirtyAll)
+        setAvailableOutputsDirty.insert(hashTx);
+}
+
+void CWallet::IndexAvailableOutputs(const uint256& hashTx) const
+{
+    mapAvailableOutputs.erase(hashTx);
+
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
+    if (mi == mapWallet.end())
+        return;
+    const CWalletTx* pcoin = &mi->second;
+
+    std::vector<CAvailableOutput> vOutputs;
+    for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+        CAvailableOutput output;
+        output.mine = IsMine(pcoin->vout[i]);
+        if (output.mine == ISMINE_NO || IsSpent(hashTx, i))
+            continue;
+        output.n = i;
+        output.fDenominated = IsDenominatedAmount(pcoin->vout[i].nValue);
+        output.fCollateral = IsCollateralAmount(pcoin->vout[i].nValue);
+        vOutputs.push_back(output);
+    }
+    if (!vOutputs.empty())
+        mapAvailableOutputs.insert(std::make_pair(hashTx, std::make_pair(pcoin, vOutputs)));
+}
+
+void CWallet::UpdateAvailableOutputs() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fAvailableOutputsDirtyAll) {
+        mapAvailableOutputs.clear();
+        setAvailableOutputsDirty.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
+            IndexAvailableOutputs(it->first);
+        fAvailableOutputsDirtyAll = false;
+    } else {
+        BOOST_FOREACH(const uint256& hash, setAvailableOutputsDirty)
+            IndexAvailableOutputs(hash);
+        setAvailableOutputsDirty.clear();
     }
-    return nTotal;
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue, AvailableCoinsType nCoinType, bool fUseInstaPay) const
@@ -2376,10 +2492,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateAvailableOutputs();
+        for (AvailableOutputs::const_iterator it = mapAvailableOutputs.begin(); it != mapAvailableOutputs.end(); ++it)
         {
             const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = it->second.first;
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -2400,30 +2517,31 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             if (nDepth == 0 && !pcoin->InMempool())
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            BOOST_FOREACH(const CAvailableOutput& output, it->second.second) {
+                const unsigned int i = output.n;
                 bool found = false;
                 if(nCoinType == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
+                    found = output.fDenominated;
                 } else if(nCoinType == ONLY_NOT100000IFMN) {
                     found = !(fMasterNode && pcoin->vout[i].nValue == 100000*COIN);
                 } else if(nCoinType == ONLY_NONDENOMINATED_NOT100000IFMN) {
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                    if (output.fCollateral) continue; // do not use collateral amounts
+                    found = !output.fDenominated;
                     if(found && fMasterNode) found = pcoin->vout[i].nValue != 100000*COIN; // do not use Hot MN funds
                 } else if(nCoinType == ONLY_100000) {
                     found = pcoin->vout[i].nValue == 100000*COIN;
                 } else if(nCoinType == ONLY_PRIVATEPAY_COLLATERAL) {
-                    found = IsCollateralAmount(pcoin->vout[i].nValue);
+                    found = output.fCollateral;
                 } else {
                     found = true;
                 }
                 if(!found) continue;
 
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    (!IsLockedCoin((*it).first, i) || nCoinType == ONLY_100000) &&
+                isminetype mine = output.mine;
+                if (!(IsSpent(wtxid, i)) &&
+                    (!IsLockedCoin(wtxid, i) || nCoinType == ONLY_100000) &&
                     (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO)));
@@ -3672,6 +3790,12 @@ DBErrors CWallet::ZapWalletTx(std::vector<CWalletTx>& vWtx)
     if (nZapWalletTxRet != DB_LOAD_OK)
         return nZapWalletTxRet;
 
+    {
+        LOCK(cs_wallet);
+        BOOST_FOREACH(const CWalletTx& wtx, vWtx)
+            mapPrivatePayRounds.erase(wtx.GetHash());
+    }
+
     return DB_LOAD_OK;
 }
 
@@ -4168,6 +4292,8 @@ bool CWallet::UpdatedTransaction(const uint256 &hashTx)
         // Only notify UI if this transaction is in this wallet
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()){
+            // InstaPay lock changes make the transaction count as trusted
+            MarkBalancesDirty(hashTx);
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
             return true;
         }
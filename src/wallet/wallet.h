@@ -39,6 +39,7 @@ extern CAmount maxTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
+extern bool fCheckWalletBalances;
 
 extern bool fLargeWorkForkFound;
 extern bool fLargeWorkInvalidChainFound;
@@ -117,6 +118,83 @@ struct CompactTallyItem
     }
 };
 
+/** Balance totals of a wallet by category, or the share of one transaction in them */
+struct CWalletBalances
+{
+    CAmount nTrusted;                   //!< GetBalance()
+    CAmount nUnconfirmed;               //!< GetUnconfirmedBalance()
+    CAmount nImmature;                  //!< GetImmatureBalance()
+    CAmount nWatchOnlyTrusted;          //!< GetWatchOnlyBalance()
+    CAmount nWatchOnlyUnconfirmed;      //!< GetUnconfirmedWatchOnlyBalance()
+    CAmount nWatchOnlyImmature;         //!< GetImmatureWatchOnlyBalance()
+    CAmount nAnonymized;                //!< GetAnonymizedBalance()
+    CAmount nDenominatedTrusted;        //!< GetDenominatedBalance(false)
+    CAmount nDenominatedUnconfirmed;    //!< GetDenominatedBalance(true)
+
+    CWalletBalances()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nTrusted = nUnconfirmed = nImmature = 0;
+        nWatchOnlyTrusted = nWatchOnlyUnconfirmed = nWatchOnlyImmature = 0;
+        nAnonymized = nDenominatedTrusted = nDenominatedUnconfirmed = 0;
+    }
+
+    bool IsNull() const
+    {
+        return *this == CWalletBalances();
+    }
+
+    CWalletBalances& operator+=(const CWalletBalances& b)
+    {
+        nTrusted += b.nTrusted;
+        nUnconfirmed += b.nUnconfirmed;
+        nImmature += b.nImmature;
+        nWatchOnlyTrusted += b.nWatchOnlyTrusted;
+        nWatchOnlyUnconfirmed += b.nWatchOnlyUnconfirmed;
+        nWatchOnlyImmature += b.nWatchOnlyImmature;
+        nAnonymized += b.nAnonymized;
+        nDenominatedTrusted += b.nDenominatedTrusted;
+        nDenominatedUnconfirmed += b.nDenominatedUnconfirmed;
+        return *this;
+    }
+
+    CWalletBalances& operator-=(const CWalletBalances& b)
+    {
+        nTrusted -= b.nTrusted;
+        nUnconfirmed -= b.nUnconfirmed;
+        nImmature -= b.nImmature;
+        nWatchOnlyTrusted -= b.nWatchOnlyTrusted;
+        nWatchOnlyUnconfirmed -= b.nWatchOnlyUnconfirmed;
+        nWatchOnlyImmature -= b.nWatchOnlyImmature;
+        nAnonymized -= b.nAnonymized;
+        nDenominatedTrusted -= b.nDenominatedTrusted;
+        nDenominatedUnconfirmed -= b.nDenominatedUnconfirmed;
+        return *this;
+    }
+
+    friend bool operator==(const CWalletBalances& a, const CWalletBalances& b)
+    {
+        return a.nTrusted == b.nTrusted &&
+               a.nUnconfirmed == b.nUnconfirmed &&
+               a.nImmature == b.nImmature &&
+               a.nWatchOnlyTrusted == b.nWatchOnlyTrusted &&
+               a.nWatchOnlyUnconfirmed == b.nWatchOnlyUnconfirmed &&
+               a.nWatchOnlyImmature == b.nWatchOnlyImmature &&
+               a.nAnonymized == b.nAnonymized &&
+               a.nDenominatedTrusted == b.nDenominatedTrusted &&
+               a.nDenominatedUnconfirmed == b.nDenominatedUnconfirmed;
+    }
+
+    friend bool operator!=(const CWalletBalances& a, const CWalletBalances& b)
+    {
+        return !(a == b);
+    }
+};
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -413,21 +491,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fAnonymizedCreditCached = false;
-        fDenomUnconfCreditCached = false;
-        fDenomConfCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -447,6 +511,9 @@ public:
     CAmount GetAnonymizedCredit(bool fUseCache=true) const;
     CAmount GetDenominatedCredit(bool unconfirmed, bool fUseCache=true) const;
 
+    //! share of this transaction in each of the wallet balance totals
+    CWalletBalances GetBalances() const;
+
     void GetAmounts(std::list<COutputEntry>& listReceived,
                     std::list<COutputEntry>& listSent, CAmount& nFee, std::string& strSentAccount, const isminefilter& filter) const;
 
@@ -638,6 +705,54 @@ private:
     mutable bool fAnonymizableTallyCachedNonDenom;
     mutable std::vector<CompactTallyItem> vecAnonymizableTallyCachedNonDenom;
 
+    /**
+     * PrivatePay rounds of every output of each wallet transaction, see
+     * GetRealInputPrivatePayRounds. Filled in on first use, so every mixing
+     * chain is walked once per run.
+     */
+    mutable std::map<uint256, std::vector<int> > mapPrivatePayRounds;
+    const std::vector<int>& GetTxPrivatePayRounds(const CWalletTx& wtx, int nRounds) const;
+    /* Forget the rounds of a new wallet transaction and of its in-wallet descendants. */
+    void UpdatePrivatePayRounds(const uint256& hashTx);
+
+    /**
+     * Running balance totals: the sum of the last GetBalances() of every wallet
+     * transaction in mapTxBalances (zero shares are left out). Transactions
+     * marked dirty are recomputed on the next query, and so are the volatile
+     * ones whose share can change with the chain tip or the mempool alone:
+     * unconfirmed, conflicted and immature transactions. Everything else only
+     * changes along with CWalletTx::MarkDirty().
+     */
+    mutable CWalletBalances balancesTotal;
+    mutable std::map<uint256, CWalletBalances> mapTxBalances;
+    mutable std::set<uint256> setBalancesDirty;
+    mutable std::set<uint256> setBalancesVolatile;
+    mutable bool fBalancesDirtyAll;
+    mutable int nBalancesPrivatePayRounds;
+    void UpdateTxBalances(const uint256& hashTx) const;
+
+    /** An output of a wallet transaction that AvailableCoins() may return */
+    struct CAvailableOutput
+    {
+        unsigned int n;
+        isminetype mine;
+        bool fDenominated;
+        bool fCollateral;
+    };
+    /**
+     * The outputs AvailableCoins() looks at: per wallet transaction, the ones
+     * that were ours and unspent when the transaction was last indexed. A new
+     * spend drops its outpoint right away, and transactions marked dirty are
+     * reindexed on the next call. Outputs spent otherwise in the meantime may
+     * still be listed; AvailableCoins() checks them again anyway.
+     */
+    typedef std::map<uint256, std::pair<const CWalletTx*, std::vector<CAvailableOutput> > > AvailableOutputs;
+    mutable AvailableOutputs mapAvailableOutputs;
+    mutable std::set<uint256> setAvailableOutputsDirty;
+    mutable bool fAvailableOutputsDirtyAll;
+    void IndexAvailableOutputs(const uint256& hashTx) const;
+    void UpdateAvailableOutputs() const;
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -726,6 +841,9 @@ public:
         fBroadcastTransactions = false;
         fAnonymizableTallyCached = false;
         fAnonymizableTallyCachedNonDenom = false;
+        fBalancesDirtyAll = true;
+        nBalancesPrivatePayRounds = 0;
+        fAvailableOutputsDirtyAll = true;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
     }
@@ -865,6 +983,12 @@ public:
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
+    /** Balance totals by category, see CWalletBalances */
+    CWalletBalances GetBalances() const;
+    /** Have the share of a transaction in the balance totals recomputed on the next query */
+    void MarkBalancesDirty(const uint256& hashTx) const;
+    /** Have the outputs of a transaction reindexed for AvailableCoins() on the next call */
+    void MarkAvailableOutputsDirty(const uint256& hashTx) const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;